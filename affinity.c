@@ -0,0 +1,168 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+// Thread placement on NUMA nodes.
+// The layout is read from sysfs so that no additional library is needed.
+// Memory is placed by first touch: buffers are allocated and cleared by the thread that uses them
+// after it has been bound to its node.
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "affinity.h"
+
+// maximal node id that is probed
+static const int MAX_NODES = 1024;
+
+/*
+ * Parses a cpu list (e.g. 0-3,8,10-11) and appends all listed cpus that are also in allowed to cpus.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+static int parse_cpulist(const char *list, const cpu_set_t *allowed, int **cpus, int *n_cpus)
+{
+    const char *current = list;
+    while (*current != '\0' && *current != '\n') {
+        char *end = NULL;
+        long first = strtol(current, &end, 10);
+        if (end == current) return 1;
+
+        long last = first;
+        if (*end == '-') {
+            current = end + 1;
+            last = strtol(current, &end, 10);
+            if (end == current) return 1;
+        }
+
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) {
+            if (!CPU_ISSET(cpu, allowed)) continue;
+            int *grown = realloc(*cpus, (*n_cpus + 1) * sizeof(int));
+            if (grown == NULL) return 1;
+            *cpus = grown;
+            (*cpus)[(*n_cpus)++] = (int) cpu;
+        }
+
+        current = (*end == ',') ? end + 1 : end;
+    }
+
+    return 0;
+}
+
+/*
+ * Adds a node with the given cpus to the layout.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+static int add_node(numa_layout_t *layout, int id, int *cpus, int n_cpus)
+{
+    int *ids = realloc(layout->node_ids, (layout->n_nodes + 1) * sizeof(int));
+    if (ids == NULL) return 1;
+    layout->node_ids = ids;
+
+    int *counts = realloc(layout->n_cpus, (layout->n_nodes + 1) * sizeof(int));
+    if (counts == NULL) return 1;
+    layout->n_cpus = counts;
+
+    int **lists = realloc(layout->cpus, (layout->n_nodes + 1) * sizeof(int *));
+    if (lists == NULL) return 1;
+    layout->cpus = lists;
+
+    layout->node_ids[layout->n_nodes] = id;
+    layout->n_cpus[layout->n_nodes] = n_cpus;
+    layout->cpus[layout->n_nodes] = cpus;
+    layout->n_nodes++;
+    return 0;
+}
+
+numa_layout_t *numa_detect(void)
+{
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) != 0) return NULL;
+
+    numa_layout_t *layout = calloc(1, sizeof(numa_layout_t));
+    if (layout == NULL) return NULL;
+
+    char path[128] = "";
+    char line[4096] = "";
+    for (int id = 0; id < MAX_NODES; ++id) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", id);
+        FILE *file = fopen(path, "r");
+        if (file == NULL) continue;
+
+        int *cpus = NULL, n_cpus = 0;
+        int failed = fgets(line, sizeof(line), file) == NULL || parse_cpulist(line, &allowed, &cpus, &n_cpus) != 0;
+        fclose(file);
+
+        // nodes without usable cpus (e.g. memory-only nodes or nodes excluded by cpuset) are ignored
+        if (failed || n_cpus == 0 || add_node(layout, id, cpus, n_cpus) != 0) {
+            free(cpus);
+            continue;
+        }
+    }
+
+    // no NUMA information available: treat the machine as a single node
+    if (layout->n_nodes == 0) {
+        int *cpus = NULL, n_cpus = 0;
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (!CPU_ISSET(cpu, &allowed)) continue;
+            int *grown = realloc(cpus, (n_cpus + 1) * sizeof(int));
+            if (grown == NULL) break;
+            cpus = grown;
+            cpus[n_cpus++] = cpu;
+        }
+
+        if (n_cpus == 0 || add_node(layout, 0, cpus, n_cpus) != 0) {
+            free(cpus);
+            numa_destroy(layout);
+            return NULL;
+        }
+    }
+
+    return layout;
+}
+
+int numa_bind_thread(const numa_layout_t *layout, int node)
+{
+    if (node < 0 || node >= layout->n_nodes) return 1;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int i = 0; i < layout->n_cpus[node]; ++i) {
+        CPU_SET(layout->cpus[node][i], &set);
+    }
+
+    // on Linux, pid 0 refers to the calling thread
+    return sched_setaffinity(0, sizeof(cpu_set_t), &set);
+}
+
+void numa_cpulist(const numa_layout_t *layout, int node, char *buffer, size_t size)
+{
+    size_t written = 0;
+    buffer[0] = '\0';
+
+    const int *cpus = layout->cpus[node];
+    for (int i = 0; i < layout->n_cpus[node] && written < size; ++i) {
+        int first = cpus[i];
+        while (i + 1 < layout->n_cpus[node] && cpus[i + 1] == cpus[i] + 1) ++i;
+
+        int n = 0;
+        if (cpus[i] == first) n = snprintf(buffer + written, size - written, "%s%d", written ? "," : "", first);
+        else n = snprintf(buffer + written, size - written, "%s%d-%d", written ? "," : "", first, cpus[i]);
+        if (n < 0) return;
+        written += (size_t) n;
+    }
+}
+
+void numa_destroy(numa_layout_t *layout)
+{
+    if (layout == NULL) return;
+
+    for (int i = 0; i < layout->n_nodes; ++i) {
+        free(layout->cpus[i]);
+    }
+    free(layout->cpus);
+    free(layout->n_cpus);
+    free(layout->node_ids);
+    free(layout);
+}
@@ -0,0 +1,37 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <stddef.h>
+
+/* NUMA nodes available to the process */
+typedef struct numa_layout {
+    int n_nodes;
+    int *node_ids;      // ids of the nodes as reported by the kernel
+    int *n_cpus;        // number of usable cpus of each node
+    int **cpus;         // usable cpus of each node
+} numa_layout_t;
+
+/*
+ * Detects NUMA nodes and their cpus usable by this process.
+ * If the machine provides no NUMA information, a single node containing all usable cpus is returned.
+ * Returns NULL, if the layout could not be determined.
+ */
+numa_layout_t *numa_detect(void);
+
+/*
+ * Restricts the calling thread to the cpus of the node with the given index.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+int numa_bind_thread(const numa_layout_t *layout, int node);
+
+/*
+ * Writes the cpus of the node with the given index into buffer as a cpu list (e.g. 0-15,32-47).
+ */
+void numa_cpulist(const numa_layout_t *layout, int node, char *buffer, size_t size);
+
+void numa_destroy(numa_layout_t *layout);
+
+#endif /* AFFINITY_H */
@@ -0,0 +1,730 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+// Batch centering of multiple xtc trajectories with a work-stealing scheduler.
+//
+// All trajectories are indexed first. Each worker owns a deque of frame-range tasks and processes
+// its ranges front to back in grains of a few megabytes, returning the rest of the range into its
+// deque before processing the grain. An idle worker steals the oldest task of another worker,
+// splitting it in half if it is large enough, so one huge trajectory ends up spread over all workers.
+//
+// Output of every trajectory stays ordered: the range starting at the first frame is written
+// directly into the output file, every stolen range is written into its own segment file next
+// to the output. Segments are appended to the output in frame order once the trajectory is done.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "batch.h"
+#include "affinity.h"
+#include "checksum.h"
+#include "frame.h"
+#include "frameindex.h"
+#include "io.h"
+#include "xtc.h"
+
+// approximate amount of input data processed in one grain
+static const size_t GRAIN_BYTES = 8 * 1024 * 1024;
+// maximal number of frames in one grain
+static const size_t GRAIN_FRAMES = 4096;
+// idle workers look for work again after this time (in nanoseconds)
+static const long IDLE_WAIT = 1000000;
+
+/* contiguous part of an output trajectory written by one worker at a time */
+typedef struct segment {
+    size_t first;               // first frame of the segment
+    char *path;                 // NULL for the segment written directly into the output file
+    int fd;
+} segment_t;
+
+typedef struct job {
+    const char *input_file;
+    const char *output_file;
+    int input;
+    frame_index_t index;
+    size_t grain;               // number of frames in one grain
+    uint32_t *checksums;        // checksums of the centered frames (if requested), indexed by input frame
+    size_t *output_sizes;       // sizes of the centered frames (if checksums are requested)
+
+    // guarded by the lock of the batch
+    segment_t **segments;
+    size_t n_segments;
+    size_t remaining;           // frames not processed yet
+    size_t failed_frame;        // first frame that could not be processed (SIZE_MAX if none)
+} job_t;
+
+/* frame range [first, last) of a job */
+typedef struct task {
+    job_t *job;
+    size_t first;
+    size_t last;
+    segment_t *segment;         // segment into which the range is written
+} task_t;
+
+typedef struct deque {
+    pthread_mutex_t lock;
+    task_t *tasks;              // owner works at the end, thieves steal from the start
+    size_t n_tasks;
+    size_t capacity;
+} deque_t;
+
+struct batch;
+
+typedef struct batch_worker {
+    struct batch *batch;
+    int id;
+    int node;                   // index of the NUMA node the worker is bound to (-1 if unbound)
+    pthread_t thread;
+    deque_t deque;
+    frame_workspace_t workspace;
+    unsigned char *input;
+    unsigned char *output;
+    size_t n_stolen;            // number of tasks stolen by this worker
+    size_t n_centered;          // number of frames centered by this worker
+    size_t n_quantized;         // number of frames centered in the integer domain
+} batch_worker_t;
+
+typedef struct batch {
+    const pipeline_config_t *config;
+    numa_layout_t *layout;
+    size_t frame_bound;
+
+    job_t *jobs;
+    size_t n_jobs;
+    batch_worker_t *workers;
+
+    pthread_mutex_t lock;
+    size_t outstanding;         // frames of all jobs not processed yet
+    int error;
+} batch_t;
+
+/*
+ * Adds task to the end of the deque.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+static int push_task(deque_t *deque, task_t task)
+{
+    pthread_mutex_lock(&deque->lock);
+    if (deque->n_tasks == deque->capacity) {
+        size_t capacity = deque->capacity == 0 ? 16 : 2 * deque->capacity;
+        task_t *grown = realloc(deque->tasks, capacity * sizeof(task_t));
+        if (grown == NULL) {
+            pthread_mutex_unlock(&deque->lock);
+            return 1;
+        }
+        deque->tasks = grown;
+        deque->capacity = capacity;
+    }
+    deque->tasks[deque->n_tasks++] = task;
+    pthread_mutex_unlock(&deque->lock);
+    return 0;
+}
+
+/*
+ * Removes the last task of the deque of the worker.
+ * Returns non-zero, if a task has been obtained.
+ */
+static int pop_task(deque_t *deque, task_t *task)
+{
+    pthread_mutex_lock(&deque->lock);
+    int found = deque->n_tasks > 0;
+    if (found) *task = deque->tasks[--deque->n_tasks];
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+/*
+ * Takes the oldest task of the victim. Tasks of at least two grains are split in half
+ * and the thief takes the later half.
+ * Returns non-zero, if a task has been obtained.
+ */
+static int take_task(deque_t *victim, task_t *task)
+{
+    pthread_mutex_lock(&victim->lock);
+    int found = victim->n_tasks > 0;
+    if (found) {
+        task_t *oldest = &victim->tasks[0];
+        const size_t length = oldest->last - oldest->first;
+        if (length >= 2 * oldest->job->grain) {
+            *task = *oldest;
+            task->first = oldest->first + length / 2;
+            oldest->last = task->first;
+        } else {
+            *task = *oldest;
+            memmove(victim->tasks, victim->tasks + 1, (victim->n_tasks - 1) * sizeof(task_t));
+            victim->n_tasks--;
+        }
+    }
+    pthread_mutex_unlock(&victim->lock);
+    return found;
+}
+
+/*
+ * Creates a new segment of the output of job starting at frame first.
+ * Returns the segment or NULL, if it could not be created.
+ */
+static segment_t *create_segment(batch_t *batch, job_t *job, size_t first)
+{
+    segment_t *segment = calloc(1, sizeof(segment_t));
+    if (segment == NULL) return NULL;
+    segment->first = first;
+
+    const size_t length = strlen(job->output_file) + 32;
+    segment->path = malloc(length);
+    if (segment->path == NULL) {
+        free(segment);
+        return NULL;
+    }
+    snprintf(segment->path, length, "%s.part%zu", job->output_file, first);
+
+    segment->fd = open(segment->path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (segment->fd < 0) {
+        fprintf(stderr, "File %s could not be opened for writing.\n", segment->path);
+        free(segment->path);
+        free(segment);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&batch->lock);
+    segment_t **grown = realloc(job->segments, (job->n_segments + 1) * sizeof(segment_t *));
+    if (grown != NULL) {
+        job->segments = grown;
+        job->segments[job->n_segments++] = segment;
+    }
+    pthread_mutex_unlock(&batch->lock);
+
+    if (grown == NULL) {
+        close(segment->fd);
+        unlink(segment->path);
+        free(segment->path);
+        free(segment);
+        return NULL;
+    }
+
+    return segment;
+}
+
+/*
+ * Marks frames [first, last) of job as processed.
+ * Returns non-zero, if this has been the last unprocessed range of the job.
+ */
+static int complete_range(batch_t *batch, job_t *job, size_t first, size_t last)
+{
+    pthread_mutex_lock(&batch->lock);
+    job->remaining -= last - first;
+    batch->outstanding -= last - first;
+    int done = job->remaining == 0;
+    pthread_mutex_unlock(&batch->lock);
+    return done;
+}
+
+/*
+ * Records that frame of job could not be processed.
+ */
+static void fail_frame(batch_t *batch, job_t *job, size_t frame, int error)
+{
+    pthread_mutex_lock(&batch->lock);
+    if (frame < job->failed_frame) job->failed_frame = frame;
+    if (error) batch->error = 1;
+    pthread_mutex_unlock(&batch->lock);
+}
+
+/*
+ * Centers frames [first, last) of job and writes them into segment.
+ */
+static void process_range(batch_worker_t *worker, job_t *job, segment_t *segment, size_t first, size_t last)
+{
+    batch_t *batch = worker->batch;
+    const pipeline_config_t *config = batch->config;
+
+    pthread_mutex_lock(&batch->lock);
+    const size_t failed_frame = job->failed_frame;
+    pthread_mutex_unlock(&batch->lock);
+
+    for (size_t frame = first; frame < last && frame < failed_frame; ++frame) {
+        if (frame % (size_t) config->skip != 0) continue;
+
+        const size_t size = frame_index_size(&job->index, frame);
+        xtc_header_t header = {0};
+        if (pread_full(job->input, worker->input, size, (off_t) job->index.offsets[frame]) != (ssize_t) size ||
+                xtc_parse_header(worker->input, &header) != 0) {
+            fprintf(stderr, "\nFrame %zu of %s could not be read.\n", frame, job->input_file);
+            fail_frame(batch, job, frame, 1);
+            return;
+        }
+
+        size_t output_size = 0;
+        frame_result_t result = frame_center(config, &worker->workspace, &header, worker->input,
+                worker->output, batch->frame_bound, &output_size);
+
+        if (result == FRAME_CORRUPTED) {
+            fprintf(stderr, "\nFrame %zu of %s could not be decoded.\n", frame, job->input_file);
+            fail_frame(batch, job, frame, 1);
+            return;
+        }
+
+        if (result == FRAME_UNENCODABLE) {
+            fprintf(stderr, "\nFrame %zu of %s could not be encoded.\n", frame, job->input_file);
+            fail_frame(batch, job, frame, 1);
+            return;
+        }
+
+        if (write_full(segment->fd, worker->output, output_size) != 0) {
+            fprintf(stderr, "\nWriting into %s has failed.\n", segment->path != NULL ? segment->path : job->output_file);
+            fail_frame(batch, job, frame, 1);
+            return;
+        }
+
+        if (job->checksums != NULL) {
+            job->checksums[frame] = crc32c(worker->output, output_size);
+            job->output_sizes[frame] = output_size;
+        }
+
+        worker->n_centered++;
+        if (worker->workspace.buffer.is_quantized && !worker->workspace.buffer.is_precise) worker->n_quantized++;
+    }
+}
+
+/*
+ * Appends the contents of the segment file in to out.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+static int append_segment(int out, int in)
+{
+    off_t offset = 0;
+    for (;;) {
+        ssize_t n = copy_file_range(in, &offset, out, NULL, 64 * 1024 * 1024, 0);
+        if (n > 0) continue;
+        if (n == 0) return 0;
+        if (errno == EINTR) continue;
+        break;
+    }
+
+    // copy_file_range is not supported for this pair of files
+    unsigned char buffer[64 * 1024];
+    for (;;) {
+        ssize_t n = pread_full(in, buffer, sizeof(buffer), offset);
+        if (n < 0) return 1;
+        if (n == 0) return 0;
+        if (write_full(out, buffer, (size_t) n) != 0) return 1;
+        offset += n;
+    }
+}
+
+static int compare_segments(const void *a, const void *b)
+{
+    const segment_t *first = *(segment_t *const *) a;
+    const segment_t *second = *(segment_t *const *) b;
+    return (first->first > second->first) - (first->first < second->first);
+}
+
+/*
+ * Appends all segments of a finished job to its output file in frame order and removes them.
+ * Segments starting after a failed frame are discarded.
+ */
+static void finish_job(batch_t *batch, job_t *job)
+{
+    // no other thread touches the job anymore
+    qsort(job->segments, job->n_segments, sizeof(segment_t *), compare_segments);
+    const int output = job->segments[0]->fd;
+
+    int failed = job->failed_frame != SIZE_MAX;
+    for (size_t i = 1; i < job->n_segments; ++i) {
+        segment_t *segment = job->segments[i];
+        if (segment->first < job->failed_frame && append_segment(output, segment->fd) != 0) {
+            fprintf(stderr, "\nCould not append %s to %s.\n", segment->path, job->output_file);
+            failed = 1;
+        }
+        close(segment->fd);
+        unlink(segment->path);
+        segment->fd = -1;
+    }
+
+    if (close(output) != 0) failed = 1;
+    job->segments[0]->fd = -1;
+
+    // checksums are recorded for all frames present in the output
+    if (job->checksums != NULL) {
+        checksum_file_t sidecar;
+        if (checksum_file_open(&sidecar, job->output_file) != 0) {
+            failed = 1;
+        } else {
+            for (size_t frame = 0; frame < job->index.n_frames && frame < job->failed_frame; frame += (size_t) batch->config->skip) {
+                if (checksum_file_add(&sidecar, job->output_sizes[frame], job->checksums[frame]) != 0) break;
+            }
+            if (checksum_file_close(&sidecar) != 0) failed = 1;
+        }
+    }
+
+    if (failed) {
+        pthread_mutex_lock(&batch->lock);
+        batch->error = 1;
+        pthread_mutex_unlock(&batch->lock);
+        fprintf(stderr, "\nCentering of %s has failed.\n", job->input_file);
+    } else {
+        printf("Centered %s -> %s (%zu frames).\n", job->input_file, job->output_file, job->index.n_frames);
+        fflush(stdout);
+    }
+}
+
+/*
+ * Steals a task from another worker. Workers on the same NUMA node are tried first.
+ * Every stolen range gets its own output segment.
+ * Returns non-zero, if a task has been obtained.
+ */
+static int steal_task(batch_worker_t *worker, task_t *task)
+{
+    batch_t *batch = worker->batch;
+    const int n_workers = batch->config->n_threads;
+
+    for (int pass = 0; pass < 2; ++pass) {
+        for (int i = 1; i < n_workers; ++i) {
+            batch_worker_t *victim = &batch->workers[(worker->id + i) % n_workers];
+            if ((victim->node == worker->node) != (pass == 0)) continue;
+            if (!take_task(&victim->deque, task)) continue;
+
+            task->segment = create_segment(batch, task->job, task->first);
+            if (task->segment == NULL) {
+                // the range cannot be written anywhere, so the output of the job ends before it
+                fail_frame(batch, task->job, task->first, 1);
+                if (complete_range(batch, task->job, task->first, task->last)) finish_job(batch, task->job);
+                return 0;
+            }
+
+            worker->n_stolen++;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void *run_worker(void *arg)
+{
+    batch_worker_t *worker = (batch_worker_t *) arg;
+    batch_t *batch = worker->batch;
+
+    if (worker->node >= 0 && numa_bind_thread(batch->layout, worker->node) != 0) {
+        fprintf(stderr, "Warning. Worker %d could not be bound to NUMA node %d.\n", worker->id, batch->layout->node_ids[worker->node]);
+    }
+
+    worker->input = malloc(batch->frame_bound + XTC_PADDING);
+    worker->output = malloc(batch->frame_bound);
+    if (worker->input == NULL || worker->output == NULL ||
+            frame_workspace_init(&worker->workspace, batch->config->n_atoms) != 0) {
+        fprintf(stderr, "Could not allocate memory for worker %d.\n", worker->id);
+        pthread_mutex_lock(&batch->lock);
+        batch->error = 1;
+        pthread_mutex_unlock(&batch->lock);
+        // the tasks of this worker are taken over by the others
+        return NULL;
+    }
+    memset(worker->input, 0, batch->frame_bound + XTC_PADDING);
+
+    for (;;) {
+        task_t task;
+        if (!pop_task(&worker->deque, &task) && !steal_task(worker, &task)) {
+            pthread_mutex_lock(&batch->lock);
+            int done = batch->outstanding == 0;
+            pthread_mutex_unlock(&batch->lock);
+            if (done) break;
+
+            struct timespec wait = { 0, IDLE_WAIT };
+            nanosleep(&wait, NULL);
+            continue;
+        }
+
+        job_t *job = task.job;
+        const size_t last = task.last - task.first > job->grain ? task.first + job->grain : task.last;
+
+        // the rest of the range is available for stealing while the grain is processed
+        if (last < task.last) {
+            task_t rest = task;
+            rest.first = last;
+            if (push_task(&worker->deque, rest) != 0) {
+                process_range(worker, job, task.segment, task.first, task.last);
+                if (complete_range(batch, job, task.first, task.last)) finish_job(batch, job);
+                continue;
+            }
+        }
+
+        process_range(worker, job, task.segment, task.first, last);
+        if (complete_range(batch, job, task.first, last)) finish_job(batch, job);
+    }
+
+    return NULL;
+}
+
+/*
+ * Reads the list of trajectories.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+static int read_list(const char *list_file, batch_t *batch)
+{
+    FILE *file = fopen(list_file, "r");
+    if (file == NULL) {
+        fprintf(stderr, "File %s could not be read.\n", list_file);
+        return 1;
+    }
+
+    char line[8192] = "";
+    size_t line_number = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        ++line_number;
+        char input[4096] = "", output[4096] = "";
+        int n = sscanf(line, "%4095s %4095s", input, output);
+        if (n <= 0 || input[0] == '#') continue;
+
+        if (n != 2) {
+            fprintf(stderr, "Line %zu of %s does not contain an input and an output file.\n", line_number, list_file);
+            fclose(file);
+            return 1;
+        }
+
+        if (!strcmp(input, output)) {
+            fprintf(stderr, "Input xtc file %s and output file %s are the same file.\n", input, output);
+            fclose(file);
+            return 1;
+        }
+
+        job_t *grown = realloc(batch->jobs, (batch->n_jobs + 1) * sizeof(job_t));
+        if (grown == NULL) {
+            fclose(file);
+            return 1;
+        }
+        batch->jobs = grown;
+
+        job_t *job = &batch->jobs[batch->n_jobs++];
+        memset(job, 0, sizeof(job_t));
+        job->input = -1;
+        job->input_file = strdup(input);
+        job->output_file = strdup(output);
+        if (job->input_file == NULL || job->output_file == NULL) {
+            fclose(file);
+            return 1;
+        }
+    }
+
+    fclose(file);
+
+    if (batch->n_jobs == 0) {
+        fprintf(stderr, "No trajectories listed in %s.\n", list_file);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Opens and indexes the input of job and creates its output file.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+static int prepare_job(batch_t *batch, job_t *job)
+{
+    job->input = open(job->input_file, O_RDONLY);
+    if (job->input < 0) {
+        fprintf(stderr, "File %s could not be read as an xtc file.\n", job->input_file);
+        return 1;
+    }
+
+    if (frame_index_build(job->input, (int) batch->config->n_atoms, batch->config->n_threads, &job->index) != 0) {
+        fprintf(stderr, "File %s could not be indexed. Does the number of atoms match the gro file?\n", job->input_file);
+        return 1;
+    }
+
+    segment_t *segment = calloc(1, sizeof(segment_t));
+    job->segments = malloc(sizeof(segment_t *));
+    if (segment == NULL || job->segments == NULL) {
+        free(segment);
+        return 1;
+    }
+    job->segments[0] = segment;
+    job->n_segments = 1;
+
+    segment->fd = open(job->output_file, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (segment->fd < 0) {
+        fprintf(stderr, "File %s could not be opened for writing.\n", job->output_file);
+        return 1;
+    }
+
+    const size_t n_frames = job->index.n_frames;
+    const size_t average = n_frames > 0 ? (size_t) (job->index.offsets[n_frames] / n_frames) : 1;
+    job->grain = GRAIN_BYTES / (average > 0 ? average : 1);
+    if (job->grain < 1) job->grain = 1;
+    if (job->grain > GRAIN_FRAMES) job->grain = GRAIN_FRAMES;
+
+    if (batch->config->checksums) {
+        job->checksums = calloc(n_frames + 1, sizeof(uint32_t));
+        job->output_sizes = calloc(n_frames + 1, sizeof(size_t));
+        if (job->checksums == NULL || job->output_sizes == NULL) {
+            fprintf(stderr, "Could not allocate memory for the checksums of %s.\n", job->input_file);
+            return 1;
+        }
+    }
+
+    job->remaining = n_frames;
+    job->failed_frame = SIZE_MAX;
+    return 0;
+}
+
+static void destroy_job(job_t *job)
+{
+    for (size_t i = 0; i < job->n_segments; ++i) {
+        if (job->segments[i]->fd >= 0) close(job->segments[i]->fd);
+        free(job->segments[i]->path);
+        free(job->segments[i]);
+    }
+    free(job->segments);
+    if (job->input >= 0) close(job->input);
+    frame_index_free(&job->index);
+    free(job->checksums);
+    free(job->output_sizes);
+    free((char *) job->input_file);
+    free((char *) job->output_file);
+}
+
+static int compare_jobs(const void *a, const void *b)
+{
+    const job_t *first = *(job_t *const *) a;
+    const job_t *second = *(job_t *const *) b;
+    const uint64_t size_first = first->index.offsets[first->index.n_frames];
+    const uint64_t size_second = second->index.offsets[second->index.n_frames];
+    return (size_first < size_second) - (size_first > size_second);
+}
+
+/*
+ * Assigns whole trajectories to workers, the largest ones first.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+static int distribute_jobs(batch_t *batch)
+{
+    job_t **order = malloc(batch->n_jobs * sizeof(job_t *));
+    if (order == NULL) return 1;
+    for (size_t i = 0; i < batch->n_jobs; ++i) order[i] = &batch->jobs[i];
+    qsort(order, batch->n_jobs, sizeof(job_t *), compare_jobs);
+
+    size_t next = 0;
+    for (size_t i = 0; i < batch->n_jobs; ++i) {
+        job_t *job = order[i];
+        batch->outstanding += job->index.n_frames;
+
+        if (job->index.n_frames == 0) {
+            finish_job(batch, job);
+            continue;
+        }
+
+        task_t task = { job, 0, job->index.n_frames, job->segments[0] };
+        batch_worker_t *worker = &batch->workers[next++ % (size_t) batch->config->n_threads];
+        if (push_task(&worker->deque, task) != 0) {
+            free(order);
+            return 1;
+        }
+    }
+
+    free(order);
+    return 0;
+}
+
+int batch_run(const pipeline_config_t *config, const char *list_file)
+{
+    batch_t batch = {0};
+    batch.config = config;
+    batch.frame_bound = xtc_frame_bound((int) config->n_atoms);
+    pthread_mutex_init(&batch.lock, NULL);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int error = read_list(list_file, &batch);
+    for (size_t i = 0; !error && i < batch.n_jobs; ++i) {
+        error = prepare_job(&batch, &batch.jobs[i]);
+    }
+
+    batch.workers = error ? NULL : calloc((size_t) config->n_threads, sizeof(batch_worker_t));
+    if (!error && batch.workers == NULL) {
+        fprintf(stderr, "Could not allocate memory for the workers.\n");
+        error = 1;
+    }
+
+    if (!error && config->numa) {
+        batch.layout = numa_detect();
+        if (batch.layout == NULL) printf("NUMA placement: layout of the machine could not be determined, workers are not bound.\n");
+    }
+
+    int n_started = 0;
+    if (!error) {
+        for (int i = 0; i < config->n_threads; ++i) {
+            batch_worker_t *worker = &batch.workers[i];
+            worker->batch = &batch;
+            worker->id = i;
+            worker->node = batch.layout != NULL ? i % batch.layout->n_nodes : -1;
+            pthread_mutex_init(&worker->deque.lock, NULL);
+        }
+
+        if (batch.layout != NULL) {
+            char cpus[256] = "";
+            printf("NUMA placement: %d node(s), %d worker(s).\n", batch.layout->n_nodes, config->n_threads);
+            for (int i = 0; i < config->n_threads; ++i) {
+                numa_cpulist(batch.layout, batch.workers[i].node, cpus, sizeof(cpus));
+                printf("  worker %d -> node %d (cpus %s)\n", i, batch.layout->node_ids[batch.workers[i].node], cpus);
+            }
+        }
+
+        error = distribute_jobs(&batch);
+
+        for (int i = 0; !error && i < config->n_threads; ++i) {
+            if (pthread_create(&batch.workers[i].thread, NULL, run_worker, &batch.workers[i]) != 0) {
+                fprintf(stderr, "Could not start worker thread %d.\n", i);
+                // the tasks of this worker are stolen by the running workers
+                break;
+            }
+            ++n_started;
+        }
+
+        if (n_started == 0) error = 1;
+    }
+
+    size_t n_stolen = 0, n_centered = 0, n_quantized = 0;
+    for (int i = 0; i < n_started; ++i) {
+        pthread_join(batch.workers[i].thread, NULL);
+        n_stolen += batch.workers[i].n_stolen;
+        n_centered += batch.workers[i].n_centered;
+        n_quantized += batch.workers[i].n_quantized;
+    }
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (!error && batch.outstanding != 0) error = 1;
+    if (!error && !batch.error) {
+        size_t n_frames = 0;
+        for (size_t i = 0; i < batch.n_jobs; ++i) n_frames += batch.jobs[i].index.n_frames;
+        printf("Processed %zu frames from %zu trajectories in %.1f s (%zu ranges stolen).\n", n_frames, batch.n_jobs,
+                (double) (end.tv_sec - start.tv_sec) + 1e-9 * (double) (end.tv_nsec - start.tv_nsec), n_stolen);
+        if (config->integer) printf("Integer-domain centering used for %zu of %zu frames.\n", n_quantized, n_centered);
+    }
+
+    for (int i = 0; batch.workers != NULL && i < config->n_threads; ++i) {
+        batch_worker_t *worker = &batch.workers[i];
+        free(worker->deque.tasks);
+        free(worker->input);
+        free(worker->output);
+        frame_workspace_free(&worker->workspace);
+        if (worker->batch != NULL) pthread_mutex_destroy(&worker->deque.lock);
+    }
+    free(batch.workers);
+
+    for (size_t i = 0; i < batch.n_jobs; ++i) destroy_job(&batch.jobs[i]);
+    free(batch.jobs);
+    numa_destroy(batch.layout);
+    pthread_mutex_destroy(&batch.lock);
+
+    return error || batch.error;
+}
@@ -0,0 +1,17 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "pipeline.h"
+
+/*
+ * Centers all trajectories listed in list_file. Every non-empty line of the file
+ * contains the path to an input xtc file and the path to the corresponding output xtc file.
+ * Lines starting with '#' are ignored. input_file and output_file of config are not used.
+ * Returns zero, if all trajectories have been centered successfully. Else returns non-zero.
+ */
+int batch_run(const pipeline_config_t *config, const char *list_file);
+
+#endif /* BATCH_H */
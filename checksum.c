@@ -0,0 +1,258 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+// Per-frame CRC32C checksums of xtc files.
+//
+// Checksums are stored in a text sidecar next to the xtc file (FILE.crc) with one line per frame:
+//     frame offset size crc32c
+// The checksum is calculated using the crc32 instructions of SSE4.2 (x86-64) or ARMv8,
+// if the cpu supports them, otherwise using a lookup table.
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "checksum.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+// reflected polynomial of CRC32C
+static const uint32_t CRC32C_POLYNOMIAL = 0x82F63B78;
+
+static uint32_t crc_table[256];
+// crc32 instructions are available
+static int crc_hardware = 0;
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void build_crc_table(void)
+{
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLYNOMIAL : crc >> 1;
+        }
+        crc_table[i] = crc;
+    }
+}
+
+static uint32_t crc32c_table(uint32_t crc, const unsigned char *data, size_t size)
+{
+    for (size_t i = 0; i < size; ++i) {
+        crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hardware(uint32_t crc, const unsigned char *data, size_t size)
+{
+    uint64_t crc64 = crc;
+    while (size >= 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        data += 8;
+        size -= 8;
+    }
+
+    crc = (uint32_t) crc64;
+    while (size > 0) {
+        crc = _mm_crc32_u8(crc, *data++);
+        size--;
+    }
+    return crc;
+}
+
+static int hardware_available(void)
+{
+    return __builtin_cpu_supports("sse4.2");
+}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+static uint32_t crc32c_hardware(uint32_t crc, const unsigned char *data, size_t size)
+{
+    while (size >= 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc = __crc32cd(crc, word);
+        data += 8;
+        size -= 8;
+    }
+
+    while (size > 0) {
+        crc = __crc32cb(crc, *data++);
+        size--;
+    }
+    return crc;
+}
+
+static int hardware_available(void)
+{
+    return 1;
+}
+#else
+static uint32_t crc32c_hardware(uint32_t crc, const unsigned char *data, size_t size)
+{
+    return crc32c_table(crc, data, size);
+}
+
+static int hardware_available(void)
+{
+    return 0;
+}
+#endif
+
+static void init_crc(void)
+{
+    build_crc_table();
+    crc_hardware = hardware_available();
+}
+
+uint32_t crc32c(const unsigned char *data, size_t size)
+{
+    pthread_once(&crc_once, init_crc);
+
+    uint32_t crc = 0xFFFFFFFF;
+    crc = crc_hardware ? crc32c_hardware(crc, data, size) : crc32c_table(crc, data, size);
+    return crc ^ 0xFFFFFFFF;
+}
+
+char *checksum_path(const char *xtc_file)
+{
+    const size_t length = strlen(xtc_file) + 5;
+    char *path = malloc(length);
+    if (path == NULL) return NULL;
+    snprintf(path, length, "%s.crc", xtc_file);
+    return path;
+}
+
+int checksum_file_open(checksum_file_t *sidecar, const char *xtc_file)
+{
+    memset(sidecar, 0, sizeof(checksum_file_t));
+
+    sidecar->path = checksum_path(xtc_file);
+    if (sidecar->path == NULL) return 1;
+
+    sidecar->file = fopen(sidecar->path, "w");
+    if (sidecar->file == NULL) {
+        fprintf(stderr, "File %s could not be opened for writing.\n", sidecar->path);
+        free(sidecar->path);
+        sidecar->path = NULL;
+        return 1;
+    }
+
+    fprintf(sidecar->file, "# CRC32C checksums of frames of %s\n", xtc_file);
+    fprintf(sidecar->file, "# frame offset size crc32c\n");
+    return 0;
+}
+
+int checksum_file_add(checksum_file_t *sidecar, size_t size, uint32_t checksum)
+{
+    if (fprintf(sidecar->file, "%zu %" PRIu64 " %zu %08" PRIx32 "\n", sidecar->n_frames, sidecar->offset, size, checksum) < 0) return 1;
+    sidecar->offset += size;
+    sidecar->n_frames++;
+    return 0;
+}
+
+int checksum_file_close(checksum_file_t *sidecar)
+{
+    if (sidecar->file == NULL) return 0;
+
+    int error = fclose(sidecar->file) != 0;
+    if (error) fprintf(stderr, "Writing into %s has failed.\n", sidecar->path);
+
+    free(sidecar->path);
+    sidecar->file = NULL;
+    sidecar->path = NULL;
+    return error;
+}
+
+/*
+ * Appends a record to the list.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+static int append_record(checksum_list_t *list, size_t *capacity, uint64_t offset, uint64_t size, uint32_t checksum)
+{
+    if (list->n_frames == *capacity) {
+        size_t grown_capacity = *capacity == 0 ? 1024 : *capacity * 2;
+        uint64_t *offsets = realloc(list->offsets, grown_capacity * sizeof(uint64_t));
+        if (offsets != NULL) list->offsets = offsets;
+        uint64_t *sizes = realloc(list->sizes, grown_capacity * sizeof(uint64_t));
+        if (sizes != NULL) list->sizes = sizes;
+        uint32_t *checksums = realloc(list->checksums, grown_capacity * sizeof(uint32_t));
+        if (checksums != NULL) list->checksums = checksums;
+        if (offsets == NULL || sizes == NULL || checksums == NULL) return 1;
+        *capacity = grown_capacity;
+    }
+
+    list->offsets[list->n_frames] = offset;
+    list->sizes[list->n_frames] = size;
+    list->checksums[list->n_frames] = checksum;
+    list->n_frames++;
+    return 0;
+}
+
+int checksum_list_read(const char *xtc_file, checksum_list_t *list)
+{
+    memset(list, 0, sizeof(checksum_list_t));
+
+    char *path = checksum_path(xtc_file);
+    if (path == NULL) return 1;
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "File %s could not be read.\n", path);
+        free(path);
+        return 1;
+    }
+
+    size_t capacity = 0;
+    char line[256] = "";
+    size_t line_number = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        ++line_number;
+        if (line[0] == '#' || line[0] == '\n') continue;
+
+        size_t frame = 0;
+        uint64_t offset = 0, size = 0;
+        uint32_t checksum = 0;
+        if (sscanf(line, "%zu %" SCNu64 " %" SCNu64 " %" SCNx32, &frame, &offset, &size, &checksum) != 4) {
+            fprintf(stderr, "Could not parse line %zu of %s.\n", line_number, path);
+            goto failed;
+        }
+
+        // frames must follow each other without gaps
+        const uint64_t expected = list->n_frames == 0 ? 0 : list->offsets[list->n_frames - 1] + list->sizes[list->n_frames - 1];
+        if (frame != list->n_frames || offset != expected) {
+            fprintf(stderr, "Line %zu of %s does not continue the previous frame.\n", line_number, path);
+            goto failed;
+        }
+
+        if (append_record(list, &capacity, offset, size, checksum) != 0) {
+            fprintf(stderr, "Could not allocate memory for the checksums.\n");
+            goto failed;
+        }
+    }
+
+    fclose(file);
+    free(path);
+    return 0;
+
+failed:
+    fclose(file);
+    free(path);
+    checksum_list_free(list);
+    return 1;
+}
+
+void checksum_list_free(checksum_list_t *list)
+{
+    free(list->offsets);
+    free(list->sizes);
+    free(list->checksums);
+    memset(list, 0, sizeof(checksum_list_t));
+}
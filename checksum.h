@@ -0,0 +1,65 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* sidecar file storing the position, size and checksum of every frame of an xtc file */
+typedef struct checksum_file {
+    FILE *file;
+    char *path;
+    uint64_t offset;            // offset of the next frame
+    size_t n_frames;
+} checksum_file_t;
+
+/* contents of a sidecar file */
+typedef struct checksum_list {
+    size_t n_frames;
+    uint64_t *offsets;
+    uint64_t *sizes;
+    uint32_t *checksums;
+} checksum_list_t;
+
+/*
+ * Calculates the CRC32C (Castagnoli) checksum of data.
+ * Uses the crc32 instructions of the cpu, if available.
+ */
+uint32_t crc32c(const unsigned char *data, size_t size);
+
+/*
+ * Returns the path to the sidecar of xtc_file (xtc_file.crc). The path must be freed by the caller.
+ * Returns NULL, if the memory could not be allocated.
+ */
+char *checksum_path(const char *xtc_file);
+
+/*
+ * Creates the sidecar of xtc_file.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+int checksum_file_open(checksum_file_t *sidecar, const char *xtc_file);
+
+/*
+ * Records the next frame of the xtc file with the given size and checksum.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+int checksum_file_add(checksum_file_t *sidecar, size_t size, uint32_t checksum);
+
+/*
+ * Closes the sidecar.
+ * Returns zero, if all records have been written successfully. Else returns non-zero.
+ */
+int checksum_file_close(checksum_file_t *sidecar);
+
+/*
+ * Reads the sidecar of xtc_file.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+int checksum_list_read(const char *xtc_file, checksum_list_t *list);
+
+void checksum_list_free(checksum_list_t *list);
+
+#endif /* CHECKSUM_H */
@@ -0,0 +1,314 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+// Estimation of the cost of centering an xtc file.
+//
+// A few positions spread evenly over the input file are read (measuring the read throughput),
+// the first frame following every position is located using the same search as the recovery
+// of damaged files and the frame is decoded, centered and encoded exactly like in the pipeline,
+// timing every stage (decoding, centering and wrapping by the same latency laps as the pipeline).
+// The number of frames and the size of the output are extrapolated from the sizes of the sampled
+// frames, the wall time from the measured costs of the stages and the read throughput, and the
+// peak memory from the buffers the pipeline would allocate.
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "estimate.h"
+#include "checksum.h"
+#include "frame.h"
+#include "frameindex.h"
+#include "io.h"
+#include "stream.h"
+#include "xtc.h"
+
+// number of positions in the input file at which a frame is sampled
+static const size_t ESTIMATE_SAMPLES = 8;
+// amount of data read at every position to measure the read throughput (in bytes)
+static const size_t ESTIMATE_READ = 4 << 20;
+
+/* measured costs and sizes of the sampled frames */
+typedef struct estimate_totals {
+    size_t n_frames;
+    uint64_t input_bytes;       // size of the sampled frames
+    uint64_t output_bytes;      // size of the sampled frames after centering
+    double decode;              // time spent in the individual stages (in seconds)
+    double center;
+    double wrap;
+    double encode;
+    uint64_t read_bytes;        // data read to measure the read throughput
+    double read;                // time spent reading them (in seconds)
+} estimate_totals_t;
+
+static double seconds_since(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) (now.tv_sec - start->tv_sec) + (double) (now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+/*
+ * Returns the number of cpus the process may run on or zero, if it cannot be determined.
+ */
+static int usable_cpus(void)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) return 0;
+    return CPU_COUNT(&set);
+}
+
+/*
+ * Returns the resident memory of the process (in bytes) or zero, if it cannot be determined.
+ */
+static uint64_t resident_memory(void)
+{
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm == NULL) return 0;
+
+    unsigned long size = 0, resident = 0;
+    const int n_read = fscanf(statm, "%lu %lu", &size, &resident);
+    fclose(statm);
+
+    return n_read == 2 ? (uint64_t) resident * (uint64_t) sysconf(_SC_PAGESIZE) : 0;
+}
+
+/*
+ * Returns the amount of memory the pipeline would allocate with the given configuration.
+ * table contains the lookup tables built for the sampled frames.
+ */
+static uint64_t pipeline_memory(const pipeline_config_t *config, const center_table_t *table)
+{
+    const uint64_t n_atoms = config->n_atoms;
+    const uint64_t frame_bound = xtc_frame_bound((int) config->n_atoms);
+
+    // every slot holds the raw frame, the encoded frame and the decoded coordinates (floats and integers)
+    const uint64_t n_slots = (3 * (uint64_t) config->n_threads + 1) * (uint64_t) config->frame_batch;
+    const uint64_t slot = frame_bound + XTC_PADDING + frame_bound + 6 * n_atoms * sizeof(int);
+
+    // every worker holds a scratch array and its own lookup tables
+    uint64_t worker = 3 * n_atoms * sizeof(int);
+    for (int dim = 0; dim < 3; ++dim) worker += 2 * (uint64_t) table->box[dim] * sizeof(float);
+
+    uint64_t streams = stream_buffer_size();
+    if (config->output_file != NULL || config->centers_file == NULL) streams += stream_buffer_size();
+
+    return n_slots * slot + (uint64_t) config->n_threads * worker + streams;
+}
+
+/*
+ * Reads the data at offset into buffer to measure the read throughput.
+ */
+static void measure_read(int fd, uint64_t offset, unsigned char *buffer, estimate_totals_t *totals)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    const ssize_t n_read = pread_full(fd, buffer, ESTIMATE_READ, (off_t) offset);
+    const double time = seconds_since(&start);
+
+    if (n_read <= 0) return;
+    totals->read_bytes += (uint64_t) n_read;
+    totals->read += time;
+}
+
+/*
+ * Returns the time (in seconds) recorded for the stage since its sum of latencies was before.
+ */
+static double stage_seconds(const latency_recorder_t *latency, latency_stage_t stage, const uint64_t *before)
+{
+    return (double) (latency->stages[stage].sum - before[stage]) * 1e-9;
+}
+
+/*
+ * Decodes, centers and encodes the frame at offset, adding its costs to totals (if totals is not NULL).
+ * Returns zero, if successful. Else returns non-zero.
+ */
+static int sample_frame(
+        const pipeline_config_t *config,
+        int fd,
+        uint64_t offset,
+        uint64_t file_size,
+        unsigned char *input,
+        unsigned char *output,
+        frame_workspace_t *workspace,
+        estimate_totals_t *totals)
+{
+    const int n_atoms = (int) config->n_atoms;
+    const size_t frame_bound = xtc_frame_bound(n_atoms);
+    const size_t capacity = file_size - offset < frame_bound ? (size_t) (file_size - offset) : frame_bound;
+
+    xtc_header_t header = {0};
+    if (pread_full(fd, input, capacity, (off_t) offset) != (ssize_t) capacity || capacity < xtc_header_size(n_atoms) ||
+            xtc_peek_atoms(input) != n_atoms || xtc_parse_header(input, &header) != 0) return 1;
+
+    const size_t frame_size = xtc_frame_size(&header);
+    if (frame_size > capacity) return 1;
+    memset(input + frame_size, 0, XTC_PADDING);
+
+    frame_buffer_t *buffer = &workspace->buffer;
+    frame_scratch_t *scratch = &workspace->scratch;
+    const int centers_only = config->output_file == NULL && config->centers_file != NULL;
+
+    // decoding, centering and wrapping are timed by the latency recorder of the scratch
+    uint64_t before[LATENCY_STAGES];
+    for (int stage = 0; stage < LATENCY_STAGES; ++stage) before[stage] = scratch->latency->stages[stage].sum;
+
+    frame_result_t result = centers_only ? frame_decode_reference(config, &header, input, buffer, scratch) :
+            frame_decode_center(config, &header, input, buffer, scratch);
+    if (result != FRAME_OK) return 1;
+
+    size_t output_size = 0;
+    double encode = 0.0;
+    if (!centers_only) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        result = frame_encode(&header, buffer, scratch->work, output, frame_bound, &output_size);
+        if (result == FRAME_OK && config->checksums) crc32c(output, output_size);
+        encode = seconds_since(&start);
+        if (result != FRAME_OK) return 1;
+    }
+
+    if (totals == NULL) return 0;
+    totals->n_frames++;
+    totals->input_bytes += frame_size;
+    totals->output_bytes += output_size;
+    totals->decode += stage_seconds(scratch->latency, LATENCY_DECODE, before);
+    totals->center += stage_seconds(scratch->latency, LATENCY_CENTER, before);
+    totals->wrap += stage_seconds(scratch->latency, LATENCY_WRAP, before);
+    totals->encode += encode;
+    return 0;
+}
+
+int estimate_run(const pipeline_config_t *config)
+{
+    int fd = open(config->input_file, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "File %s could not be read as an xtc file.\n", config->input_file);
+        return 1;
+    }
+
+    unsigned char probe[8] = {0};
+    struct stat info;
+    if (pread_full(fd, probe, sizeof(probe), 0) != (ssize_t) sizeof(probe) || xtc_peek_atoms(probe) != (int) config->n_atoms) {
+        fprintf(stderr, "Number of atoms in %s does not match the gro file.\n", config->input_file);
+        close(fd);
+        return 1;
+    }
+    if (fstat(fd, &info) != 0) {
+        fprintf(stderr, "File %s could not be read as an xtc file.\n", config->input_file);
+        close(fd);
+        return 1;
+    }
+    const uint64_t file_size = (uint64_t) info.st_size;
+
+    // memory in use before the pipeline would start
+    const uint64_t resident = resident_memory();
+
+    const size_t frame_bound = xtc_frame_bound((int) config->n_atoms);
+    const size_t input_size = (frame_bound > ESTIMATE_READ ? frame_bound : ESTIMATE_READ) + XTC_PADDING;
+    unsigned char *input = malloc(input_size);
+    unsigned char *output = malloc(frame_bound);
+    latency_recorder_t *latency = calloc(1, sizeof(latency_recorder_t));
+    frame_workspace_t workspace = {0};
+    if (input == NULL || output == NULL || latency == NULL || frame_workspace_init(&workspace, config->n_atoms) != 0) {
+        fprintf(stderr, "Could not allocate memory for the sampled frames.\n");
+        free(input);
+        free(output);
+        free(latency);
+        frame_workspace_free(&workspace);
+        close(fd);
+        return 1;
+    }
+    workspace.scratch.latency = latency;
+
+    // the first frame is processed once more beforehand, so that the costs do not include the first touch
+    // of the buffers; the read throughput at the start of the file is measured before it gets cached by that
+    estimate_totals_t totals = {0};
+    measure_read(fd, 0, input, &totals);
+    int error = sample_frame(config, fd, 0, file_size, input, output, &workspace, NULL);
+
+    uint64_t previous = 0;
+    for (size_t i = 0; i < ESTIMATE_SAMPLES && !error; ++i) {
+        const uint64_t position = file_size * i / ESTIMATE_SAMPLES;
+        if (i > 0) measure_read(fd, position, input, &totals);
+
+        const uint64_t offset = i == 0 ? 0 : frame_index_resync(fd, (int) config->n_atoms, position, file_size);
+        // the file contains fewer frames than positions
+        if (offset >= file_size || (i > 0 && offset <= previous)) continue;
+        previous = offset;
+
+        if (sample_frame(config, fd, offset, file_size, input, output, &workspace, &totals) != 0) {
+            // only a damaged or incomplete first frame makes the estimate impossible
+            if (i == 0) error = 1;
+        }
+    }
+
+    if (error || totals.n_frames == 0) {
+        fprintf(stderr, "Frames of %s could not be sampled.\n", config->input_file);
+        free(input);
+        free(output);
+        free(latency);
+        frame_workspace_free(&workspace);
+        close(fd);
+        return 1;
+    }
+
+    const double n_sampled = (double) totals.n_frames;
+    const uint64_t n_frames = (uint64_t) ((double) file_size / ((double) totals.input_bytes / n_sampled) + 0.5);
+    const uint64_t n_selected = (n_frames + (uint64_t) config->skip - 1) / (uint64_t) config->skip;
+    const uint64_t output_bytes = (uint64_t) ((double) n_selected * ((double) totals.output_bytes / n_sampled) + 0.5);
+
+    const double decode = totals.decode / n_sampled;
+    const double center = totals.center / n_sampled;
+    const double wrap = totals.wrap / n_sampled;
+    const double encode = totals.encode / n_sampled;
+
+    // the workers share the stages (but not more of them than there are cpus run at once),
+    // reading runs concurrently and the whole input is always read
+    const int n_cpus = usable_cpus();
+    const int n_parallel = n_cpus > 0 && n_cpus < config->n_threads ? n_cpus : config->n_threads;
+    const double compute_seconds = (double) n_selected * (decode + center + wrap + encode) / n_parallel;
+    const double read_throughput = totals.read > 0.0 ? (double) totals.read_bytes / totals.read : 0.0;
+    const double read_seconds = read_throughput > 0.0 ? (double) file_size / read_throughput : 0.0;
+    const double wall_seconds = compute_seconds > read_seconds ? compute_seconds : read_seconds;
+
+    struct rusage usage;
+    uint64_t peak_memory = resident + pipeline_memory(config, &workspace.scratch.table);
+    if (getrusage(RUSAGE_SELF, &usage) == 0 && (uint64_t) usage.ru_maxrss * 1024 > peak_memory) {
+        peak_memory = (uint64_t) usage.ru_maxrss * 1024;
+    }
+
+    printf("sampled_frames=%zu\n", totals.n_frames);
+    printf("input_bytes=%" PRIu64 "\n", file_size);
+    printf("frames=%" PRIu64 "\n", n_frames);
+    printf("selected_frames=%" PRIu64 "\n", n_selected);
+    printf("output_bytes=%" PRIu64 "\n", output_bytes);
+    printf("threads=%d\n", config->n_threads);
+    printf("cpus=%d\n", n_cpus);
+    printf("decode_seconds_per_frame=%.9f\n", decode);
+    printf("center_seconds_per_frame=%.9f\n", center);
+    printf("wrap_seconds_per_frame=%.9f\n", wrap);
+    printf("encode_seconds_per_frame=%.9f\n", encode);
+    printf("read_bytes_per_second=%.0f\n", read_throughput);
+    printf("compute_seconds=%.3f\n", compute_seconds);
+    printf("read_seconds=%.3f\n", read_seconds);
+    printf("wall_seconds=%.3f\n", wall_seconds);
+    printf("peak_memory_bytes=%" PRIu64 "\n", peak_memory);
+
+    free(input);
+    free(output);
+    free(latency);
+    frame_workspace_free(&workspace);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,18 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef ESTIMATE_H
+#define ESTIMATE_H
+
+#include "pipeline.h"
+
+/*
+ * Estimates the cost of centering the input xtc file with the given configuration without centering it.
+ * A few frames spread over the file are decoded, centered and encoded on this machine and the number of frames,
+ * the size of the output, the wall time for the configured number of threads and the peak memory are predicted.
+ * The estimate is printed to standard output as key=value lines.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+int estimate_run(const pipeline_config_t *config);
+
+#endif /* ESTIMATE_H */
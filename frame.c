@@ -0,0 +1,534 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "frame.h"
+#include "geometry.h"
+
+// maximal difference between the box size scaled by precision and the nearest integer
+// allowing integer-domain centering (in units of 1 / precision)
+// this is about the resolution of single-precision coordinates of a typical box
+static const double BOX_TOLERANCE = 1e-3;
+
+// number of frames of a batch decoded before their centers are calculated
+#define BATCH_CHUNK 16
+
+// boxes larger than this (in units of 1 / precision) are not centered using lookup tables;
+// this bounds the memory of the tables (a cosine and a sine per position: up to 8 MB per dimension
+// and 24 MB per worker), which are far larger than the cache already at this limit
+#define MAX_LOOKUP_BOX (1 << 20)
+
+// compressed frames with boxes at least this large (in units of 1 / precision) in any dimension
+// are centered in double precision, since the spacing of single-precision coordinates
+// near the edge of such a box reaches 1/32 of the unit and rounding errors move atoms by whole units
+#define PRECISE_BOX_UNITS (1 << 18)
+
+// every Nth center estimated by a thread from the sample of reference atoms is checked against all reference atoms
+static const size_t SAMPLE_CHECK_INTERVAL = 32;
+
+int frame_buffer_init(frame_buffer_t *buffer, size_t n_atoms)
+{
+    buffer->coordinates = malloc(3 * n_atoms * sizeof(float));
+    buffer->quantized = malloc(3 * n_atoms * sizeof(int));
+    buffer->is_quantized = 0;
+    buffer->is_precise = 0;
+    if (buffer->coordinates == NULL || buffer->quantized == NULL) return 1;
+
+    memset(buffer->coordinates, 0, 3 * n_atoms * sizeof(float));
+    memset(buffer->quantized, 0, 3 * n_atoms * sizeof(int));
+    return 0;
+}
+
+void frame_buffer_free(frame_buffer_t *buffer)
+{
+    free(buffer->coordinates);
+    free(buffer->quantized);
+    buffer->coordinates = NULL;
+    buffer->quantized = NULL;
+}
+
+int frame_scratch_init(frame_scratch_t *scratch, size_t n_atoms)
+{
+    memset(&scratch->table, 0, sizeof(center_table_t));
+    scratch->n_sampled = 0;
+    scratch->latency = NULL;
+    scratch->work = calloc(3 * n_atoms, sizeof(int));
+    return scratch->work == NULL;
+}
+
+void frame_scratch_free(frame_scratch_t *scratch)
+{
+    free(scratch->work);
+    scratch->work = NULL;
+    center_table_free(&scratch->table);
+}
+
+int frame_workspace_init(frame_workspace_t *workspace, size_t n_atoms)
+{
+    const int buffer_failed = frame_buffer_init(&workspace->buffer, n_atoms) != 0;
+    return frame_scratch_init(&workspace->scratch, n_atoms) != 0 || buffer_failed;
+}
+
+void frame_workspace_free(frame_workspace_t *workspace)
+{
+    frame_buffer_free(&workspace->buffer);
+    frame_scratch_free(&workspace->scratch);
+}
+
+/*
+ * Calculates the size of the box in units of 1 / precision.
+ * Returns zero, if the box is a whole multiple of 1 / precision (within BOX_TOLERANCE). Else returns non-zero.
+ */
+static int quantized_box(const xtc_header_t *header, const float box[3], int box_units[3])
+{
+    for (int dim = 0; dim < 3; ++dim) {
+        const double units = (double) box[dim] * (double) header->precision;
+        const double rounded = floor(units + 0.5);
+        if (!(rounded >= 1.0 && rounded <= INT_MAX / 2) || fabs(units - rounded) > BOX_TOLERANCE) return 1;
+        box_units[dim] = (int) rounded;
+    }
+
+    return 0;
+}
+
+/*
+ * Returns non-zero, if the frame should be centered in double precision.
+ */
+static int precise_box(const xtc_header_t *header, const float box[3])
+{
+    if (header->n_atoms <= XTC_MAX_UNCOMPRESSED) return 0;
+
+    int precise = 0;
+    for (int dim = 0; dim < 3; ++dim) {
+        const double units = (double) box[dim] * (double) header->precision;
+        // wrapped coordinates must still fit into int
+        if (units > INT_MAX / 2) return 0;
+        if (units >= PRECISE_BOX_UNITS) precise = 1;
+    }
+
+    return precise;
+}
+
+/*
+ * Centers the quantized coordinates of a frame with the given center in the integer domain.
+ *
+ * The translation is calculated exactly as for float coordinates, then it is rounded to the nearest
+ * multiple of 1 / precision (halfway cases away from zero) and added to the integer coordinates,
+ * which are wrapped into the box scaled by precision.
+ * Compared to translating the float coordinates and quantizing them again, an atom can end up
+ * one unit (1 / precision) away, but distances between atoms are preserved exactly.
+ */
+static void center_quantized(
+        const pipeline_config_t *config,
+        const xtc_header_t *header,
+        const float box[3],
+        const int box_units[3],
+        const float center[3],
+        frame_buffer_t *buffer)
+{
+    const size_t n_atoms = (size_t) header->n_atoms;
+    int *x = buffer->quantized, *y = buffer->quantized + n_atoms, *z = buffer->quantized + 2 * n_atoms;
+
+    set_translation(buffer->translation, box, center, config->center[0], config->center[1], config->center[2]);
+
+    int shift[3] = {0};
+    for (int dim = 0; dim < 3; ++dim) {
+        shift[dim] = (int) lround((double) buffer->translation[dim] * (double) header->precision);
+        // the exported translation is the one actually applied
+        buffer->translation[dim] = (float) (shift[dim] / (double) header->precision);
+    }
+
+    geometry_translate_quantized(x, y, z, n_atoms, shift, box_units);
+}
+
+/* decoded coordinates of a frame from which centers of geometry are calculated */
+typedef struct center_source {
+    const float *coordinates;   // float coordinates (NULL, if the frame is only available as integers)
+    const int *x, *y, *z;       // integer coordinates
+    double inv_precision;       // zero for uncompressed frames
+    const center_table_t *table; // lookup tables (NULL, if not used)
+    int precise;                // calculate the center from the integer coordinates in double precision
+} center_source_t;
+
+static void center_of(const center_source_t *source, const size_t *indices, size_t n_indices, const float box[3], double center[3])
+{
+    if (source->precise) {
+        const double precise_box[3] = { box[0], box[1], box[2] };
+        geometry_center_precise(source->x, source->y, source->z, indices, n_indices, source->inv_precision, precise_box, center);
+        return;
+    }
+
+    float single[3] = {0.0f};
+    if (source->table != NULL) {
+        geometry_center_lookup(source->table, source->x, source->y, source->z, indices, n_indices, box, single);
+    } else if (source->coordinates != NULL) {
+        geometry_center(source->coordinates, indices, n_indices, box, single);
+    } else {
+        geometry_center_quantized(source->x, source->y, source->z, indices, n_indices, (float) source->inv_precision, box, single);
+    }
+
+    for (int dim = 0; dim < 3; ++dim) center[dim] = single[dim];
+}
+
+/*
+ * Calculates the center of geometry of the reference atoms.
+ * If a sample of the reference atoms is provided, the center is estimated from the sample.
+ * Every SAMPLE_CHECK_INTERVAL-th estimate of a thread is compared with the center of all reference atoms
+ * and if they differ by more than 1 / precision, all reference atoms are used from then on.
+ */
+static void reference_center(
+        const pipeline_config_t *config,
+        frame_scratch_t *scratch,
+        const center_source_t *source,
+        const float box[3],
+        double center[3])
+{
+    center_sample_t *sample = config->sample;
+    if (sample == NULL || source->inv_precision <= 0.0 || __atomic_load_n(&sample->disabled, __ATOMIC_RELAXED)) {
+        center_of(source, config->reference, config->n_reference, box, center);
+        return;
+    }
+
+    center_of(source, sample->indices, sample->n_indices, box, center);
+    if (scratch->n_sampled++ % SAMPLE_CHECK_INTERVAL != 0) return;
+
+    double full[3] = {0.0};
+    center_of(source, config->reference, config->n_reference, box, full);
+    for (int dim = 0; dim < 3; ++dim) {
+        if (!config->center[dim]) continue;
+
+        // centers are compared in the periodic box
+        double deviation = fabs(center[dim] - full[dim]);
+        if (deviation > box[dim] / 2.0) deviation = box[dim] - deviation;
+
+        if (deviation > source->inv_precision) {
+            if (__atomic_exchange_n(&sample->disabled, 1, __ATOMIC_RELAXED) == 0) {
+                fprintf(stderr, "\nWarning. Center estimated from the sample of reference atoms deviates by %.4f nm. "
+                        "Using all reference atoms.\n", deviation);
+            }
+            memcpy(center, full, sizeof(full));
+            return;
+        }
+    }
+}
+
+/*
+ * Stores the center calculated in double precision and the translation moving it
+ * to the center of the box in the selected dimensions into buffer.
+ * Returns the translation in units of 1 / precision in shift.
+ */
+static void set_precise_translation(
+        const pipeline_config_t *config,
+        const xtc_header_t *header,
+        const float box[3],
+        const double center[3],
+        frame_buffer_t *buffer,
+        double shift[3])
+{
+    for (int dim = 0; dim < 3; ++dim) {
+        buffer->center[dim] = (float) center[dim];
+        shift[dim] = 0.0;
+        if (!config->center[dim]) continue;
+
+        const double translation = (double) box[dim] / 2.0 - center[dim];
+        buffer->translation[dim] = (float) translation;
+        shift[dim] = translation * (double) header->precision;
+    }
+}
+
+/*
+ * Decodes and centers a compressed frame with a box of at least PRECISE_BOX_UNITS.
+ * The center and the translation are calculated in double precision and the decoded integers
+ * are translated and wrapped in double precision, so every atom ends up at the quantized position
+ * of its exactly translated coordinates.
+ */
+static frame_result_t decode_center_precise(
+        const pipeline_config_t *config,
+        const xtc_header_t *header,
+        const unsigned char *input,
+        const float box[3],
+        frame_buffer_t *buffer,
+        frame_scratch_t *scratch)
+{
+    const size_t n_atoms = (size_t) header->n_atoms;
+    int *x = buffer->quantized, *y = x + n_atoms, *z = x + 2 * n_atoms;
+    uint64_t start = latency_start(scratch->latency);
+    if (xtc_decode_quantized(input, header, x, y, z) != 0) return FRAME_CORRUPTED;
+    latency_lap(scratch->latency, LATENCY_DECODE, &start);
+
+    const center_source_t source = { NULL, x, y, z, 1.0 / header->precision, NULL, 1 };
+    double center[3] = {0.0};
+    reference_center(config, scratch, &source, box, center);
+    latency_lap(scratch->latency, LATENCY_CENTER, &start);
+
+    double shift[3] = {0.0};
+    set_precise_translation(config, header, box, center, buffer, shift);
+
+    const double box_units[3] = {
+        (double) box[0] * (double) header->precision,
+        (double) box[1] * (double) header->precision,
+        (double) box[2] * (double) header->precision };
+    geometry_translate_precise(x, y, z, n_atoms, shift, box_units);
+    latency_lap(scratch->latency, LATENCY_WRAP, &start);
+
+    buffer->is_quantized = 1;
+    buffer->is_precise = 1;
+    return FRAME_OK;
+}
+
+frame_result_t frame_decode_center(
+        const pipeline_config_t *config,
+        const xtc_header_t *header,
+        const unsigned char *input,
+        frame_buffer_t *buffer,
+        frame_scratch_t *scratch)
+{
+    float box[3] = { header->box[0][0], header->box[1][1], header->box[2][2] };
+    for (int dim = 0; dim < 3; ++dim) {
+        if (!(box[dim] > 0.0f)) return FRAME_CORRUPTED;
+    }
+
+    buffer->is_quantized = 0;
+    buffer->is_precise = 0;
+    memset(buffer->translation, 0, sizeof(buffer->translation));
+    center_source_t source = { buffer->coordinates, NULL, NULL, NULL, 0.0, NULL, 0 };
+    double center[3] = {0.0};
+
+    if (precise_box(header, box)) return decode_center_precise(config, header, input, box, buffer, scratch);
+
+    uint64_t start = latency_start(scratch->latency);
+    if (header->n_atoms > XTC_MAX_UNCOMPRESSED) {
+        const size_t n_atoms = (size_t) header->n_atoms;
+        int box_units[3] = {0};
+        const int integral = (config->integer || config->lookup) && quantized_box(header, box, box_units) == 0;
+        const int integer = config->integer && integral;
+
+        // centering in the integer domain keeps the decoded integers in the frame buffer
+        int *x = integer ? buffer->quantized : scratch->work;
+        int *y = x + n_atoms, *z = x + 2 * n_atoms;
+        if (xtc_decode_quantized(input, header, x, y, z) != 0) return FRAME_CORRUPTED;
+
+        source.x = x;
+        source.y = y;
+        source.z = z;
+        source.inv_precision = 1.0 / header->precision;
+
+        // if the tables could not be allocated, the center is calculated as usual
+        if (config->lookup && integral &&
+                box_units[0] <= MAX_LOOKUP_BOX && box_units[1] <= MAX_LOOKUP_BOX && box_units[2] <= MAX_LOOKUP_BOX &&
+                center_table_update(&scratch->table, box_units) == 0) {
+            source.table = &scratch->table;
+        }
+
+        if (integer) {
+            latency_lap(scratch->latency, LATENCY_DECODE, &start);
+            source.coordinates = NULL;
+            reference_center(config, scratch, &source, box, center);
+            for (int dim = 0; dim < 3; ++dim) buffer->center[dim] = (float) center[dim];
+            latency_lap(scratch->latency, LATENCY_CENTER, &start);
+            center_quantized(config, header, box, box_units, buffer->center, buffer);
+            latency_lap(scratch->latency, LATENCY_WRAP, &start);
+            buffer->is_quantized = 1;
+            return FRAME_OK;
+        }
+
+        xtc_dequantize(header, x, y, z, buffer->coordinates);
+    } else if (xtc_decode(input, header, buffer->coordinates, scratch->work) != 0) {
+        return FRAME_CORRUPTED;
+    }
+    latency_lap(scratch->latency, LATENCY_DECODE, &start);
+
+    reference_center(config, scratch, &source, box, center);
+    for (int dim = 0; dim < 3; ++dim) buffer->center[dim] = (float) center[dim];
+    latency_lap(scratch->latency, LATENCY_CENTER, &start);
+    set_translation(buffer->translation, box, buffer->center, config->center[0], config->center[1], config->center[2]);
+    geometry_translate(buffer->coordinates, config->n_atoms, buffer->translation, box);
+    latency_lap(scratch->latency, LATENCY_WRAP, &start);
+
+    return FRAME_OK;
+}
+
+/*
+ * Decodes the frame input into coordinates without centering it, like the float path of frame_decode_center.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+static int decode_coordinates(const xtc_header_t *header, const unsigned char *input, float *coordinates, int *work)
+{
+    if (header->n_atoms <= XTC_MAX_UNCOMPRESSED) return xtc_decode(input, header, coordinates, work);
+
+    const size_t n_atoms = (size_t) header->n_atoms;
+    if (xtc_decode_quantized(input, header, work, work + n_atoms, work + 2 * n_atoms) != 0) return 1;
+    xtc_dequantize(header, work, work + n_atoms, work + 2 * n_atoms, coordinates);
+    return 0;
+}
+
+void frame_decode_center_batch(
+        const pipeline_config_t *config,
+        frame_job_t *jobs,
+        size_t n_jobs,
+        frame_scratch_t *scratch)
+{
+    // integer centering, lookup tables and sampling work on individual frames
+    if (n_jobs == 1 || config->integer || config->lookup || config->sample != NULL || config->n_reference > FRAME_BATCH_REFERENCE) {
+        for (size_t i = 0; i < n_jobs; ++i) {
+            jobs[i].result = frame_decode_center(config, jobs[i].header, jobs[i].input, jobs[i].buffer, scratch);
+        }
+        return;
+    }
+
+    const float *coordinates[BATCH_CHUNK];
+    float boxes[3 * BATCH_CHUNK], centers[3 * BATCH_CHUNK];
+    frame_job_t *decoded[BATCH_CHUNK];
+
+    for (size_t first = 0; first < n_jobs; first += BATCH_CHUNK) {
+        const size_t last = n_jobs - first < BATCH_CHUNK ? n_jobs : first + BATCH_CHUNK;
+
+        size_t n_decoded = 0;
+        for (size_t i = first; i < last; ++i) {
+            frame_job_t *job = &jobs[i];
+            uint64_t start = latency_start(scratch->latency);
+            frame_buffer_t *buffer = job->buffer;
+            buffer->is_quantized = 0;
+            buffer->is_precise = 0;
+            memset(buffer->translation, 0, sizeof(buffer->translation));
+
+            float *box = boxes + 3 * n_decoded;
+            for (int dim = 0; dim < 3; ++dim) box[dim] = job->header->box[dim][dim];
+            // frames with very large boxes are centered in double precision
+            if (box[0] > 0.0f && box[1] > 0.0f && box[2] > 0.0f && precise_box(job->header, box)) {
+                job->result = frame_decode_center(config, job->header, job->input, buffer, scratch);
+                continue;
+            }
+
+            if (!(box[0] > 0.0f && box[1] > 0.0f && box[2] > 0.0f) ||
+                    decode_coordinates(job->header, job->input, buffer->coordinates, scratch->work) != 0) {
+                job->result = FRAME_CORRUPTED;
+                continue;
+            }
+
+            latency_lap(scratch->latency, LATENCY_DECODE, &start);
+            job->result = FRAME_OK;
+            coordinates[n_decoded] = buffer->coordinates;
+            decoded[n_decoded++] = job;
+        }
+
+        // the centers are calculated for all frames at once, every frame is charged an equal share
+        uint64_t start = latency_start(scratch->latency);
+        geometry_center_frames(coordinates, n_decoded, config->reference, config->n_reference, boxes, centers);
+        if (scratch->latency != NULL && n_decoded > 0) {
+            const uint64_t share = (latency_now() - start) / n_decoded;
+            for (size_t i = 0; i < n_decoded; ++i) latency_record(scratch->latency, LATENCY_CENTER, share);
+        }
+
+        for (size_t i = 0; i < n_decoded; ++i) {
+            frame_buffer_t *buffer = decoded[i]->buffer;
+            const float *box = boxes + 3 * i;
+            start = latency_start(scratch->latency);
+            memcpy(buffer->center, centers + 3 * i, sizeof(buffer->center));
+            set_translation(buffer->translation, box, buffer->center, config->center[0], config->center[1], config->center[2]);
+            geometry_translate(buffer->coordinates, config->n_atoms, buffer->translation, box);
+            latency_lap(scratch->latency, LATENCY_WRAP, &start);
+        }
+    }
+}
+
+frame_result_t frame_decode_reference(
+        const pipeline_config_t *config,
+        const xtc_header_t *header,
+        const unsigned char *input,
+        frame_buffer_t *buffer,
+        frame_scratch_t *scratch)
+{
+    float box[3] = { header->box[0][0], header->box[1][1], header->box[2][2] };
+    for (int dim = 0; dim < 3; ++dim) {
+        if (!(box[dim] > 0.0f)) return FRAME_CORRUPTED;
+    }
+
+    buffer->is_quantized = 0;
+    buffer->is_precise = 0;
+    memset(buffer->translation, 0, sizeof(buffer->translation));
+    center_source_t source = { buffer->coordinates, NULL, NULL, NULL, 0.0, NULL, 0 };
+    double center[3] = {0.0};
+
+    uint64_t start = latency_start(scratch->latency);
+    if (header->n_atoms > XTC_MAX_UNCOMPRESSED) {
+        const size_t n_atoms = (size_t) header->n_atoms;
+        int *x = scratch->work, *y = x + n_atoms, *z = x + 2 * n_atoms;
+        if (xtc_decode_prefix(input, header, (int) config->reference_end, x, y, z) != 0) return FRAME_CORRUPTED;
+
+        source.coordinates = NULL;
+        source.x = x;
+        source.y = y;
+        source.z = z;
+        source.inv_precision = 1.0 / header->precision;
+        source.precise = precise_box(header, box);
+
+        int box_units[3] = {0};
+        if (config->lookup && !source.precise && quantized_box(header, box, box_units) == 0 &&
+                box_units[0] <= MAX_LOOKUP_BOX && box_units[1] <= MAX_LOOKUP_BOX && box_units[2] <= MAX_LOOKUP_BOX &&
+                center_table_update(&scratch->table, box_units) == 0) {
+            source.table = &scratch->table;
+        }
+    } else if (xtc_decode(input, header, buffer->coordinates, scratch->work) != 0) {
+        return FRAME_CORRUPTED;
+    }
+    latency_lap(scratch->latency, LATENCY_DECODE, &start);
+
+    reference_center(config, scratch, &source, box, center);
+    if (source.precise) {
+        double shift[3] = {0.0};
+        set_precise_translation(config, header, box, center, buffer, shift);
+        latency_lap(scratch->latency, LATENCY_CENTER, &start);
+        return FRAME_OK;
+    }
+
+    for (int dim = 0; dim < 3; ++dim) buffer->center[dim] = (float) center[dim];
+    set_translation(buffer->translation, box, buffer->center, config->center[0], config->center[1], config->center[2]);
+    latency_lap(scratch->latency, LATENCY_CENTER, &start);
+
+    return FRAME_OK;
+}
+
+frame_result_t frame_encode(
+        const xtc_header_t *header,
+        const frame_buffer_t *buffer,
+        int *work,
+        unsigned char *output,
+        size_t capacity,
+        size_t *output_size)
+{
+    if (buffer->is_quantized) {
+        const size_t n_atoms = (size_t) header->n_atoms;
+        const int *x = buffer->quantized, *y = buffer->quantized + n_atoms, *z = buffer->quantized + 2 * n_atoms;
+        for (size_t i = 0; i < n_atoms; ++i) {
+            work[3 * i] = x[i];
+            work[3 * i + 1] = y[i];
+            work[3 * i + 2] = z[i];
+        }
+        *output_size = xtc_encode_quantized(output, capacity, header, work);
+    } else if (header->n_atoms > XTC_MAX_UNCOMPRESSED) {
+        *output_size = xtc_quantize(header, buffer->coordinates, work) == 0 ? xtc_encode_quantized(output, capacity, header, work) : 0;
+    } else {
+        *output_size = xtc_encode(output, capacity, header, buffer->coordinates, work);
+    }
+    return *output_size == 0 ? FRAME_UNENCODABLE : FRAME_OK;
+}
+
+frame_result_t frame_center(
+        const pipeline_config_t *config,
+        frame_workspace_t *workspace,
+        const xtc_header_t *header,
+        const unsigned char *input,
+        unsigned char *output,
+        size_t capacity,
+        size_t *output_size)
+{
+    frame_result_t result = frame_decode_center(config, header, input, &workspace->buffer, &workspace->scratch);
+    if (result != FRAME_OK) return result;
+
+    return frame_encode(header, &workspace->buffer, workspace->scratch.work, output, capacity, output_size);
+}
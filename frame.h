@@ -0,0 +1,145 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stddef.h>
+#include "geometry.h"
+#include "latency.h"
+#include "pipeline.h"
+#include "xtc.h"
+
+// reference groups with at most this number of atoms are centered across the frames of a batch
+#define FRAME_BATCH_REFERENCE 64
+
+/* coordinates of a frame passed from centering to encoding */
+typedef struct frame_buffer {
+    float *coordinates;         // x, y, z triplets
+    int *quantized;             // arrays of x, y and z integer coordinates in units of 1 / precision
+    int is_quantized;           // the frame has been centered in the integer domain (coordinates are not set)
+    int is_precise;             // the quantized frame has been centered in double precision (very large box)
+    float center[3];            // center of the reference atoms before centering
+    float translation[3];       // translation applied to the frame
+} frame_buffer_t;
+
+/* per-thread scratch space for decoding, centering and encoding */
+typedef struct frame_scratch {
+    int *work;                  // 3 * n_atoms integers
+    center_table_t table;       // lookup tables for the center of geometry (only built, if requested)
+    size_t n_sampled;           // number of centers estimated from the sample of reference atoms
+    latency_recorder_t *latency; // latencies of decoding, centering and wrapping (NULL, if not recorded)
+} frame_scratch_t;
+
+/* per-thread buffers for centering of individual frames */
+typedef struct frame_workspace {
+    frame_buffer_t buffer;
+    frame_scratch_t scratch;
+} frame_workspace_t;
+
+typedef enum frame_result {
+    FRAME_OK,
+    FRAME_CORRUPTED,        // input frame could not be decoded
+    FRAME_UNENCODABLE,      // centered frame could not be encoded
+} frame_result_t;
+
+/* frame of a batch processed by frame_decode_center_batch */
+typedef struct frame_job {
+    const xtc_header_t *header;
+    const unsigned char *input;
+    frame_buffer_t *buffer;
+    frame_result_t result;
+} frame_job_t;
+
+/*
+ * Allocates a buffer for a frame with n_atoms atoms.
+ * The buffer is cleared, so its pages are placed on the node of the calling thread.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+int frame_buffer_init(frame_buffer_t *buffer, size_t n_atoms);
+
+void frame_buffer_free(frame_buffer_t *buffer);
+
+/*
+ * Allocates scratch space for frames with n_atoms atoms.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+int frame_scratch_init(frame_scratch_t *scratch, size_t n_atoms);
+
+void frame_scratch_free(frame_scratch_t *scratch);
+
+/*
+ * Allocates buffers of the workspace for frames with n_atoms atoms.
+ * The buffers are cleared, so their pages are placed on the node of the calling thread.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+int frame_workspace_init(frame_workspace_t *workspace, size_t n_atoms);
+
+void frame_workspace_free(frame_workspace_t *workspace);
+
+/*
+ * Decodes the frame input described by header into buffer and centers it.
+ * If integer centering is enabled and the box is a whole multiple of 1 / precision,
+ * the frame is centered directly on the quantized coordinates without conversion to floats.
+ * If lookup centers are enabled and the box allows it, the center of geometry is calculated
+ * using the lookup tables of scratch, which are rebuilt whenever the box changes.
+ * input must be followed by XTC_PADDING readable bytes.
+ */
+frame_result_t frame_decode_center(
+        const pipeline_config_t *config,
+        const xtc_header_t *header,
+        const unsigned char *input,
+        frame_buffer_t *buffer,
+        frame_scratch_t *scratch);
+
+/*
+ * Decodes and centers n_jobs frames like frame_decode_center, storing the result of every frame in its job.
+ * For reference groups of at most FRAME_BATCH_REFERENCE atoms (and without integer centering, lookup tables
+ * or sampling), all frames are decoded first and the centers of all frames are then calculated together,
+ * looping over the frames for every reference atom. The centered coordinates are identical in both cases.
+ */
+void frame_decode_center_batch(
+        const pipeline_config_t *config,
+        frame_job_t *jobs,
+        size_t n_jobs,
+        frame_scratch_t *scratch);
+
+/*
+ * Calculates the center of the reference atoms of the frame input and the translation centering them
+ * (stored in buffer) without centering the frame itself.
+ * Compressed frames are only decoded up to the last reference atom.
+ * input must be followed by XTC_PADDING readable bytes.
+ */
+frame_result_t frame_decode_reference(
+        const pipeline_config_t *config,
+        const xtc_header_t *header,
+        const unsigned char *input,
+        frame_buffer_t *buffer,
+        frame_scratch_t *scratch);
+
+/*
+ * Encodes centered coordinates of buffer into output.
+ * capacity of output must be at least xtc_frame_bound(n_atoms).
+ * The size of the encoded frame is written into output_size.
+ */
+frame_result_t frame_encode(
+        const xtc_header_t *header,
+        const frame_buffer_t *buffer,
+        int *work,
+        unsigned char *output,
+        size_t capacity,
+        size_t *output_size);
+
+/*
+ * Decodes the frame input, centers it and encodes it into output using the buffers of workspace.
+ */
+frame_result_t frame_center(
+        const pipeline_config_t *config,
+        frame_workspace_t *workspace,
+        const xtc_header_t *header,
+        const unsigned char *input,
+        unsigned char *output,
+        size_t capacity,
+        size_t *output_size);
+
+#endif /* FRAME_H */
@@ -0,0 +1,360 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+// Indexing of xtc files.
+//
+// The position of a frame is only known from the header of the previous frame, so a plain
+// index is built by walking through the headers one after another. Large files are instead
+// split into regions that are indexed in parallel: every thread searches its region for
+// the first position that looks like a frame header (magic number, atom count, plausible
+// box and precision) and confirms it by following the sizes of several subsequent frames.
+// From there, the thread walks through the headers until it leaves its region.
+//
+// The chains of the regions are then stitched together. The chain of a region is only
+// accepted, if it starts exactly where the already verified chain of the previous regions
+// ends; otherwise the region is walked again starting from the verified position.
+// The result is therefore identical to the sequential walk.
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "frameindex.h"
+#include "io.h"
+#include "xtc.h"
+
+// files smaller than this are always indexed sequentially (in bytes)
+static const uint64_t PARALLEL_MIN_SIZE = 64 << 20;
+// size of the blocks searched for frame headers (in bytes)
+static const size_t SCAN_BLOCK = 1 << 20;
+// number of frames that must follow a candidate header for it to be accepted
+static const int CONFIRM_FRAMES = 4;
+// number of frames that must follow a candidate header found when resynchronizing
+static const int RESYNC_CONFIRM_FRAMES = 1;
+// largest box size considered plausible (in nm)
+static const float MAX_BOX = 1e6f;
+
+/* frames found in a part of the file */
+typedef struct chain {
+    uint64_t *starts;       // offsets of frames
+    size_t n_starts;
+    size_t capacity;
+    uint64_t end;           // offset following the last frame of the chain
+    int last;               // chain has reached the end of the file
+    int failed;             // chain has hit an invalid header
+} chain_t;
+
+typedef struct region {
+    pthread_t thread;
+    int fd;
+    int n_atoms;
+    uint64_t begin;         // first byte of the region
+    uint64_t limit;         // first byte following the region
+    uint64_t file_size;
+    int found;              // a confirmed frame start has been found in the region
+    chain_t chain;
+} region_t;
+
+/*
+ * Appends offset to the chain.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+static int append_start(chain_t *chain, uint64_t offset)
+{
+    if (chain->n_starts >= chain->capacity) {
+        size_t grown_capacity = chain->capacity == 0 ? 1024 : chain->capacity * 2;
+        uint64_t *grown = realloc(chain->starts, grown_capacity * sizeof(uint64_t));
+        if (grown == NULL) return 1;
+        chain->starts = grown;
+        chain->capacity = grown_capacity;
+    }
+
+    chain->starts[chain->n_starts++] = offset;
+    return 0;
+}
+
+/*
+ * Reads and parses the header of the frame at offset.
+ * Returns zero, if a valid header with n_atoms atoms has been read. Else returns non-zero.
+ */
+static int read_header(int fd, int n_atoms, uint64_t offset, xtc_header_t *header)
+{
+    const size_t header_size = xtc_header_size(n_atoms);
+    unsigned char buffer[XTC_HEADER_SIZE] = {0};
+
+    if (pread_full(fd, buffer, header_size, (off_t) offset) != (ssize_t) header_size) return 1;
+    if (xtc_peek_atoms(buffer) != n_atoms) return 1;
+    return xtc_parse_header(buffer, header);
+}
+
+/*
+ * Walks through the frames starting at offset and appends them to the chain
+ * until a frame starts at or after limit or the end of the file is reached.
+ * An incomplete last frame is not added to the chain.
+ * Returns zero, if successful. Else returns non-zero (memory allocation failure).
+ */
+static int walk_frames(int fd, int n_atoms, uint64_t offset, uint64_t limit, uint64_t file_size, chain_t *chain)
+{
+    const size_t header_size = xtc_header_size(n_atoms);
+
+    while (offset < limit) {
+        if (offset + header_size > file_size) {
+            chain->last = 1;
+            break;
+        }
+
+        xtc_header_t header = {0};
+        if (read_header(fd, n_atoms, offset, &header) != 0) {
+            chain->failed = 1;
+            break;
+        }
+
+        const uint64_t next = offset + xtc_frame_size(&header);
+        if (next > file_size) {
+            chain->last = 1;
+            break;
+        }
+
+        if (append_start(chain, offset) != 0) return 1;
+        offset = next;
+    }
+
+    chain->end = offset;
+    return 0;
+}
+
+/*
+ * Checks that the header describes a frame that could belong to a real trajectory.
+ */
+static int plausible_header(const xtc_header_t *header)
+{
+    for (int dim = 0; dim < 3; ++dim) {
+        const float size = header->box[dim][dim];
+        if (!isfinite(size) || size <= 0.0f || size > MAX_BOX) return 0;
+    }
+
+    if (header->n_atoms > XTC_MAX_UNCOMPRESSED && (!isfinite(header->precision) || header->precision <= 0.0f)) return 0;
+
+    return isfinite(header->time);
+}
+
+/*
+ * Checks that the candidate frame at offset is valid and followed by n_following valid frames
+ * (or by valid frames up to the end of the file).
+ */
+static int confirm_candidate(int fd, int n_atoms, uint64_t offset, uint64_t file_size, int n_following)
+{
+    const size_t header_size = xtc_header_size(n_atoms);
+
+    for (int i = 0; i <= n_following; ++i) {
+        if (offset == file_size || (i > 0 && offset + header_size > file_size)) return 1;
+
+        xtc_header_t header = {0};
+        if (read_header(fd, n_atoms, offset, &header) != 0 || !plausible_header(&header)) return 0;
+
+        offset += xtc_frame_size(&header);
+        if (offset > file_size) return i > 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Searches the region for the first confirmed frame start.
+ * Returns the offset of the frame or the limit of the region, if no frame starts in the region.
+ */
+static uint64_t find_first_frame(const region_t *region, unsigned char *block)
+{
+    // frames are padded to 4 bytes, so they always start at offsets divisible by 4
+    uint64_t block_start = (region->begin + 3) & ~(uint64_t) 3;
+
+    while (block_start < region->limit) {
+        ssize_t n = pread_full(region->fd, block, SCAN_BLOCK + 8, (off_t) block_start);
+        if (n < 8) break;
+
+        for (size_t pos = 0; pos + 8 <= (size_t) n && pos < SCAN_BLOCK; pos += 4) {
+            if (block_start + pos >= region->limit) return region->limit;
+            // magic number followed by the number of atoms, both big-endian
+            if (block[pos] != 0 || block[pos + 1] != 0 || block[pos + 2] != 0x07 || block[pos + 3] != 0xCB) continue;
+            const unsigned char *atoms = block + pos + 4;
+            const int n_atoms = (int) ((unsigned) atoms[0] << 24 | (unsigned) atoms[1] << 16 | (unsigned) atoms[2] << 8 | atoms[3]);
+            if (n_atoms != region->n_atoms) continue;
+
+            if (confirm_candidate(region->fd, region->n_atoms, block_start + pos, region->file_size, CONFIRM_FRAMES)) return block_start + pos;
+        }
+
+        block_start += SCAN_BLOCK;
+    }
+
+    return region->limit;
+}
+
+uint64_t frame_index_resync(int fd, int n_atoms, uint64_t offset, uint64_t file_size)
+{
+    unsigned char *block = malloc(SCAN_BLOCK + 8);
+    if (block == NULL) return file_size;
+
+    uint64_t block_start = offset;
+    while (block_start + 8 <= file_size) {
+        ssize_t n = pread_full(fd, block, SCAN_BLOCK + 8, (off_t) block_start);
+        if (n < 8) break;
+
+        // damage may shift the data, so frames are searched for at every byte
+        const size_t n_candidates = (size_t) n - 7 < SCAN_BLOCK ? (size_t) n - 7 : SCAN_BLOCK;
+        const unsigned char *end = block + 3 + n_candidates;
+        const unsigned char *last_byte = block + 3;
+
+        // the last byte of the big-endian magic number is searched for first
+        while ((last_byte = memchr(last_byte, XTC_MAGIC & 0xFF, (size_t) (end - last_byte))) != NULL) {
+            const unsigned char *candidate = last_byte - 3;
+            ++last_byte;
+
+            if (candidate[0] != 0 || candidate[1] != 0 || candidate[2] != XTC_MAGIC >> 8) continue;
+            if (xtc_peek_atoms(candidate) != n_atoms) continue;
+
+            const uint64_t candidate_offset = block_start + (uint64_t) (candidate - block);
+            if (confirm_candidate(fd, n_atoms, candidate_offset, file_size, RESYNC_CONFIRM_FRAMES)) {
+                free(block);
+                return candidate_offset;
+            }
+        }
+
+        block_start += n_candidates;
+    }
+
+    free(block);
+    return file_size;
+}
+
+static void *index_region(void *arg)
+{
+    region_t *region = (region_t *) arg;
+
+    unsigned char *block = malloc(SCAN_BLOCK + 8);
+    if (block == NULL) {
+        region->chain.failed = 1;
+        return NULL;
+    }
+
+    const uint64_t start = find_first_frame(region, block);
+    free(block);
+
+    if (start >= region->limit) return NULL;
+
+    region->found = 1;
+    if (walk_frames(region->fd, region->n_atoms, start, region->limit, region->file_size, &region->chain) != 0) {
+        region->chain.failed = 1;
+    }
+
+    return NULL;
+}
+
+/*
+ * Appends all frames of the chain to the index.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+static int append_chain(chain_t *index, const chain_t *chain)
+{
+    for (size_t i = 0; i < chain->n_starts; ++i) {
+        if (append_start(index, chain->starts[i]) != 0) return 1;
+    }
+    index->end = chain->end;
+    index->last = chain->last;
+    index->failed = chain->failed;
+    return 0;
+}
+
+/*
+ * Indexes the file by regions searched in parallel. The resulting chain is identical
+ * to the chain obtained by walking through the whole file.
+ * Returns zero, if successful. Else returns non-zero (memory allocation failure).
+ */
+static int index_parallel(int fd, int n_atoms, int n_threads, uint64_t file_size, chain_t *result)
+{
+    region_t *regions = calloc((size_t) n_threads, sizeof(region_t));
+    if (regions == NULL) return 1;
+
+    const uint64_t region_size = file_size / (uint64_t) n_threads;
+    for (int i = 0; i < n_threads; ++i) {
+        regions[i].fd = fd;
+        regions[i].n_atoms = n_atoms;
+        regions[i].begin = region_size * (uint64_t) i;
+        regions[i].limit = i == n_threads - 1 ? file_size : region_size * (uint64_t) (i + 1);
+        regions[i].file_size = file_size;
+    }
+
+    // the first region is walked by the calling thread, it starts at a known frame
+    int *started = calloc((size_t) n_threads, sizeof(int));
+    if (started == NULL) {
+        free(regions);
+        return 1;
+    }
+    for (int i = 1; i < n_threads; ++i) {
+        started[i] = pthread_create(&regions[i].thread, NULL, index_region, &regions[i]) == 0;
+    }
+
+    int error = walk_frames(fd, n_atoms, 0, regions[0].limit, file_size, result);
+
+    for (int i = 1; i < n_threads; ++i) {
+        if (started[i]) pthread_join(regions[i].thread, NULL);
+    }
+
+    // stitch the chains together, walking again through the regions whose chain does not continue the verified one
+    for (int i = 1; i < n_threads && !error && !result->last && !result->failed; ++i) {
+        const region_t *region = &regions[i];
+        // no frame starts in this region
+        if (result->end >= region->limit) continue;
+
+        if (started[i] && region->found && !region->chain.failed && region->chain.starts != NULL && region->chain.starts[0] == result->end) {
+            error = append_chain(result, &region->chain);
+        } else {
+            error = walk_frames(fd, n_atoms, result->end, region->limit, file_size, result);
+        }
+    }
+
+    for (int i = 0; i < n_threads; ++i) free(regions[i].chain.starts);
+    free(regions);
+    free(started);
+    return error;
+}
+
+int frame_index_build(int fd, int n_atoms, int n_threads, frame_index_t *index)
+{
+    struct stat info;
+    if (fstat(fd, &info) != 0) return 1;
+    const uint64_t file_size = (uint64_t) info.st_size;
+
+    chain_t chain = {0};
+    int error = 0;
+    if (n_threads > 1 && file_size >= PARALLEL_MIN_SIZE) {
+        error = index_parallel(fd, n_atoms, n_threads, file_size, &chain);
+    } else {
+        error = walk_frames(fd, n_atoms, 0, file_size, file_size, &chain);
+    }
+
+    if (error || chain.failed) {
+        free(chain.starts);
+        return 1;
+    }
+
+    // offsets of all frames followed by the end of the last frame
+    index->n_frames = chain.n_starts;
+    index->offsets = malloc((chain.n_starts + 1) * sizeof(uint64_t));
+    if (index->offsets == NULL) {
+        free(chain.starts);
+        return 1;
+    }
+    if (chain.n_starts > 0) memcpy(index->offsets, chain.starts, chain.n_starts * sizeof(uint64_t));
+    index->offsets[chain.n_starts] = chain.end;
+
+    free(chain.starts);
+    return 0;
+}
+
+void frame_index_free(frame_index_t *index)
+{
+    free(index->offsets);
+    index->offsets = NULL;
+    index->n_frames = 0;
+}
@@ -0,0 +1,41 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef FRAMEINDEX_H
+#define FRAMEINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* positions of frames in an xtc file */
+typedef struct frame_index {
+    size_t n_frames;
+    uint64_t *offsets;      // n_frames + 1 entries, the last one marks the end of the last frame
+} frame_index_t;
+
+/*
+ * Builds the index of an xtc file open as fd by walking through the frame headers.
+ * Large files are split into n_threads regions that are searched for frames in parallel.
+ * All frames must contain n_atoms atoms. An incomplete last frame is not indexed.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+int frame_index_build(int fd, int n_atoms, int n_threads, frame_index_t *index);
+
+/*
+ * Returns the size of the frame with the given index.
+ */
+static inline size_t frame_index_size(const frame_index_t *index, size_t frame)
+{
+    return (size_t) (index->offsets[frame + 1] - index->offsets[frame]);
+}
+
+/*
+ * Searches the xtc file open as fd for the first frame with n_atoms atoms starting at or after offset.
+ * A frame is accepted, if its header is plausible and it is followed by a valid frame (or the end of the file).
+ * Returns the offset of the frame or file_size, if no frame has been found.
+ */
+uint64_t frame_index_resync(int fd, int n_atoms, uint64_t offset, uint64_t file_size);
+
+void frame_index_free(frame_index_t *index);
+
+#endif /* FRAMEINDEX_H */
@@ -0,0 +1,310 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "geometry.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// number of frames whose sums are kept together by geometry_center_frames
+#define FRAME_CHUNK 16
+
+// number of atoms translated at once, only blocks with atoms far outside the box are wrapped by loops
+#define TRANSLATE_BLOCK 256
+
+/*
+ * Adds the position of an atom into the sums of the Bai & Breen algorithm.
+ * The sums are kept in double precision: a float sum of millions of terms of the same sign
+ * reaches a magnitude at which the individual terms are mostly rounded away.
+ */
+static inline void add_position(const float position[3], const float box[3], double sum_xi[3], double sum_zeta[3])
+{
+    for (int dim = 0; dim < 3; ++dim) {
+        float theta = (position[dim] / box[dim]) * 2 * M_PI;
+        sum_xi[dim] += cos(theta);
+        sum_zeta[dim] += sin(theta);
+    }
+}
+
+/*
+ * Converts the sums of the Bai & Breen algorithm into the center of geometry.
+ */
+static inline void finish_center(const double sum_xi[3], const double sum_zeta[3], size_t n_indices, const float box[3], float center[3])
+{
+    for (int dim = 0; dim < 3; ++dim) {
+        double xi = sum_xi[dim] / n_indices;
+        double zeta = sum_zeta[dim] / n_indices;
+        double theta = atan2(-zeta, -xi) + M_PI;
+        center[dim] = box[dim] * (theta / (2 * M_PI));
+    }
+}
+
+void geometry_center(const float *coordinates, const size_t *indices, size_t n_indices, const float box[3], float center[3])
+{
+    double sum_xi[3] = {0.0};
+    double sum_zeta[3] = {0.0};
+
+    for (size_t i = 0; i < n_indices; ++i) {
+        add_position(coordinates + 3 * indices[i], box, sum_xi, sum_zeta);
+    }
+
+    finish_center(sum_xi, sum_zeta, n_indices, box, center);
+}
+
+void geometry_center_frames(
+        const float *const *coordinates, size_t n_frames,
+        const size_t *indices, size_t n_indices,
+        const float *boxes, float *centers)
+{
+    for (size_t first = 0; first < n_frames; first += FRAME_CHUNK) {
+        const size_t n_chunk = n_frames - first < FRAME_CHUNK ? n_frames - first : FRAME_CHUNK;
+        const float *const *chunk = coordinates + first;
+        const float *chunk_boxes = boxes + 3 * first;
+
+        // sums are stored by dimension, so the innermost loop runs over the frames
+        double sum_xi[3][FRAME_CHUNK] = {{0.0}};
+        double sum_zeta[3][FRAME_CHUNK] = {{0.0}};
+
+        // every frame sums the atoms in the same order as geometry_center
+        for (size_t i = 0; i < n_indices; ++i) {
+            const size_t offset = 3 * indices[i];
+            for (int dim = 0; dim < 3; ++dim) {
+                for (size_t frame = 0; frame < n_chunk; ++frame) {
+                    float theta = (chunk[frame][offset + dim] / chunk_boxes[3 * frame + dim]) * 2 * M_PI;
+                    sum_xi[dim][frame] += cos(theta);
+                    sum_zeta[dim][frame] += sin(theta);
+                }
+            }
+        }
+
+        for (size_t frame = 0; frame < n_chunk; ++frame) {
+            const double frame_xi[3] = { sum_xi[0][frame], sum_xi[1][frame], sum_xi[2][frame] };
+            const double frame_zeta[3] = { sum_zeta[0][frame], sum_zeta[1][frame], sum_zeta[2][frame] };
+            finish_center(frame_xi, frame_zeta, n_indices, chunk_boxes + 3 * frame, centers + 3 * (first + frame));
+        }
+    }
+}
+
+/*
+ * Wraps the coordinates of n_atoms atoms starting at position into the box (continuing the wrapping
+ * of atoms already moved by at most one box length).
+ */
+static void wrap_atoms(float *position, size_t n_atoms, const float box[3])
+{
+    for (size_t i = 0; i < 3 * n_atoms; i += 3) {
+        for (int dim = 0; dim < 3; ++dim) {
+            while (position[i + dim] > box[dim]) position[i + dim] -= box[dim];
+            while (position[i + dim] < 0) position[i + dim] += box[dim];
+        }
+    }
+}
+
+void geometry_translate(float *coordinates, size_t n_atoms, const float translation[3], const float box[3])
+{
+    // translation and box repeated for eight atoms (24 values), so the loops are vectorized
+    float shift[24], size[24];
+    for (int j = 0; j < 24; ++j) {
+        shift[j] = translation[j % 3];
+        size[j] = box[j % 3];
+    }
+
+    for (size_t first = 0; first < n_atoms; first += TRANSLATE_BLOCK) {
+        const size_t n_block = n_atoms - first < TRANSLATE_BLOCK ? n_atoms - first : TRANSLATE_BLOCK;
+        float *block = coordinates + 3 * first;
+        const size_t n_values = 3 * n_block;
+
+        // every value is moved by at most one box length without branching,
+        // which is enough for nearly all atoms, since the translation is shorter than the box
+        int outside[24] = {0};
+        size_t i = 0;
+        for (; i + 24 <= n_values; i += 24) {
+            for (int j = 0; j < 24; ++j) {
+                float value = block[i + j] + shift[j];
+                value = value > size[j] ? value - size[j] : value;
+                value = value < 0 ? value + size[j] : value;
+                outside[j] |= (value > size[j]) | (value < 0);
+                block[i + j] = value;
+            }
+        }
+        for (int j = 0; i < n_values; ++i, ++j) {
+            float value = block[i] + shift[j];
+            value = value > size[j] ? value - size[j] : value;
+            value = value < 0 ? value + size[j] : value;
+            outside[j] |= (value > size[j]) | (value < 0);
+            block[i] = value;
+        }
+
+        // atoms far outside the box are wrapped the same way as by the loops of the reference implementation
+        int any_outside = 0;
+        for (int j = 0; j < 24; ++j) any_outside |= outside[j];
+        if (any_outside) wrap_atoms(block, n_block, box);
+    }
+}
+
+/*
+ * Defines a function calculating the center of geometry from integer coordinates with positions
+ * and angles of type real. The float variant gives results identical to geometry_center
+ * applied to the converted coordinates, the double variant is used for very large boxes.
+ */
+#define DEFINE_CENTER_QUANTIZED(name, real)                                                         \
+void name(                                                                                          \
+        const int *x, const int *y, const int *z,                                                   \
+        const size_t *indices, size_t n_indices,                                                    \
+        real inv_precision, const real box[3], real center[3])                                      \
+{                                                                                                   \
+    double sum_xi[3] = {0.0};                                                                       \
+    double sum_zeta[3] = {0.0};                                                                     \
+                                                                                                    \
+    for (size_t i = 0; i < n_indices; ++i) {                                                        \
+        const size_t atom = indices[i];                                                             \
+        const real position[3] = { x[atom] * inv_precision, y[atom] * inv_precision, z[atom] * inv_precision }; \
+        for (int dim = 0; dim < 3; ++dim) {                                                         \
+            real theta = (position[dim] / box[dim]) * 2 * M_PI;                                     \
+            sum_xi[dim] += cos(theta);                                                              \
+            sum_zeta[dim] += sin(theta);                                                            \
+        }                                                                                           \
+    }                                                                                               \
+                                                                                                    \
+    for (int dim = 0; dim < 3; ++dim) {                                                             \
+        double xi = sum_xi[dim] / n_indices;                                                        \
+        double zeta = sum_zeta[dim] / n_indices;                                                    \
+        double theta = atan2(-zeta, -xi) + M_PI;                                                    \
+        center[dim] = box[dim] * (theta / (2 * M_PI));                                              \
+    }                                                                                               \
+}
+
+DEFINE_CENTER_QUANTIZED(geometry_center_quantized, float)
+DEFINE_CENTER_QUANTIZED(geometry_center_precise, double)
+
+/*
+ * Defines a function translating one array of integer coordinates by shift and wrapping it into [0, box].
+ * The sums are calculated in type real and converted back to integers by to_int.
+ * Like geometry_translate, values are moved by at most one box length without branching in a single pass
+ * and only blocks containing values further outside the box are wrapped by loops.
+ */
+#define DEFINE_TRANSLATE_AXIS(name, real, to_int)                                                   \
+static void name(int *values, size_t n_atoms, real shift, real box)                                 \
+{                                                                                                   \
+    real moved[TRANSLATE_BLOCK];                                                                    \
+    for (size_t first = 0; first < n_atoms; first += TRANSLATE_BLOCK) {                             \
+        const size_t n_block = n_atoms - first < TRANSLATE_BLOCK ? n_atoms - first : TRANSLATE_BLOCK; \
+        int *block = values + first;                                                                \
+                                                                                                    \
+        int outside = 0;                                                                            \
+        for (size_t i = 0; i < n_block; ++i) {                                                      \
+            real value = (real) block[i] + shift;                                                   \
+            value = value > box ? value - box : value;                                              \
+            value = value < 0 ? value + box : value;                                                \
+            outside |= (value > box) | (value < 0);                                                 \
+            moved[i] = value;                                                                       \
+        }                                                                                           \
+                                                                                                    \
+        if (!outside) {                                                                             \
+            for (size_t i = 0; i < n_block; ++i) block[i] = to_int(moved[i]);                       \
+            continue;                                                                               \
+        }                                                                                           \
+                                                                                                    \
+        /* continuing from the moved values takes the same steps as wrapping the sums */            \
+        for (size_t i = 0; i < n_block; ++i) {                                                      \
+            real value = moved[i];                                                                  \
+            while (value > box) value -= box;                                                       \
+            while (value < 0) value += box;                                                         \
+            block[i] = to_int(value);                                                               \
+        }                                                                                           \
+    }                                                                                               \
+}
+
+// the sums of integer coordinates can exceed the range of int before wrapping
+static inline int narrow_int(int64_t value)
+{
+    return (int) value;
+}
+
+// wrapped values are not negative, so adding one half and truncating rounds them as xtc_quantize does
+static inline int round_units(double value)
+{
+    return (int) (value + 0.5);
+}
+
+DEFINE_TRANSLATE_AXIS(translate_axis, int64_t, narrow_int)
+DEFINE_TRANSLATE_AXIS(translate_axis_precise, double, round_units)
+
+void geometry_translate_quantized(int *x, int *y, int *z, size_t n_atoms, const int shift[3], const int box[3])
+{
+    translate_axis(x, n_atoms, shift[0], box[0]);
+    translate_axis(y, n_atoms, shift[1], box[1]);
+    translate_axis(z, n_atoms, shift[2], box[2]);
+}
+
+void geometry_translate_precise(int *x, int *y, int *z, size_t n_atoms, const double shift[3], const double box[3])
+{
+    translate_axis_precise(x, n_atoms, shift[0], box[0]);
+    translate_axis_precise(y, n_atoms, shift[1], box[1]);
+    translate_axis_precise(z, n_atoms, shift[2], box[2]);
+}
+
+int center_table_update(center_table_t *table, const int box[3])
+{
+    for (int dim = 0; dim < 3; ++dim) {
+        if (table->terms[dim] != NULL && table->box[dim] == box[dim]) continue;
+
+        float *terms = realloc(table->terms[dim], 2 * (size_t) box[dim] * sizeof(float));
+        if (terms == NULL) return 1;
+        table->terms[dim] = terms;
+        table->box[dim] = box[dim];
+
+        for (int i = 0; i < box[dim]; ++i) {
+            const double theta = 2 * M_PI * i / box[dim];
+            terms[2 * i] = cos(theta);
+            terms[2 * i + 1] = sin(theta);
+        }
+    }
+
+    return 0;
+}
+
+void center_table_free(center_table_t *table)
+{
+    for (int dim = 0; dim < 3; ++dim) {
+        free(table->terms[dim]);
+        table->terms[dim] = NULL;
+        table->box[dim] = 0;
+    }
+}
+
+/*
+ * Returns value modulo size in the range [0, size).
+ */
+static inline int wrap_index(int value, int size)
+{
+    // coordinates are mostly inside the box, so the division is usually avoided
+    if ((unsigned int) value < (unsigned int) size) return value;
+    const int index = value % size;
+    return index < 0 ? index + size : index;
+}
+
+void geometry_center_lookup(
+        const center_table_t *table,
+        const int *x, const int *y, const int *z,
+        const size_t *indices, size_t n_indices,
+        const float box[3], float center[3])
+{
+    double sum_xi[3] = {0.0};
+    double sum_zeta[3] = {0.0};
+    const int *values[3] = { x, y, z };
+
+    for (size_t i = 0; i < n_indices; ++i) {
+        const size_t atom = indices[i];
+        for (int dim = 0; dim < 3; ++dim) {
+            const float *terms = table->terms[dim] + 2 * wrap_index(values[dim][atom], table->box[dim]);
+            sum_xi[dim] += terms[0];
+            sum_zeta[dim] += terms[1];
+        }
+    }
+
+    finish_center(sum_xi, sum_zeta, n_indices, box, center);
+}
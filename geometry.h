@@ -0,0 +1,107 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+
+#include <stddef.h>
+
+/*
+ * Calculates translation moving center to the center of the box in the selected dimensions.
+ */
+static inline void set_translation(float translation[3], const float box[3], const float center[3], const int x, const int y, const int z)
+{
+    if (x) translation[0] = (box[0] / 2) - center[0];
+    if (y) translation[1] = (box[1] / 2) - center[1];
+    if (z) translation[2] = (box[2] / 2) - center[2];
+}
+
+/* lookup tables of the Bai & Breen terms (cosine and sine of the angle) of integer positions in a box */
+typedef struct center_table {
+    int box[3];                 // box size the tables have been built for (in integer units)
+    float *terms[3];            // cosine and sine of every position 0 <= i < box stored at 2 * i and 2 * i + 1
+} center_table_t;
+
+/*
+ * Calculates center of geometry of the atoms with the given indices
+ * in a periodic rectangular box using the algorithm of Bai & Breen.
+ * coordinates are stored as x, y, z triplets.
+ */
+void geometry_center(const float *coordinates, const size_t *indices, size_t n_indices, const float box[3], float center[3]);
+
+/*
+ * Calculates centers of geometry of the atoms with the given indices in n_frames frames at once.
+ * coordinates[f] points to the coordinates of frame f (x, y, z triplets),
+ * boxes and centers contain three values for every frame.
+ * The sums of all frames are accumulated together for every atom, so for small numbers of atoms
+ * the frames are processed without the overhead of separate calls. Results are identical to geometry_center.
+ */
+void geometry_center_frames(
+        const float *const *coordinates, size_t n_frames,
+        const size_t *indices, size_t n_indices,
+        const float *boxes, float *centers);
+
+/*
+ * Translates n_atoms atoms by translation and wraps them into the rectangular box.
+ * Atoms are moved by at most one box length without branching and only blocks of atoms
+ * that end up further outside the box are wrapped by loops. The result is identical to wrapping every atom by loops.
+ */
+void geometry_translate(float *coordinates, size_t n_atoms, const float translation[3], const float box[3]);
+
+/*
+ * Calculates center of geometry of the atoms with the given indices from integer coordinates
+ * stored in arrays x, y and z. Coordinates are converted using inv_precision, so the result
+ * is identical to geometry_center applied to the converted coordinates.
+ */
+void geometry_center_quantized(
+        const int *x, const int *y, const int *z,
+        const size_t *indices, size_t n_indices,
+        float inv_precision, const float box[3], float center[3]);
+
+/*
+ * Like geometry_center_quantized, but with positions, angles and the center in double precision.
+ * Used for boxes so large that single-precision positions approach the precision of xtc files.
+ */
+void geometry_center_precise(
+        const int *x, const int *y, const int *z,
+        const size_t *indices, size_t n_indices,
+        double inv_precision, const double box[3], double center[3]);
+
+/*
+ * Translates n_atoms atoms with integer coordinates stored in arrays x, y and z by shift
+ * and wraps them into the rectangular box (all in the same integer units).
+ * Like geometry_translate, atoms are wrapped into the interval [0, box] without branching
+ * and only blocks of atoms further outside the box are wrapped by loops.
+ */
+void geometry_translate_quantized(int *x, int *y, int *z, size_t n_atoms, const int shift[3], const int box[3]);
+
+/*
+ * Translates n_atoms atoms with integer coordinates stored in arrays x, y and z by shift,
+ * wraps them into the rectangular box in double precision (shift and box in the units of the coordinates,
+ * not necessarily whole) and rounds them to the nearest integers. The loops are vectorized like in
+ * geometry_translate_quantized.
+ */
+void geometry_translate_precise(int *x, int *y, int *z, size_t n_atoms, const double shift[3], const double box[3]);
+
+/*
+ * Makes the lookup tables correspond to box (in integer units). Only the tables of axes
+ * whose size has changed are rebuilt, so the tables are built once for boxes of constant size.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+int center_table_update(center_table_t *table, const int box[3]);
+
+void center_table_free(center_table_t *table);
+
+/*
+ * Calculates center of geometry of the atoms with the given indices from integer coordinates
+ * stored in arrays x, y and z using the lookup tables instead of evaluating cosine and sine.
+ * The angle of every atom is given by its coordinate modulo the box size of the table.
+ * box is the size of the box in nm.
+ */
+void geometry_center_lookup(
+        const center_table_t *table,
+        const int *x, const int *y, const int *z,
+        const size_t *indices, size_t n_indices,
+        const float box[3], float center[3]);
+
+#endif /* GEOMETRY_H */
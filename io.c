@@ -0,0 +1,56 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#include <errno.h>
+#include <unistd.h>
+#include "io.h"
+
+ssize_t read_full(int fd, unsigned char *buffer, size_t size)
+{
+    size_t total = 0;
+    while (total < size) {
+        ssize_t n = read(fd, buffer + total, size - total);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) break;
+        total += (size_t) n;
+    }
+    return (ssize_t) total;
+}
+
+ssize_t pread_full(int fd, unsigned char *buffer, size_t size, off_t offset)
+{
+    size_t total = 0;
+    while (total < size) {
+        ssize_t n = pread(fd, buffer + total, size - total, offset + (off_t) total);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) break;
+        total += (size_t) n;
+    }
+    return (ssize_t) total;
+}
+
+int write_full(int fd, const unsigned char *buffer, size_t size)
+{
+    size_t total = 0;
+    while (total < size) {
+        ssize_t n = write(fd, buffer + total, size - total);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 1;
+        total += (size_t) n;
+    }
+    return 0;
+}
+
+int pwrite_full(int fd, const unsigned char *buffer, size_t size, off_t offset)
+{
+    size_t total = 0;
+    while (total < size) {
+        ssize_t n = pwrite(fd, buffer + total, size - total, offset + (off_t) total);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 1;
+        total += (size_t) n;
+    }
+    return 0;
+}
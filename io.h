@@ -0,0 +1,34 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef IO_H
+#define IO_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Reads up to size bytes from fd.
+ * Returns the number of bytes read (less than size at the end of the file) or -1 on error.
+ */
+ssize_t read_full(int fd, unsigned char *buffer, size_t size);
+
+/*
+ * Reads up to size bytes from fd starting at offset.
+ * Returns the number of bytes read (less than size at the end of the file) or -1 on error.
+ */
+ssize_t pread_full(int fd, unsigned char *buffer, size_t size, off_t offset);
+
+/*
+ * Writes size bytes into fd.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+int write_full(int fd, const unsigned char *buffer, size_t size);
+
+/*
+ * Writes size bytes into fd starting at offset.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+int pwrite_full(int fd, const unsigned char *buffer, size_t size, off_t offset);
+
+#endif /* IO_H */
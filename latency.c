@@ -0,0 +1,115 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+// Latency histograms in the style of HdrHistogram.
+//
+// Latencies are counted in buckets whose width doubles with every power of two, every power
+// of two being split into LATENCY_SUB_BUCKETS buckets, so any latency is known with a relative
+// error of about 3 % and a histogram covering all possible latencies has a fixed size.
+// Recording is a few instructions: every thread owns its histograms and updates them with
+// relaxed atomic stores, so the reporter can merge them at any time without locking.
+
+#include <inttypes.h>
+#include "latency.h"
+
+static const char *STAGE_NAMES[LATENCY_STAGES] = { "read", "decode", "center", "wrap", "encode", "write" };
+
+static size_t bucket_of(uint64_t value)
+{
+    if (value < LATENCY_SUB_BUCKETS) return (size_t) value;
+
+    const int shift = 63 - __builtin_clzll(value) - LATENCY_SUB_BITS;
+    return (size_t) (shift + 1) * LATENCY_SUB_BUCKETS + (size_t) ((value >> shift) - LATENCY_SUB_BUCKETS);
+}
+
+/*
+ * Returns the highest latency counted in the bucket.
+ */
+static uint64_t bucket_highest(size_t bucket)
+{
+    if (bucket < LATENCY_SUB_BUCKETS) return bucket;
+
+    const int shift = (int) (bucket / LATENCY_SUB_BUCKETS) - 1;
+    const uint64_t lowest = (uint64_t) (LATENCY_SUB_BUCKETS + bucket % LATENCY_SUB_BUCKETS) << shift;
+    return lowest + (((uint64_t) 1 << shift) - 1);
+}
+
+const char *latency_stage_name(latency_stage_t stage)
+{
+    return STAGE_NAMES[stage];
+}
+
+void latency_record(latency_recorder_t *recorder, latency_stage_t stage, uint64_t nanoseconds)
+{
+    latency_histogram_t *histogram = &recorder->stages[stage];
+    uint64_t *count = &histogram->counts[bucket_of(nanoseconds)];
+
+    // only the owning thread writes, so the increments need not be atomic
+    __atomic_store_n(count, __atomic_load_n(count, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&histogram->sum, __atomic_load_n(&histogram->sum, __ATOMIC_RELAXED) + nanoseconds, __ATOMIC_RELAXED);
+    if (nanoseconds > __atomic_load_n(&histogram->max, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&histogram->max, nanoseconds, __ATOMIC_RELAXED);
+    }
+}
+
+void latency_merge(latency_recorder_t *sum, const latency_recorder_t *recorder)
+{
+    for (int stage = 0; stage < LATENCY_STAGES; ++stage) {
+        latency_histogram_t *target = &sum->stages[stage];
+        const latency_histogram_t *source = &recorder->stages[stage];
+
+        for (size_t i = 0; i < LATENCY_BUCKETS; ++i) {
+            target->counts[i] += __atomic_load_n(&source->counts[i], __ATOMIC_RELAXED);
+        }
+        const uint64_t max = __atomic_load_n(&source->max, __ATOMIC_RELAXED);
+        if (max > target->max) target->max = max;
+        target->sum += __atomic_load_n(&source->sum, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * Returns the latency below or at which the given fraction of the counted latencies lies.
+ */
+static uint64_t percentile(const uint64_t *counts, uint64_t total, double fraction, uint64_t max)
+{
+    uint64_t rank = (uint64_t) (fraction * (double) total + 0.999999);
+    if (rank == 0) rank = 1;
+
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < LATENCY_BUCKETS; ++i) {
+        cumulative += counts[i];
+        if (cumulative >= rank) {
+            const uint64_t highest = bucket_highest(i);
+            return highest < max ? highest : max;
+        }
+    }
+
+    return max;
+}
+
+void latency_report(FILE *output, const char *title, const latency_recorder_t *current, const latency_recorder_t *previous)
+{
+    fprintf(output, "%s\n", title);
+    fprintf(output, "%-8s %12s %12s %12s %12s %12s\n", "stage", "frames", "p50 (us)", "p90 (us)", "p99 (us)", "max (us)");
+
+    uint64_t counts[LATENCY_BUCKETS];
+    for (int stage = 0; stage < LATENCY_STAGES; ++stage) {
+        const latency_histogram_t *histogram = &current->stages[stage];
+
+        uint64_t total = 0;
+        size_t highest = 0;
+        for (size_t i = 0; i < LATENCY_BUCKETS; ++i) {
+            counts[i] = histogram->counts[i] - (previous == NULL ? 0 : previous->stages[stage].counts[i]);
+            total += counts[i];
+            if (counts[i] > 0) highest = i;
+        }
+        if (total == 0) continue;
+
+        uint64_t max = histogram->max;
+        if (previous != NULL && bucket_highest(highest) < max) max = bucket_highest(highest);
+
+        fprintf(output, "%-8s %12" PRIu64 " %12.1f %12.1f %12.1f %12.1f\n", latency_stage_name(stage), total,
+                (double) percentile(counts, total, 0.50, max) * 1e-3, (double) percentile(counts, total, 0.90, max) * 1e-3,
+                (double) percentile(counts, total, 0.99, max) * 1e-3, (double) max * 1e-3);
+    }
+}
@@ -0,0 +1,91 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// every power of two of latencies is split into 2^LATENCY_SUB_BITS buckets (resolution of about 3 %)
+#define LATENCY_SUB_BITS 5
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+// number of buckets covering all latencies up to 2^64 nanoseconds
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+/* stages of processing a frame whose latencies are recorded */
+typedef enum latency_stage {
+    LATENCY_READ,
+    LATENCY_DECODE,
+    LATENCY_CENTER,
+    LATENCY_WRAP,
+    LATENCY_ENCODE,
+    LATENCY_WRITE,
+    LATENCY_STAGES,
+} latency_stage_t;
+
+/* log-linear histogram of latencies (in nanoseconds) */
+typedef struct latency_histogram {
+    uint64_t counts[LATENCY_BUCKETS];
+    uint64_t max;
+    uint64_t sum;               // sum of all recorded latencies
+} latency_histogram_t;
+
+/* histograms of all stages, updated by a single thread and read concurrently by the reporter */
+typedef struct latency_recorder {
+    latency_histogram_t stages[LATENCY_STAGES];
+} latency_recorder_t;
+
+static inline uint64_t latency_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
+
+/*
+ * Returns the name of the stage.
+ */
+const char *latency_stage_name(latency_stage_t stage);
+
+/*
+ * Records a latency of the stage. Must only be called by the thread owning recorder.
+ */
+void latency_record(latency_recorder_t *recorder, latency_stage_t stage, uint64_t nanoseconds);
+
+/*
+ * Returns the current time to be passed to latency_lap or zero, if recorder is NULL.
+ */
+static inline uint64_t latency_start(const latency_recorder_t *recorder)
+{
+    return recorder == NULL ? 0 : latency_now();
+}
+
+/*
+ * Records the time elapsed since start as a latency of the stage and sets start to the current time.
+ * Does nothing, if recorder is NULL.
+ */
+static inline void latency_lap(latency_recorder_t *recorder, latency_stage_t stage, uint64_t *start)
+{
+    if (recorder == NULL) return;
+
+    const uint64_t now = latency_now();
+    latency_record(recorder, stage, now - *start);
+    *start = now;
+}
+
+/*
+ * Adds the histograms of recorder (which may be updated by its thread at the same time) to sum.
+ */
+void latency_merge(latency_recorder_t *sum, const latency_recorder_t *recorder);
+
+/*
+ * Prints the number of latencies, their 50th, 90th and 99th percentile and their maximum
+ * for every stage of current into output, preceded by title.
+ * If previous is not NULL, only latencies recorded after previous (an earlier merge of the same recorders)
+ * are reported; their maximum is then only known up to the resolution of the histograms.
+ */
+void latency_report(FILE *output, const char *title, const latency_recorder_t *current, const latency_recorder_t *previous);
+
+#endif /* LATENCY_H */
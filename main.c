@@ -3,10 +3,36 @@
 // VERSION 2022/09/01
 
 #include <unistd.h>
+#include <getopt.h>
 #include <groan.h>
-
-// frequency of printing during the calculation
-static const int PROGRESS_FREQ = 10000;
+#include "batch.h"
+#include "estimate.h"
+#include "geometry.h"
+#include "pipeline.h"
+#include "query.h"
+#include "startup.h"
+#include "topology.h"
+#include "verify.h"
+
+// identifiers of options that only have a long form
+enum long_option {
+    OPT_NUMA = 256,
+    OPT_IO,
+    OPT_DIRECT,
+    OPT_CHECKSUMS,
+    OPT_VERIFY,
+    OPT_RECOVER,
+    OPT_INTEGER,
+    OPT_LOOKUP,
+    OPT_SAMPLE,
+    OPT_CENTERS,
+    OPT_FRAME_BATCH,
+    OPT_ESTIMATE,
+    OPT_LATENCY,
+    OPT_LATENCY_INTERVAL,
+    OPT_METRICS,
+    OPT_METRICS_INTERVAL,
+};
 
 /*
  * Parses command line arguments.
@@ -16,23 +42,47 @@ int get_arguments(
         int argc, 
         char **argv,
         char **gro_file,
-        char **xtc_file,
         char **ndx_file,
-        char **output_file,
         char **reference_atoms,
-        int *skip,
-        int *center_x,
-        int *center_y,
-        int *center_z) 
+        char **batch_file,
+        char **verify_file,
+        int *sample_every,
+        int *estimate,
+        pipeline_config_t *config) 
 {
-    int gro_specified = 0, output_specified = 0;
+    int gro_specified = 0, output_specified = 0, io_specified = 0;
+
+    static const struct option long_options[] = {
+        {"batch", required_argument, NULL, 'b'},
+        {"numa", no_argument, NULL, OPT_NUMA},
+        {"io", required_argument, NULL, OPT_IO},
+        {"direct", no_argument, NULL, OPT_DIRECT},
+        {"checksums", no_argument, NULL, OPT_CHECKSUMS},
+        {"verify", required_argument, NULL, OPT_VERIFY},
+        {"recover", no_argument, NULL, OPT_RECOVER},
+        {"integer", no_argument, NULL, OPT_INTEGER},
+        {"lookup", no_argument, NULL, OPT_LOOKUP},
+        {"sample", required_argument, NULL, OPT_SAMPLE},
+        {"centers", required_argument, NULL, OPT_CENTERS},
+        {"frame-batch", required_argument, NULL, OPT_FRAME_BATCH},
+        {"estimate", no_argument, NULL, OPT_ESTIMATE},
+        {"latency", no_argument, NULL, OPT_LATENCY},
+        {"latency-interval", required_argument, NULL, OPT_LATENCY_INTERVAL},
+        {"metrics", required_argument, NULL, OPT_METRICS},
+        {"metrics-interval", required_argument, NULL, OPT_METRICS_INTERVAL},
+        {NULL, 0, NULL, 0}
+    };
 
     int opt = 0;
-    while((opt = getopt(argc, argv, "c:f:n:o:r:s:xyzh")) != -1) {
+    while((opt = getopt_long(argc, argv, "b:c:f:n:o:r:s:t:xyzh", long_options, NULL)) != -1) {
         switch (opt) {
         // help
         case 'h':
             return 1;
+        // list of trajectories to center
+        case 'b':
+            *batch_file = optarg;
+            break;
         // gro file to read
         case 'c':
             *gro_file = optarg;
@@ -40,7 +90,7 @@ int get_arguments(
             break;
         // xtc file to read
         case 'f':
-            *xtc_file = optarg;
+            config->input_file = optarg;
             break;
         // ndx file to read
         case 'n':
@@ -48,7 +98,7 @@ int get_arguments(
             break;
         // output file name
         case 'o':
-            *output_file = optarg;
+            config->output_file = optarg;
             output_specified = 1;
             break;
         // reference atoms
@@ -57,25 +107,136 @@ int get_arguments(
             break;
         // skip frames
         case 's':
-            if (sscanf(optarg, "%d", skip) != 1) {
+            if (sscanf(optarg, "%d", &config->skip) != 1) {
                 fprintf(stderr, "Could not parse skip value (flag '-s').\n");
                 return 1;
             }
             
-            if (*skip <= 0) {
+            if (config->skip <= 0) {
                 fprintf(stderr, "Skip must be positive.\n");
                 return 1;
             }
             break;
+        // number of worker threads
+        case 't':
+            if (sscanf(optarg, "%d", &config->n_threads) != 1) {
+                fprintf(stderr, "Could not parse number of threads (flag '-t').\n");
+                return 1;
+            }
+
+            if (config->n_threads <= 0) {
+                fprintf(stderr, "Number of threads must be positive.\n");
+                return 1;
+            }
+            break;
         // centering in individual dimensions
         case 'x':
-            *center_x = 1;
+            config->center[0] = 1;
             break;
         case 'y':
-            *center_y = 1;
+            config->center[1] = 1;
             break;
         case 'z':
-            *center_z = 1;
+            config->center[2] = 1;
+            break;
+        // NUMA placement of worker threads
+        case OPT_NUMA:
+            config->numa = 1;
+            break;
+        // backend for asynchronous reading and writing
+        case OPT_IO:
+            if (stream_parse_backend(optarg, &config->io_backend) != 0) {
+                fprintf(stderr, "Unknown input/output backend '%s' (flag '--io').\n", optarg);
+                return 1;
+            }
+            io_specified = 1;
+            break;
+        // direct output bypassing the page cache
+        case OPT_DIRECT:
+            config->direct = 1;
+            break;
+        // checksums of the output frames
+        case OPT_CHECKSUMS:
+            config->checksums = 1;
+            break;
+        // xtc file to verify against its checksums
+        case OPT_VERIFY:
+            *verify_file = optarg;
+            break;
+        // skipping of damaged parts of the input
+        case OPT_RECOVER:
+            config->recover = 1;
+            break;
+        // centering of compressed frames on integer coordinates
+        case OPT_INTEGER:
+            config->integer = 1;
+            break;
+        // centers of geometry calculated using lookup tables
+        case OPT_LOOKUP:
+            config->lookup = 1;
+            break;
+        // estimating the center from every Nth residue of the reference atoms
+        case OPT_SAMPLE:
+            if (sscanf(optarg, "%d", sample_every) != 1) {
+                fprintf(stderr, "Could not parse sampling of residues (flag '--sample').\n");
+                return 1;
+            }
+
+            if (*sample_every <= 0) {
+                fprintf(stderr, "Sampling of residues must be positive.\n");
+                return 1;
+            }
+            break;
+        // file for the centers and translations of the frames
+        case OPT_CENTERS:
+            config->centers_file = optarg;
+            break;
+        // number of frames processed together
+        case OPT_FRAME_BATCH:
+            if (sscanf(optarg, "%d", &config->frame_batch) != 1) {
+                fprintf(stderr, "Could not parse the size of frame batches (flag '--frame-batch').\n");
+                return 1;
+            }
+
+            if (config->frame_batch <= 0) {
+                fprintf(stderr, "Size of frame batches must be positive.\n");
+                return 1;
+            }
+            break;
+        // estimating the cost of centering without centering
+        case OPT_ESTIMATE:
+            *estimate = 1;
+            break;
+        // distribution of the latencies of the individual stages
+        case OPT_LATENCY:
+            config->latency = 1;
+            break;
+        case OPT_LATENCY_INTERVAL:
+            if (sscanf(optarg, "%d", &config->latency_interval) != 1) {
+                fprintf(stderr, "Could not parse the interval of latency reports (flag '--latency-interval').\n");
+                return 1;
+            }
+
+            if (config->latency_interval <= 0) {
+                fprintf(stderr, "Interval of latency reports must be positive.\n");
+                return 1;
+            }
+            config->latency = 1;
+            break;
+        // metrics for the textfile collector of Prometheus
+        case OPT_METRICS:
+            config->metrics_file = optarg;
+            break;
+        case OPT_METRICS_INTERVAL:
+            if (sscanf(optarg, "%d", &config->metrics_interval) != 1) {
+                fprintf(stderr, "Could not parse the interval of writing metrics (flag '--metrics-interval').\n");
+                return 1;
+            }
+
+            if (config->metrics_interval <= 0) {
+                fprintf(stderr, "Interval of writing metrics must be positive.\n");
+                return 1;
+            }
             break;
         default:
             //fprintf(stderr, "Unknown command line option: %c.\n", opt);
@@ -83,214 +244,305 @@ int get_arguments(
         }
     }
 
-    if (!gro_specified || !output_specified) {
+    // verification does not need any other input
+    if (*verify_file != NULL) return 0;
+
+    if (*estimate && (config->input_file == NULL || *batch_file != NULL)) {
+        fprintf(stderr, "Flag '--estimate' requires an xtc file (flag '-f').\n");
+        return 1;
+    }
+
+    if (!gro_specified || (!output_specified && *batch_file == NULL && config->centers_file == NULL && !*estimate)) {
         fprintf(stderr, "Gro file and output file must always be supplied.\n");
         return 1;
     }
+
+    if (config->centers_file != NULL && (config->input_file == NULL || *batch_file != NULL)) {
+        fprintf(stderr, "Centers can only be exported from an xtc file (flag '-f').\n");
+        return 1;
+    }
+
+    if (!output_specified && *batch_file == NULL && (config->checksums || config->direct)) {
+        fprintf(stderr, "Flags '--checksums' and '--direct' require an output file (flag '-o').\n");
+        return 1;
+    }
+
+    if (config->latency && config->input_file == NULL) {
+        fprintf(stderr, "Latencies can only be recorded when centering an xtc file (flag '-f').\n");
+        return 1;
+    }
+
+    if (config->metrics_file != NULL && config->input_file == NULL) {
+        fprintf(stderr, "Metrics can only be exported when centering an xtc file (flag '-f').\n");
+        return 1;
+    }
+
+    if (*batch_file != NULL && (config->input_file != NULL || output_specified)) {
+        fprintf(stderr, "Flags '-f' and '-o' cannot be combined with a batch file (flag '-b').\n");
+        return 1;
+    }
+
+    // batch mode indexes every input completely and stops at the first damaged frame
+    if (*batch_file != NULL && config->recover) {
+        fprintf(stderr, "Flag '--recover' cannot be combined with a batch file (flag '-b').\n");
+        return 1;
+    }
+
+    // outputs of batch mode are written by the workers with plain writes
+    if (*batch_file != NULL && config->direct) {
+        fprintf(stderr, "Flag '--direct' cannot be combined with a batch file (flag '-b').\n");
+        return 1;
+    }
+
+    // batch mode reads and writes with pread/write instead of the asynchronous streams
+    if (*batch_file != NULL && io_specified) {
+        fprintf(stderr, "Flag '--io' cannot be combined with a batch file (flag '-b').\n");
+        return 1;
+    }
+
+    // workers of batch mode center their ranges one frame at a time
+    if (*batch_file != NULL && config->frame_batch > 1) {
+        fprintf(stderr, "Flag '--frame-batch' cannot be combined with a batch file (flag '-b').\n");
+        return 1;
+    }
     return 0;
 }
 
+/*
+ * Selects atoms of every nth residue of the reference atoms.
+ * Residues follow each other in the chain, so the sample is spread over the whole reference group.
+ * Indices of the selected atoms are written into sample, which must have space for all reference atoms.
+ * Returns the number of selected atoms.
+ */
+static size_t sample_residues(const topology_t *topology, const size_t *reference, size_t n_reference, int every, size_t *sample)
+{
+    size_t n_sampled = 0;
+    size_t residue = 0;
+    for (size_t i = 0; i < n_reference; ++i) {
+        if (i > 0 && topology_residue_number(topology, reference[i]) != topology_residue_number(topology, reference[i - 1])) residue++;
+        if (residue % (size_t) every == 0) sample[n_sampled++] = reference[i];
+    }
+
+    return n_sampled;
+}
+
+/*
+ * Selects atoms using smart_select from groan, which reads the gro file and the ndx file once more.
+ * Used for queries that cannot be compiled.
+ * Returns indices of the selected atoms (their number is written into n_selected) or NULL, if the selection has failed.
+ */
+static size_t *groan_select(const char *gro_file, const char *ndx_file, const char *query, size_t *n_selected)
+{
+    system_t *system = load_gro(gro_file);
+    if (system == NULL) return NULL;
+
+    // try reading ndx file (ignore if this fails)
+    dict_t *ndx_groups = read_ndx(ndx_file, system);
+
+    // select all atoms
+    atom_selection_t *all = select_system(system);
+    select_t *selection = all == NULL ? NULL : smart_select(all, query, ndx_groups);
+
+    size_t *indices = NULL;
+    if (selection != NULL) {
+        indices = malloc((selection->n_atoms + 1) * sizeof(size_t));
+        if (indices != NULL) {
+            for (size_t i = 0; i < selection->n_atoms; ++i) indices[i] = (size_t) (selection->atoms[i] - system->atoms);
+            *n_selected = selection->n_atoms;
+        }
+    }
+
+    dict_destroy(ndx_groups);
+    free(selection);
+    free(all);
+    free(system);
+    return indices;
+}
+
 void print_usage(const char *program_name)
 {
     printf("Usage: %s -c GRO_FILE -o OUTPUT_FILE [OPTION]...\n", program_name);
+    printf("       %s -c GRO_FILE -f XTC_FILE --centers CENTERS_FILE [OPTION]...\n", program_name);
+    printf("       %s -c GRO_FILE -b BATCH_FILE [OPTION]...\n", program_name);
+    printf("       %s -c GRO_FILE -f XTC_FILE --estimate [OPTION]...\n", program_name);
+    printf("       %s --verify XTC_FILE [-t INTEGER]\n", program_name);
     printf("\nOPTIONS\n");
     printf("-h               print this message and exit\n");
+    printf("-b STRING        file listing pairs of input and output xtc files to center (optional)\n");
     printf("-c STRING        gro file to read\n");
     printf("-f STRING        xtc file to read (optional)\n");
     printf("-n STRING        ndx file to read (optional, default: index.ndx)\n");
-    printf("-o STRING        output file name\n");
+    printf("-o STRING        output file name (optional with --centers)\n");
     printf("-r STRING        selection of atoms centered (default: Protein)\n");
     printf("-s INTEGER       only center every Nth frame (default: 1)\n");
+    printf("-t INTEGER       number of worker threads for xtc centering (default: 1)\n");
     printf("-x/-y/-z         center in individual x/y/z dimensions (default: center in xyz)\n");
+    printf("--numa           bind worker threads to NUMA nodes and report the placement\n");
+    printf("--io STRING      input/output backend for xtc files: auto, uring, threads (default: auto)\n");
+    printf("--direct         write the output xtc file with direct I/O into a preallocated file\n");
+    printf("--checksums      write CRC32C checksums of the output frames into OUTPUT_FILE.crc\n");
+    printf("--verify STRING  check xtc file against its checksums (STRING.crc) and exit\n");
+    printf("--recover        skip damaged parts of the input xtc file instead of stopping\n");
+    printf("--integer        center xtc frames on integer coordinates without conversion to floats\n");
+    printf("--lookup         calculate centers of xtc frames using lookup tables instead of cos/sin\n");
+    printf("--sample INTEGER estimate centers of xtc frames from every Nth reference residue (default: 1)\n");
+    printf("--centers STRING write centers of the reference atoms and translations of all xtc frames into a file\n");
+    printf("--estimate       predict the cost of centering the xtc file from a few sampled frames and exit\n");
+    printf("--frame-batch INTEGER\n");
+    printf("                 decode, center and encode N consecutive xtc frames together (default: 1)\n");
+    printf("--latency        report percentiles of the latencies of reading, decoding, centering, wrapping,\n");
+    printf("                 encoding and writing xtc frames\n");
+    printf("--latency-interval INTEGER\n");
+    printf("                 also report the latencies of every N seconds (implies --latency)\n");
+    printf("--metrics STRING write metrics in the Prometheus text format into a file during the centering\n");
+    printf("--metrics-interval INTEGER\n");
+    printf("                 write the metrics every N seconds (default: 15)\n");
     printf("\n");
 }
 
-inline void set_translation(vec_t translation, box_t box, vec_t center, const int x, const int y, const int z)
-{
-    if (x) translation[0] = (box[0] / 2) - center[0];
-    if (y) translation[1] = (box[1] / 2) - center[1];
-    if (z) translation[2] = (box[2] / 2) - center[2];
-}
-
 int main(int argc, char **argv)
 {
     // get arguments
     char *gro_file = NULL;
-    char *xtc_file = NULL;
     char *ndx_file = "index.ndx";
-    char *output_file = NULL;
     char *reference_atoms = "Protein";
-    int skip = 1;
-    int center_x = 0;
-    int center_y = 0;
-    int center_z = 0;
-
-    if (get_arguments(argc, argv, &gro_file, &xtc_file, &ndx_file, &output_file, &reference_atoms, &skip, &center_x, &center_y, &center_z) != 0) {
+    char *batch_file = NULL;
+    char *verify_file = NULL;
+    int sample_every = 1;
+    int estimate = 0;
+    pipeline_config_t config = {0};
+    config.skip = 1;
+    config.n_threads = 1;
+    config.frame_batch = 1;
+    config.metrics_interval = 15;
+
+    if (get_arguments(argc, argv, &gro_file, &ndx_file, &reference_atoms, &batch_file, &verify_file, &sample_every, &estimate, &config) != 0) {
         print_usage(argv[0]);
         return 1;
     }
 
+    if (verify_file != NULL) return verify_run(verify_file, config.n_threads);
+
     // check that the paths to input and output files are not the same
     // this does not work if the paths are different but point to the same file!
-    if (!strcmp(gro_file, output_file)) {
-        fprintf(stderr, "Input gro file %s and output file %s are the same file.\n", gro_file, output_file);
+    if (config.output_file != NULL && !strcmp(gro_file, config.output_file)) {
+        fprintf(stderr, "Input gro file %s and output file %s are the same file.\n", gro_file, config.output_file);
         return 1;
     }
 
-    if (xtc_file != NULL) {
-        if (!strcmp(gro_file, xtc_file)) {
-            fprintf(stderr, "Input gro file %s and input xtc file %s are the same file.\n", gro_file, xtc_file);
+    if (config.input_file != NULL) {
+        if (!strcmp(gro_file, config.input_file)) {
+            fprintf(stderr, "Input gro file %s and input xtc file %s are the same file.\n", gro_file, config.input_file);
             return 1;
         }
 
-        if (!strcmp(xtc_file, output_file)) {
-            fprintf(stderr, "Input xtc file %s and output file %s are the same file.\n", xtc_file, output_file);
+        if (config.output_file != NULL && !strcmp(config.input_file, config.output_file)) {
+            fprintf(stderr, "Input xtc file %s and output file %s are the same file.\n", config.input_file, config.output_file);
             return 1;
         }
     }
 
     // if no center dimension has been selected, use all of them
-    if (!center_x && !center_y && !center_z) {
-        center_x = 1;
-        center_y = 1;
-        center_z = 1;
+    if (!config.center[0] && !config.center[1] && !config.center[2]) {
+        config.center[0] = 1;
+        config.center[1] = 1;
+        config.center[2] = 1;
     }
 
-    // read gro file
-    system_t *system = load_gro(gro_file);
-    if (system == NULL) return 1;
+    // read ndx file and prefetch the xtc file while the gro file is being read
+    startup_t startup = {0};
+    startup_begin(&startup, ndx_file, batch_file == NULL && !estimate ? config.input_file : NULL);
 
-    // try reading ndx file (ignore if this fails)
-    dict_t *ndx_groups = read_ndx(ndx_file, system);
+    // read gro file
+    topology_t topology = {0};
+    if (topology_read_gro(gro_file, &topology) != 0) {
+        startup_end(&startup);
+        return 1;
+    }
 
-    // select all atoms
-    atom_selection_t *all = select_system(system);
+    // select reference atoms using a compiled query, if possible
+    size_t n_reference = 0;
+    size_t *reference_indices = query_select(&topology, reference_atoms, startup_ndx(&startup), config.n_threads, &n_reference);
+    startup_end(&startup);
+    if (reference_indices == NULL) reference_indices = groan_select(gro_file, ndx_file, reference_atoms, &n_reference);
 
-    // select reference atoms
-    select_t *reference = smart_select(all, reference_atoms, ndx_groups);
-    if (reference == NULL || reference->n_atoms == 0) {
+    if (reference_indices == NULL || n_reference == 0) {
         fprintf(stderr, "No reference atoms ('%s') found.\n", reference_atoms);
-
-        dict_destroy(ndx_groups);
-        free(system);
-        free(all);
-        free(reference);
+        free(reference_indices);
+        topology_free(&topology);
         return 1;
     }
 
     // if there is no xtc file supplied, just center gro file and write it
-    if (xtc_file == NULL) {
-        FILE *output = fopen(output_file, "w");
+    if (config.input_file == NULL && batch_file == NULL) {
+        FILE *output = fopen(config.output_file, "w");
         if (output == NULL) {
-            fprintf(stderr, "File %s could not be opened for writing.\n", output_file);
-            dict_destroy(ndx_groups);
-            free(system);
-            free(all);
-            free(reference);
+            fprintf(stderr, "File %s could not be opened for writing.\n", config.output_file);
+            free(reference_indices);
+            topology_free(&topology);
             return 1;
         }
 
-        vec_t center = {0.0f};
-
-        center_of_geometry(reference, center, system->box);
-        vec_t translation = {0.0f};
-        set_translation(translation, system->box, center, center_x, center_y, center_z);
-        selection_translate(all, translation, system->box);
+        float center[3] = {0.0f};
+        geometry_center(topology.coordinates, reference_indices, n_reference, topology.box, center);
+        float translation[3] = {0.0f};
+        set_translation(translation, topology.box, center, config.center[0], config.center[1], config.center[2]);
+        geometry_translate(topology.coordinates, topology.n_atoms, translation, topology.box);
 
         int return_code = 0;
-        if (write_gro(output, all, system->box, velocities, "Generated using `center`.") != 0) {
+        if (topology_write_gro(output, &topology, "Generated using `center`.") != 0) {
             fprintf(stderr, "Writing has failed.\n");
             return_code = 1;
         }
-        
-        dict_destroy(ndx_groups);
-        free(system);
-        free(all);
-        free(reference);
-        fclose(output);
-        return return_code;
-    }
 
-    // open xtc file for reading
-    XDRFILE *xtc = xdrfile_open(xtc_file, "r");
-    if (xtc == NULL) {
-        fprintf(stderr, "File %s could not be read as an xtc file.\n", xtc_file);
-        dict_destroy(ndx_groups);
-        free(system);
-        free(all);
-        free(reference);
-        return 1;
-    }
-
-    // set all velocities of all particles to zero (xtc does not contain velocities)
-    reset_velocities(system);
-
-    // check that the gro file and the xtc file match each other
-    if (!validate_xtc(xtc_file, (int) system->n_atoms)) {
-        fprintf(stderr, "Number of atoms in %s does not match %s.\n", xtc_file, gro_file);
-        xdrfile_close(xtc);
-        dict_destroy(ndx_groups);
-        free(system);
-        free(all);
-        free(reference);
-        return 1;
+        free(reference_indices);
+        topology_free(&topology);
+        if (fclose(output) != 0 && return_code == 0) {
+            fprintf(stderr, "Writing has failed.\n");
+            return_code = 1;
+        }
+        return return_code;
     }
 
-    // open output xtc for writing
-    XDRFILE *output = xdrfile_open(output_file, "w");
-    if (output == NULL) {
-        fprintf(stderr, "File %s could not be opened for writing.\n", output_file);
-        xdrfile_close(xtc);
-        dict_destroy(ndx_groups);
-        free(system);
-        free(all);
-        free(reference);
-        return 1;
+    size_t reference_end = 0;
+    for (size_t i = 0; i < n_reference; ++i) {
+        if (reference_indices[i] >= reference_end) reference_end = reference_indices[i] + 1;
     }
 
-    // loop through input xtc file, center each frame and write it into output
-    int frames = 0;
-    while (read_xtc_step(xtc, system) == 0) {
-
-        // print info about the progress of reading and writing
-        if ((int) system->time % PROGRESS_FREQ == 0) {
-            printf("Step: %d. Time: %.0f ps\r", system->step, system->time);
-            fflush(stdout);
-        }
-
-        if (frames % skip != 0) {
-            ++frames;
-            continue;
-        }
-
-        vec_t center = {0.0f};
-
-        center_of_geometry(reference, center, system->box);
-        vec_t translation = {0.0f};
-        set_translation(translation, system->box, center, center_x, center_y, center_z);
-        selection_translate(all, translation, system->box);
-
-        if (write_xtc_step(output, all, system->step, system->time, system->box, system->precision) == 1) {
-            fprintf(stderr, "Writing has failed.\n");
-            dict_destroy(ndx_groups);
-            free(all);
-            free(reference);
-            xdrfile_close(xtc);
-            xdrfile_close(output);
+    config.n_atoms = topology.n_atoms;
+    config.reference = reference_indices;
+    config.n_reference = n_reference;
+    config.reference_end = reference_end;
+
+    // stratified sample of the reference atoms
+    center_sample_t sample = {0};
+    if (sample_every > 1) {
+        sample.indices = malloc(n_reference * sizeof(size_t));
+        if (sample.indices == NULL) {
+            fprintf(stderr, "Could not allocate memory for reference atoms.\n");
+            free(reference_indices);
+            topology_free(&topology);
             return 1;
         }
 
-        ++frames;
+        sample.n_indices = sample_residues(&topology, reference_indices, n_reference, sample_every, sample.indices);
+        if (sample.n_indices > 0 && sample.n_indices < n_reference) {
+            printf("Center estimated from %zu of %zu reference atoms (every %d. residue).\n",
+                    sample.n_indices, n_reference, sample_every);
+            config.sample = &sample;
+        }
     }
-    printf("\n");
 
-    dict_destroy(ndx_groups);
-    free(all);
-    free(reference);
+    // the names are not needed for centering xtc files
+    topology_free(&topology);
 
-    xdrfile_close(xtc);
-    xdrfile_close(output);
+    // read input xtc file(s), center each frame and write it into output
+    int return_code = 0;
+    if (estimate) return_code = estimate_run(&config);
+    else if (batch_file != NULL) return_code = batch_run(&config, batch_file);
+    else return_code = pipeline_run(&config);
 
-    free(system);
-    return 0;
-}
\ No newline at end of file
+    free(sample.indices);
+    free(reference_indices);
+    return return_code;
+}
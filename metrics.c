@@ -0,0 +1,133 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+// Export of metrics for the textfile collector of the Prometheus node exporter.
+//
+// The collector reads all *.prom files of a directory whenever it is scraped. The metrics are
+// therefore written into a temporary file (METRICS_FILE.tmp, not matching the pattern) which
+// is then renamed to the metrics file, replacing the previous version atomically. Every series
+// carries the input file as a label, so several runs can export into the same directory.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "metrics.h"
+
+/*
+ * Writes the HELP and TYPE lines of a metric.
+ */
+static void write_header(FILE *file, const char *name, const char *type, const char *help)
+{
+    fprintf(file, "# HELP center_%s %s\n", name, help);
+    fprintf(file, "# TYPE center_%s %s\n", name, type);
+}
+
+/*
+ * Writes the name of a metric followed by its labels: the input file and optionally label="value".
+ */
+static void write_series(FILE *file, const char *name, const char *input_file, const char *label, const char *value)
+{
+    fprintf(file, "center_%s{input=\"", name);
+    // backslashes, quotes and line breaks must be escaped in label values
+    for (const char *c = input_file; *c != '\0'; ++c) {
+        if (*c == '\\' || *c == '"') fprintf(file, "\\%c", *c);
+        else if (*c == '\n') fprintf(file, "\\n");
+        else fputc(*c, file);
+    }
+    fprintf(file, "\"");
+
+    if (label != NULL) fprintf(file, ",%s=\"%s\"", label, value);
+    fprintf(file, "} ");
+}
+
+static void write_integer(FILE *file, const char *name, const char *input_file, const char *label, const char *value, uint64_t number)
+{
+    write_series(file, name, input_file, label, value);
+    fprintf(file, "%" PRIu64 "\n", number);
+}
+
+static void write_real(FILE *file, const char *name, const char *input_file, const char *label, const char *value, double number)
+{
+    write_series(file, name, input_file, label, value);
+    fprintf(file, "%.6f\n", number);
+}
+
+/*
+ * Writes all metrics into file.
+ */
+static void write_metrics(FILE *file, const metrics_t *metrics)
+{
+    const char *input = metrics->input_file;
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    write_header(file, "start_time_seconds", "gauge", "Time at which the centering started, in seconds since the epoch.");
+    write_real(file, "start_time_seconds", input, NULL, NULL, metrics->start_time);
+    write_header(file, "last_update_time_seconds", "gauge", "Time at which these metrics were written, in seconds since the epoch.");
+    write_real(file, "last_update_time_seconds", input, NULL, NULL, (double) now.tv_sec + (double) now.tv_nsec * 1e-9);
+    write_header(file, "running", "gauge", "Whether the centering is still running.");
+    write_integer(file, "running", input, NULL, NULL, (uint64_t) metrics->running);
+    write_header(file, "failed", "gauge", "Whether the centering has failed.");
+    write_integer(file, "failed", input, NULL, NULL, (uint64_t) metrics->failed);
+
+    write_header(file, "frames_read_total", "counter", "Frames read from the input xtc file and passed to the workers.");
+    write_integer(file, "frames_read_total", input, NULL, NULL, metrics->frames_read);
+    write_header(file, "frames_encoded_total", "counter", "Frames that have passed the encode stage.");
+    write_integer(file, "frames_encoded_total", input, NULL, NULL, metrics->frames_encoded);
+    write_header(file, "frames_written_total", "counter", "Centered frames written into the output.");
+    write_integer(file, "frames_written_total", input, NULL, NULL, metrics->frames_written);
+    write_header(file, "read_bytes_total", "counter", "Bytes of the input xtc file consumed by the reader.");
+    write_integer(file, "read_bytes_total", input, NULL, NULL, metrics->bytes_read);
+    write_header(file, "written_bytes_total", "counter", "Bytes of centered frames written into the output.");
+    write_integer(file, "written_bytes_total", input, NULL, NULL, metrics->bytes_written);
+
+    write_header(file, "stage_busy_seconds_total", "counter", "Time spent by all threads in the individual stages of processing frames.");
+    for (int stage = 0; stage < LATENCY_STAGES; ++stage) {
+        write_real(file, "stage_busy_seconds_total", input, "stage", latency_stage_name(stage), metrics->busy_seconds[stage]);
+    }
+
+    write_header(file, "queue_frames", "gauge", "Frames waiting in front of the decode pool, the encode pool and the writer.");
+    write_integer(file, "queue_frames", input, "queue", "decode", metrics->decode_queue);
+    write_integer(file, "queue_frames", input, "queue", "encode", metrics->encode_queue);
+    write_integer(file, "queue_frames", input, "queue", "write", metrics->write_queue);
+    write_header(file, "slots", "gauge", "Frame slots shared by the reader, the workers and the writer.");
+    write_integer(file, "slots", input, NULL, NULL, metrics->n_slots);
+    write_header(file, "workers", "gauge", "Workers in the decode pool, in the encode pool and running both stages.");
+    write_integer(file, "workers", input, "pool", "decode", (uint64_t) metrics->decode_workers);
+    write_integer(file, "workers", input, "pool", "encode", (uint64_t) metrics->encode_workers);
+    write_integer(file, "workers", input, "pool", "shared", (uint64_t) metrics->shared_workers);
+
+    write_header(file, "damaged_regions_total", "counter", "Damaged regions of the input skipped in recovery mode.");
+    write_integer(file, "damaged_regions_total", input, NULL, NULL, metrics->damaged_regions);
+    write_header(file, "skipped_bytes_total", "counter", "Bytes of the input skipped in recovery mode.");
+    write_integer(file, "skipped_bytes_total", input, NULL, NULL, metrics->skipped_bytes);
+    write_header(file, "undecodable_frames_total", "counter", "Undecodable frames left out of the output in recovery mode.");
+    write_integer(file, "undecodable_frames_total", input, NULL, NULL, metrics->undecodable_frames);
+}
+
+int metrics_write(const char *metrics_file, const metrics_t *metrics)
+{
+    const size_t length = strlen(metrics_file) + sizeof(".tmp");
+    char *temporary = malloc(length);
+    if (temporary == NULL) return 1;
+    snprintf(temporary, length, "%s.tmp", metrics_file);
+
+    FILE *file = fopen(temporary, "w");
+    if (file == NULL) {
+        free(temporary);
+        return 1;
+    }
+
+    write_metrics(file, metrics);
+
+    int error = ferror(file) != 0;
+    if (fclose(file) != 0) error = 1;
+    if (!error && rename(temporary, metrics_file) != 0) error = 1;
+    if (error) remove(temporary);
+
+    free(temporary);
+    return error;
+}
@@ -0,0 +1,47 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "latency.h"
+
+/* state of the centering of an xtc file exported as metrics */
+typedef struct metrics {
+    const char *input_file;
+    int running;                // zero once the centering has ended
+    double start_time;          // time at which the centering has started (in seconds since the epoch)
+
+    uint64_t frames_read;
+    uint64_t frames_encoded;    // frames that have passed the encode stage
+    uint64_t frames_written;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+
+    double busy_seconds[LATENCY_STAGES]; // time spent by all threads in every stage
+
+    size_t n_slots;
+    size_t decode_queue;        // frames waiting for the decode pool
+    size_t encode_queue;        // frames waiting for the encode pool
+    size_t write_queue;         // frames waiting for the writer
+    int decode_workers;
+    int encode_workers;
+    int shared_workers;         // workers running both stages
+
+    uint64_t damaged_regions;   // damaged regions of the input skipped in recovery mode
+    uint64_t skipped_bytes;
+    uint64_t undecodable_frames; // frames left out of the output in recovery mode
+    int failed;                 // the centering has failed
+} metrics_t;
+
+/*
+ * Writes metrics in the Prometheus text exposition format into metrics_file.
+ * The metrics are written into a temporary file which then replaces metrics_file,
+ * so that readers never see a partially written file.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+int metrics_write(const char *metrics_file, const metrics_t *metrics);
+
+#endif /* METRICS_H */
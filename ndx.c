@@ -0,0 +1,125 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ndx.h"
+
+/*
+ * Appends a new empty group called name (of the given length) to ndx.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+static int add_group(ndx_t *ndx, size_t *capacity, const char *name, size_t length)
+{
+    if (ndx->n_groups == *capacity) {
+        const size_t grown = *capacity == 0 ? 16 : 2 * *capacity;
+        ndx_group_t *groups = realloc(ndx->groups, grown * sizeof(ndx_group_t));
+        if (groups == NULL) return 1;
+        ndx->groups = groups;
+        *capacity = grown;
+    }
+
+    ndx_group_t *group = &ndx->groups[ndx->n_groups];
+    memset(group, 0, sizeof(ndx_group_t));
+    group->name = malloc(length + 1);
+    if (group->name == NULL) return 1;
+    memcpy(group->name, name, length);
+    group->name[length] = '\0';
+    ndx->n_groups++;
+    return 0;
+}
+
+/*
+ * Appends atom number to group.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+static int add_atom(ndx_group_t *group, size_t *capacity, size_t atom)
+{
+    if (group->n_atoms == *capacity) {
+        const size_t grown = *capacity == 0 ? 1024 : 2 * *capacity;
+        size_t *atoms = realloc(group->atoms, grown * sizeof(size_t));
+        if (atoms == NULL) return 1;
+        group->atoms = atoms;
+        *capacity = grown;
+    }
+
+    group->atoms[group->n_atoms++] = atom;
+    return 0;
+}
+
+int ndx_read(const char *ndx_file, ndx_t *ndx)
+{
+    memset(ndx, 0, sizeof(ndx_t));
+
+    FILE *file = fopen(ndx_file, "r");
+    if (file == NULL) return 1;
+
+    char *line = NULL;
+    size_t line_capacity = 0, group_capacity = 0, atom_capacity = 0;
+    int error = 0;
+    while (!error && getline(&line, &line_capacity, file) >= 0) {
+        char *c = line;
+        while (*c == ' ' || *c == '\t') ++c;
+
+        if (*c == '[') {
+            // group header: [ name ]
+            char *start = c + 1;
+            while (*start == ' ' || *start == '\t') ++start;
+            char *end = strchr(start, ']');
+            if (end == NULL) {
+                error = 1;
+                break;
+            }
+            while (end > start && (end[-1] == ' ' || end[-1] == '\t')) --end;
+
+            error = add_group(ndx, &group_capacity, start, (size_t) (end - start));
+            atom_capacity = 0;
+            continue;
+        }
+
+        for (;;) {
+            char *end = NULL;
+            const long atom = strtol(c, &end, 10);
+            if (end == c) break;
+            // numbers preceding the first group or not positive make the file invalid
+            if (ndx->n_groups == 0 || atom <= 0) {
+                error = 1;
+                break;
+            }
+            if (add_atom(&ndx->groups[ndx->n_groups - 1], &atom_capacity, (size_t) atom) != 0) {
+                error = 1;
+                break;
+            }
+            c = end;
+        }
+    }
+
+    free(line);
+    fclose(file);
+    if (error) ndx_free(ndx);
+    return error;
+}
+
+const ndx_group_t *ndx_find(const ndx_t *ndx, const char *name, size_t length)
+{
+    const ndx_group_t *found = NULL;
+    for (size_t i = 0; i < ndx->n_groups; ++i) {
+        const ndx_group_t *group = &ndx->groups[i];
+        if (strlen(group->name) != length || strncmp(group->name, name, length) != 0) continue;
+        if (found != NULL) return NULL;
+        found = group;
+    }
+
+    return found;
+}
+
+void ndx_free(ndx_t *ndx)
+{
+    for (size_t i = 0; i < ndx->n_groups; ++i) {
+        free(ndx->groups[i].name);
+        free(ndx->groups[i].atoms);
+    }
+    free(ndx->groups);
+    memset(ndx, 0, sizeof(ndx_t));
+}
@@ -0,0 +1,36 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef NDX_H
+#define NDX_H
+
+#include <stddef.h>
+
+/* group of an ndx file */
+typedef struct ndx_group {
+    char *name;
+    size_t *atoms;              // atom numbers (starting from 1) in the order of the file
+    size_t n_atoms;
+} ndx_group_t;
+
+/* all groups of an ndx file */
+typedef struct ndx {
+    ndx_group_t *groups;
+    size_t n_groups;
+} ndx_t;
+
+/*
+ * Reads all groups of ndx_file into ndx.
+ * Returns zero, if successful. Else (also if the file does not exist) returns non-zero.
+ */
+int ndx_read(const char *ndx_file, ndx_t *ndx);
+
+/*
+ * Returns the only group of the given name (of the given length) or NULL, if there is no such group
+ * or if there are several of them.
+ */
+const ndx_group_t *ndx_find(const ndx_t *ndx, const char *name, size_t length);
+
+void ndx_free(ndx_t *ndx);
+
+#endif /* NDX_H */
@@ -0,0 +1,1099 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+// Multithreaded centering of xtc trajectories.
+//
+// Frames flow through a ring of frame slots in four stages:
+//   read   (reader thread)        raw frame is read into a slot
+//   center (decode pool)          frame is decoded and centered
+//   encode (encode pool)          centered frame is encoded
+//   write  (writer thread)        encoded frames are written in their original order
+//
+// The worker threads (-t, the core budget) are split between the decode and the encode pool.
+// An adaptive controller samples the occupancy of the queues in front of both pools and moves
+// workers from the pool with the shorter queue to the pool with the longer one, so the split
+// follows whatever limits the throughput on the current machine and storage.
+//
+// With frame batches (--frame-batch), consecutive slots form groups of frames that pass through
+// the stages together: the reader publishes a whole group at once and a worker claims all frames
+// of a group, so the locking and signalling is done once per group instead of once per frame.
+//
+// When NUMA placement is requested, workers are bound to nodes and every slot belongs to one node.
+// Slot buffers are allocated by a worker of that node and only workers of that node process the
+// slot, so a frame stays in the memory of a single node from decode to encode.
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "pipeline.h"
+#include "affinity.h"
+#include "checksum.h"
+#include "frame.h"
+#include "frameindex.h"
+#include "io.h"
+#include "latency.h"
+#include "metrics.h"
+#include "stream.h"
+#include "xtc.h"
+
+// frequency of printing during the calculation
+static const int PROGRESS_FREQ = 10000;
+
+// number of frame slots per worker
+static const size_t SLOTS_PER_WORKER = 3;
+
+// queue occupancy is sampled with this period (in nanoseconds)
+static const long CONTROL_SAMPLE = 5000000;
+// number of samples after which the split of the pools is reconsidered
+static const int CONTROL_SAMPLES = 20;
+
+// the monitor reporting latencies and metrics checks for the end of the pipeline with this period (in nanoseconds)
+static const long MONITOR_SLEEP = 100000000;
+
+typedef enum slot_state {
+    SLOT_EMPTY,     // owned by the reader
+    SLOT_READ,      // raw frame waiting for the decode pool
+    SLOT_DECODING,
+    SLOT_CENTERED,  // centered frame waiting for the encode pool
+    SLOT_ENCODING,
+    SLOT_DONE,      // encoded frame waiting for the writer
+} slot_state_t;
+
+typedef struct slot {
+    slot_state_t state;
+    int node;                   // index of the NUMA node the slot belongs to
+    size_t frame;               // index of the frame among the centered frames
+    size_t index;               // index of the frame in the input trajectory
+    uint64_t offset;            // offset of the frame in the input trajectory
+    xtc_header_t header;
+    unsigned char *input;       // raw frame followed by XTC_PADDING bytes
+    frame_buffer_t buffer;      // decoded and centered coordinates
+    unsigned char *output;      // encoded frame
+    size_t output_size;
+    uint32_t checksum;          // checksum of the encoded frame, if requested
+    int corrupted;              // frame could not be decoded
+} slot_t;
+
+typedef enum worker_role {
+    ROLE_ANY,                   // the only worker of its node, runs both stages
+    ROLE_DECODE,
+    ROLE_ENCODE,
+} worker_role_t;
+
+struct pipeline;
+
+typedef struct worker {
+    struct pipeline *pipeline;
+    int id;
+    int node;                   // index of the node the worker belongs to
+    worker_role_t role;         // guarded by the lock of the pipeline
+    pthread_t thread;
+    frame_scratch_t scratch;
+    slot_t **claimed;           // slots claimed at once (one group of slots)
+    frame_job_t *jobs;          // frames of the claimed slots passed to the batch decoder
+} worker_t;
+
+typedef struct pipeline {
+    const pipeline_config_t *config;
+    numa_layout_t *layout;      // NULL, if workers are not bound
+    int n_nodes;                // number of nodes with at least one worker
+    int input;
+    int output;
+    stream_reader_t *reader;    // reads of the input file in flight
+    stream_writer_t *writer;    // writes of the output file in flight
+    checksum_file_t checksums;  // sidecar with checksums of the written frames
+    FILE *centers;              // exported centers and translations (NULL, if not exported)
+    size_t frame_bound;         // maximal size of a frame
+    latency_recorder_t *latencies; // latencies recorded by the workers, the reader and the writer (NULL, if not recorded)
+
+    slot_t *slots;
+    size_t n_slots;
+    size_t batch;               // number of slots in a group (n_slots is a multiple of it)
+    worker_t *workers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t changed;     // signalled after every change of the state below
+    int n_ready;                // workers that have allocated their buffers
+    int finished;               // reader has passed all frames to the workers
+    size_t n_frames;            // number of frames passed to the workers
+    size_t n_published;         // number of frames passed to the workers so far
+    uint64_t n_bytes_read;      // number of bytes of the input consumed by the reader (accessed atomically)
+    uint64_t n_bytes_written;   // number of bytes of the frames written into the output
+    double start_time;          // time at which the pipeline has started (in seconds since the epoch)
+    int metrics_failed;         // writing of the metrics file has failed (reported once)
+    size_t n_encoded;           // number of frames that have passed the encode stage
+    size_t n_adjustments;       // number of workers moved between the pools
+    size_t n_skipped_regions;   // number of damaged regions skipped by the reader (recovery)
+    uint64_t n_skipped_bytes;   // number of bytes in the skipped regions
+    size_t n_undecodable;       // number of frames skipped by the writer (recovery)
+    size_t n_written;           // number of frames written into the output
+    size_t n_quantized;         // number of written frames centered in the integer domain
+    int stop;                   // processing must end
+    int error;                  // processing has failed
+} pipeline_t;
+
+/*
+ * Stops all threads of the pipeline. Must be called with the lock held.
+ */
+static void stop_pipeline(pipeline_t *pipeline, int error)
+{
+    pipeline->stop = 1;
+    if (error) pipeline->error = 1;
+    pthread_cond_broadcast(&pipeline->changed);
+}
+
+/*
+ * Allocates buffers of the slots belonging to the node of the worker.
+ * Buffers of a group of slots are allocated as single blocks owned by the first slot of the group,
+ * the other slots point into them. The buffers are cleared so that their pages are placed on the node of the worker.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+static int allocate_slots(worker_t *worker)
+{
+    pipeline_t *pipeline = worker->pipeline;
+    const size_t n_atoms = pipeline->config->n_atoms;
+    const size_t batch = pipeline->batch;
+    const size_t input_size = pipeline->frame_bound + XTC_PADDING;
+
+    for (size_t i = 0; i < pipeline->n_slots; i += batch) {
+        slot_t *group = &pipeline->slots[i];
+        if (group->node != worker->node) continue;
+
+        group->input = malloc(batch * input_size);
+        group->output = malloc(batch * pipeline->frame_bound);
+        if (group->input == NULL || group->output == NULL || frame_buffer_init(&group->buffer, batch * n_atoms) != 0) return 1;
+        memset(group->input, 0, batch * input_size);
+        memset(group->output, 0, batch * pipeline->frame_bound);
+
+        for (size_t k = 1; k < batch; ++k) {
+            slot_t *slot = &group[k];
+            slot->input = group->input + k * input_size;
+            slot->output = group->output + k * pipeline->frame_bound;
+            slot->buffer.coordinates = group->buffer.coordinates + 3 * k * n_atoms;
+            slot->buffer.quantized = group->buffer.quantized + 3 * k * n_atoms;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Returns the slot of the node with the lowest frame number in the given state or NULL.
+ * Must be called with the lock held.
+ */
+static slot_t *oldest_slot(pipeline_t *pipeline, int node, slot_state_t state)
+{
+    slot_t *oldest = NULL;
+    for (size_t i = 0; i < pipeline->n_slots; ++i) {
+        slot_t *slot = &pipeline->slots[i];
+        if (slot->node != node || slot->state != state) continue;
+        if (oldest == NULL || slot->frame < oldest->frame) oldest = slot;
+    }
+    return oldest;
+}
+
+/*
+ * Moves all slots in the state from of the group containing slot into the state to
+ * and stores them into claimed in the order of their frames.
+ * Returns the number of claimed slots. Must be called with the lock held.
+ */
+static size_t claim_group(pipeline_t *pipeline, slot_t *slot, slot_state_t from, slot_state_t to, slot_t **claimed)
+{
+    slot_t *group = pipeline->slots + (size_t) (slot - pipeline->slots) / pipeline->batch * pipeline->batch;
+
+    size_t n_claimed = 0;
+    for (size_t k = 0; k < pipeline->batch; ++k) {
+        if (group[k].state != from) continue;
+        group[k].state = to;
+        claimed[n_claimed++] = &group[k];
+    }
+    return n_claimed;
+}
+
+/*
+ * Claims the next group of slots for the worker according to its role.
+ * Returns the number of slots written into claimed or zero, if the worker should end.
+ * Must be called with the lock held.
+ */
+static size_t claim_slots(worker_t *worker, slot_t **claimed)
+{
+    pipeline_t *pipeline = worker->pipeline;
+
+    for (;;) {
+        if (pipeline->stop) return 0;
+
+        // encoding is preferred by workers running both stages, it brings frames closer to the writer
+        if (worker->role != ROLE_DECODE) {
+            slot_t *slot = oldest_slot(pipeline, worker->node, SLOT_CENTERED);
+            if (slot != NULL) return claim_group(pipeline, slot, SLOT_CENTERED, SLOT_ENCODING, claimed);
+        }
+
+        if (worker->role != ROLE_ENCODE) {
+            slot_t *slot = oldest_slot(pipeline, worker->node, SLOT_READ);
+            if (slot != NULL) return claim_group(pipeline, slot, SLOT_READ, SLOT_DECODING, claimed);
+        }
+
+        if (pipeline->finished && pipeline->n_encoded >= pipeline->n_frames) return 0;
+
+        pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+    }
+}
+
+/*
+ * Decodes and centers the claimed slots or, without an output file, only calculates their centers.
+ * The result of every slot is stored in the jobs of the worker.
+ */
+static void decode_slots(worker_t *worker, size_t n_claimed)
+{
+    const pipeline_config_t *config = worker->pipeline->config;
+
+    for (size_t i = 0; i < n_claimed; ++i) {
+        slot_t *slot = worker->claimed[i];
+        worker->jobs[i] = (frame_job_t) { &slot->header, slot->input, &slot->buffer, FRAME_OK };
+    }
+
+    if (config->output_file != NULL) {
+        frame_decode_center_batch(config, worker->jobs, n_claimed, &worker->scratch);
+        return;
+    }
+
+    for (size_t i = 0; i < n_claimed; ++i) {
+        frame_job_t *job = &worker->jobs[i];
+        job->result = frame_decode_reference(config, job->header, job->input, job->buffer, &worker->scratch);
+    }
+}
+
+static void *run_worker(void *arg)
+{
+    worker_t *worker = (worker_t *) arg;
+    pipeline_t *pipeline = worker->pipeline;
+    const pipeline_config_t *config = pipeline->config;
+
+    if (pipeline->layout != NULL && numa_bind_thread(pipeline->layout, worker->node) != 0) {
+        fprintf(stderr, "Warning. Worker %d could not be bound to NUMA node %d.\n", worker->id, pipeline->layout->node_ids[worker->node]);
+    }
+
+    // the first worker of every node allocates the slots of the node
+    worker->claimed = malloc(pipeline->batch * sizeof(slot_t *));
+    worker->jobs = malloc(pipeline->batch * sizeof(frame_job_t));
+    int failed = frame_scratch_init(&worker->scratch, config->n_atoms) != 0 || worker->claimed == NULL || worker->jobs == NULL ||
+            (worker->id < pipeline->n_nodes && allocate_slots(worker) != 0);
+    if (pipeline->latencies != NULL) worker->scratch.latency = &pipeline->latencies[worker->id];
+
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->n_ready++;
+    if (failed) {
+        fprintf(stderr, "Could not allocate memory for worker %d.\n", worker->id);
+        stop_pipeline(pipeline, 1);
+    }
+    pthread_cond_broadcast(&pipeline->changed);
+
+    size_t n_claimed = 0;
+    while ((n_claimed = claim_slots(worker, worker->claimed)) > 0) {
+        const slot_state_t claimed = worker->claimed[0]->state;
+        pthread_mutex_unlock(&pipeline->lock);
+
+        if (claimed == SLOT_DECODING) {
+            decode_slots(worker, n_claimed);
+        } else {
+            for (size_t i = 0; i < n_claimed; ++i) {
+                slot_t *slot = worker->claimed[i];
+                uint64_t start = latency_start(worker->scratch.latency);
+                worker->jobs[i].result = frame_encode(&slot->header, &slot->buffer, worker->scratch.work, slot->output, pipeline->frame_bound, &slot->output_size);
+                if (worker->jobs[i].result == FRAME_OK && config->checksums) slot->checksum = crc32c(slot->output, slot->output_size);
+                latency_lap(worker->scratch.latency, LATENCY_ENCODE, &start);
+            }
+        }
+
+        pthread_mutex_lock(&pipeline->lock);
+        for (size_t i = 0; i < n_claimed; ++i) {
+            slot_t *slot = worker->claimed[i];
+            const frame_result_t result = worker->jobs[i].result;
+            if (result == FRAME_UNENCODABLE) {
+                fprintf(stderr, "\nFrame %zu of %s could not be encoded.\n", slot->index, config->input_file);
+                stop_pipeline(pipeline, 1);
+            } else if (result == FRAME_CORRUPTED) {
+                // corrupted frames skip the encode stage, the writer reports them
+                slot->corrupted = 1;
+                slot->state = SLOT_DONE;
+                pipeline->n_encoded++;
+            } else if (claimed == SLOT_DECODING && config->output_file != NULL) {
+                slot->state = SLOT_CENTERED;
+            } else {
+                slot->state = SLOT_DONE;
+                pipeline->n_encoded++;
+            }
+        }
+        pthread_cond_broadcast(&pipeline->changed);
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+
+    return NULL;
+}
+
+/*
+ * Marks the end of reading. Must be called with the lock held.
+ */
+static void finish_reading(pipeline_t *pipeline, size_t n_frames)
+{
+    pipeline->n_frames = n_frames;
+    pipeline->finished = 1;
+    pthread_cond_broadcast(&pipeline->changed);
+}
+
+/*
+ * Searches for the next valid frame after a damaged part of the input starting at offset
+ * and records the skipped region. Called by the reader in recovery mode.
+ * Returns the offset of the next valid frame or file_size, if there is none.
+ */
+static uint64_t resync_input(pipeline_t *pipeline, uint64_t offset, uint64_t file_size)
+{
+    const pipeline_config_t *config = pipeline->config;
+
+    const uint64_t next = frame_index_resync(pipeline->input, (int) config->n_atoms, offset + 1, file_size);
+    fprintf(stderr, "\nSkipping bytes %" PRIu64 "-%" PRIu64 " of %s (no valid frame).\n", offset, next, config->input_file);
+
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->n_skipped_regions++;
+    pipeline->n_skipped_bytes += next - offset;
+    pthread_mutex_unlock(&pipeline->lock);
+
+    return next;
+}
+
+/*
+ * Reads size bytes of the input into buffer, starting with the n_carried bytes of carried,
+ * which have already been read from the input, and clears n_carried.
+ * Returns the number of bytes obtained (less than size only at the end of the file) or -1 on error.
+ */
+static ssize_t read_carried(stream_reader_t *reader, unsigned char *buffer, size_t size, const unsigned char *carried, size_t *n_carried)
+{
+    const size_t n_copied = *n_carried < size ? *n_carried : size;
+    memcpy(buffer, carried, n_copied);
+    *n_carried = 0;
+
+    const ssize_t n_read = stream_read(reader, buffer + n_copied, size - n_copied);
+    return n_read < 0 ? -1 : (ssize_t) n_copied + n_read;
+}
+
+/*
+ * Passes the read frames [first, last) to the workers.
+ */
+static void publish_frames(pipeline_t *pipeline, size_t first, size_t last)
+{
+    if (first == last) return;
+
+    pthread_mutex_lock(&pipeline->lock);
+    for (size_t frame = first; frame < last; ++frame) {
+        pipeline->slots[frame % pipeline->n_slots].state = SLOT_READ;
+    }
+    pipeline->n_published = last;
+    pthread_cond_broadcast(&pipeline->changed);
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+static void *run_reader(void *arg)
+{
+    pipeline_t *pipeline = (pipeline_t *) arg;
+    const pipeline_config_t *config = pipeline->config;
+    const size_t header_size = xtc_header_size((int) config->n_atoms);
+    latency_recorder_t *latency = pipeline->latencies == NULL ? NULL : &pipeline->latencies[config->n_threads];
+
+    struct stat input_stat;
+    const uint64_t file_size = fstat(pipeline->input, &input_stat) == 0 ? (uint64_t) input_stat.st_size : UINT64_MAX;
+
+    unsigned char scratch[XTC_HEADER_SIZE] = {0};
+    // bytes following a damaged part of the input that have been read as a part of an invalid header
+    unsigned char carried[XTC_HEADER_SIZE] = {0};
+    size_t n_carried = 0;
+    size_t n_kept = 0;
+    size_t n_published = 0;
+    uint64_t offset = 0;
+
+    for (size_t index = 0; ; ) {
+        __atomic_store_n(&pipeline->n_bytes_read, offset, __ATOMIC_RELAXED);
+        const int keep = index % (size_t) config->skip == 0;
+        slot_t *slot = &pipeline->slots[n_kept % pipeline->n_slots];
+
+        // slots of a group are refilled once the writer has emptied all of them
+        if (keep && n_kept % pipeline->batch == 0) {
+            pthread_mutex_lock(&pipeline->lock);
+            for (size_t k = 0; k < pipeline->batch; ++k) {
+                while (!pipeline->stop && slot[k].state != SLOT_EMPTY) {
+                    pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+                }
+            }
+            int stop = pipeline->stop;
+            pthread_mutex_unlock(&pipeline->lock);
+            if (stop) break;
+        }
+
+        unsigned char *buffer = keep ? slot->input : scratch;
+        uint64_t start = latency_start(latency);
+        ssize_t n = read_carried(pipeline->reader, buffer, header_size, carried, &n_carried);
+        // regular end of the file
+        if (n == 0) break;
+
+        xtc_header_t header = {0};
+        int valid = n == (ssize_t) header_size && xtc_peek_atoms(buffer) == (int) config->n_atoms && xtc_parse_header(buffer, &header) == 0;
+        // in recovery mode, a frame exceeding the file is treated as a damaged header
+        if (valid && config->recover && offset + xtc_frame_size(&header) > file_size) valid = 0;
+
+        if (!valid) {
+            if (!config->recover || n < 0) {
+                fprintf(stderr, "\nCould not read frame %zu of %s. Stopping.\n", index, config->input_file);
+                break;
+            }
+
+            const uint64_t next = resync_input(pipeline, offset, file_size);
+            if (next >= file_size) break;
+
+            const uint64_t consumed = offset + (uint64_t) n;
+            if (next < consumed) {
+                // the next frame starts within the bytes already read
+                n_carried = (size_t) (consumed - next);
+                memcpy(carried, buffer + (next - offset), n_carried);
+            } else if (stream_read(pipeline->reader, NULL, next - consumed) != (ssize_t) (next - consumed)) {
+                fprintf(stderr, "\nCould not skip to byte %" PRIu64 " of %s. Stopping.\n", next, config->input_file);
+                pthread_mutex_lock(&pipeline->lock);
+                stop_pipeline(pipeline, 1);
+                pthread_mutex_unlock(&pipeline->lock);
+                break;
+            }
+            offset = next;
+            continue;
+        }
+
+        // print info about the progress of reading and writing
+        if ((int) header.time % PROGRESS_FREQ == 0) {
+            printf("Step: %d. Time: %.0f ps\r", header.step, header.time);
+            fflush(stdout);
+        }
+
+        const size_t body = xtc_frame_size(&header) - header_size;
+        if (!keep) {
+            if (stream_read(pipeline->reader, NULL, body) != (ssize_t) body) {
+                fprintf(stderr, "\nCould not read frame %zu of %s. Stopping.\n", index, config->input_file);
+                break;
+            }
+            offset += header_size + body;
+            ++index;
+            continue;
+        }
+
+        if (stream_read(pipeline->reader, slot->input + header_size, body) != (ssize_t) body) {
+            fprintf(stderr, "\nFrame %zu of %s is incomplete. Stopping.\n", index, config->input_file);
+            break;
+        }
+        latency_lap(latency, LATENCY_READ, &start);
+
+        // empty slots belong to the reader, they are passed to the workers once the group is complete
+        slot->header = header;
+        slot->frame = n_kept;
+        slot->index = index;
+        slot->offset = offset;
+        slot->corrupted = 0;
+
+        offset += header_size + body;
+        ++index;
+        ++n_kept;
+
+        if (n_kept % pipeline->batch == 0) {
+            publish_frames(pipeline, n_published, n_kept);
+            n_published = n_kept;
+        }
+    }
+
+    publish_frames(pipeline, n_published, n_kept);
+    __atomic_store_n(&pipeline->n_bytes_read, offset, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&pipeline->lock);
+    finish_reading(pipeline, n_kept);
+    pthread_mutex_unlock(&pipeline->lock);
+
+    return NULL;
+}
+
+/*
+ * Moves one worker of the node from the pool `from` to the pool `to`,
+ * if the pool `from` keeps at least one worker. Must be called with the lock held.
+ */
+static void move_worker(pipeline_t *pipeline, int node, worker_role_t from, worker_role_t to)
+{
+    int n_from = 0;
+    worker_t *candidate = NULL;
+    for (int i = 0; i < pipeline->config->n_threads; ++i) {
+        worker_t *worker = &pipeline->workers[i];
+        if (worker->node != node || worker->role != from) continue;
+        ++n_from;
+        candidate = worker;
+    }
+
+    if (n_from < 2) return;
+
+    candidate->role = to;
+    pipeline->n_adjustments++;
+    pthread_cond_broadcast(&pipeline->changed);
+}
+
+/*
+ * Balances the decode and encode pools of every node according to the occupancy
+ * of the queues in front of them.
+ */
+static void *run_controller(void *arg)
+{
+    pipeline_t *pipeline = (pipeline_t *) arg;
+
+    // summed occupancies of the decode and encode queues of every node
+    size_t *waiting = calloc(2 * (size_t) pipeline->n_nodes, sizeof(size_t));
+    if (waiting == NULL) return NULL;
+
+    int n_samples = 0;
+    for (;;) {
+        struct timespec wait = { 0, CONTROL_SAMPLE };
+        nanosleep(&wait, NULL);
+
+        pthread_mutex_lock(&pipeline->lock);
+        if (pipeline->stop || pipeline->finished) {
+            pthread_mutex_unlock(&pipeline->lock);
+            break;
+        }
+
+        for (size_t i = 0; i < pipeline->n_slots; ++i) {
+            const slot_t *slot = &pipeline->slots[i];
+            if (slot->state == SLOT_READ) waiting[2 * slot->node]++;
+            if (slot->state == SLOT_CENTERED) waiting[2 * slot->node + 1]++;
+        }
+
+        if (++n_samples == CONTROL_SAMPLES) {
+            for (int node = 0; node < pipeline->n_nodes; ++node) {
+                const double decode_queue = (double) waiting[2 * node] / n_samples;
+                const double encode_queue = (double) waiting[2 * node + 1] / n_samples;
+
+                // a difference of at least one group of frames is needed to avoid oscillations
+                const double threshold = (double) pipeline->batch;
+                if (decode_queue > encode_queue + threshold) move_worker(pipeline, node, ROLE_ENCODE, ROLE_DECODE);
+                else if (encode_queue > decode_queue + threshold) move_worker(pipeline, node, ROLE_DECODE, ROLE_ENCODE);
+
+                waiting[2 * node] = 0;
+                waiting[2 * node + 1] = 0;
+            }
+            n_samples = 0;
+        }
+        pthread_mutex_unlock(&pipeline->lock);
+    }
+
+    free(waiting);
+    return NULL;
+}
+
+/*
+ * Merges the latencies recorded by all threads of the pipeline into sum.
+ */
+static void merge_latencies(const pipeline_t *pipeline, latency_recorder_t *sum)
+{
+    memset(sum, 0, sizeof(latency_recorder_t));
+    for (int i = 0; i < pipeline->config->n_threads + 2; ++i) latency_merge(sum, &pipeline->latencies[i]);
+}
+
+/*
+ * Collects the current state of the pipeline into metrics. sum is used to merge the recorded latencies.
+ */
+static void collect_metrics(pipeline_t *pipeline, latency_recorder_t *sum, metrics_t *metrics)
+{
+    const pipeline_config_t *config = pipeline->config;
+    memset(metrics, 0, sizeof(metrics_t));
+    metrics->input_file = config->input_file;
+    metrics->running = 1;
+    metrics->start_time = pipeline->start_time;
+    metrics->n_slots = pipeline->n_slots;
+    metrics->bytes_read = __atomic_load_n(&pipeline->n_bytes_read, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&pipeline->lock);
+    metrics->frames_read = pipeline->n_published;
+    metrics->frames_encoded = pipeline->n_encoded;
+    metrics->frames_written = pipeline->n_written;
+    metrics->bytes_written = pipeline->n_bytes_written;
+    for (size_t i = 0; i < pipeline->n_slots; ++i) {
+        const slot_state_t state = pipeline->slots[i].state;
+        if (state == SLOT_READ) metrics->decode_queue++;
+        else if (state == SLOT_CENTERED) metrics->encode_queue++;
+        else if (state == SLOT_DONE) metrics->write_queue++;
+    }
+    for (int i = 0; i < config->n_threads; ++i) {
+        const worker_role_t role = pipeline->workers[i].role;
+        if (role == ROLE_DECODE) metrics->decode_workers++;
+        else if (role == ROLE_ENCODE) metrics->encode_workers++;
+        else metrics->shared_workers++;
+    }
+    metrics->damaged_regions = pipeline->n_skipped_regions;
+    metrics->skipped_bytes = pipeline->n_skipped_bytes;
+    metrics->undecodable_frames = pipeline->n_undecodable;
+    metrics->failed = pipeline->error;
+    pthread_mutex_unlock(&pipeline->lock);
+
+    if (pipeline->latencies == NULL) return;
+    merge_latencies(pipeline, sum);
+    for (int stage = 0; stage < LATENCY_STAGES; ++stage) {
+        metrics->busy_seconds[stage] = (double) sum->stages[stage].sum * 1e-9;
+    }
+}
+
+/*
+ * Writes metrics into the metrics file. Failures are reported once.
+ */
+static void export_metrics(pipeline_t *pipeline, const metrics_t *metrics)
+{
+    if (metrics_write(pipeline->config->metrics_file, metrics) != 0 && !pipeline->metrics_failed) {
+        fprintf(stderr, "\nWarning. Metrics could not be written into %s.\n", pipeline->config->metrics_file);
+        pipeline->metrics_failed = 1;
+    }
+}
+
+/*
+ * Until the pipeline stops, prints the distribution of the latencies recorded during the last interval
+ * every latency_interval seconds and writes the metrics file every metrics_interval seconds.
+ */
+static void *run_monitor(void *arg)
+{
+    pipeline_t *pipeline = (pipeline_t *) arg;
+    const pipeline_config_t *config = pipeline->config;
+
+    // merged latencies at the end of the current and of the previous interval
+    latency_recorder_t *merged = calloc(2, sizeof(latency_recorder_t));
+    if (merged == NULL) return NULL;
+    latency_recorder_t *current = &merged[0], *previous = &merged[1];
+
+    char title[64] = "";
+    snprintf(title, sizeof(title), "Latencies of the last %d s:", config->latency_interval);
+
+    const uint64_t latency_period = pipeline->latencies == NULL ? 0 : (uint64_t) config->latency_interval * 1000000000u;
+    const uint64_t metrics_period = config->metrics_file == NULL ? 0 : (uint64_t) config->metrics_interval * 1000000000u;
+    // the metrics file is written immediately, so that it exists during the whole run
+    uint64_t next_latency = latency_now() + latency_period, next_metrics = latency_now();
+
+    for (;;) {
+        pthread_mutex_lock(&pipeline->lock);
+        const int stop = pipeline->stop;
+        pthread_mutex_unlock(&pipeline->lock);
+        if (stop) break;
+
+        const uint64_t now = latency_now();
+        if (metrics_period > 0 && now >= next_metrics) {
+            metrics_t metrics;
+            collect_metrics(pipeline, current, &metrics);
+            export_metrics(pipeline, &metrics);
+            next_metrics = now + metrics_period;
+        }
+
+        if (latency_period > 0 && now >= next_latency) {
+            merge_latencies(pipeline, current);
+            printf("\n");
+            latency_report(stdout, title, current, previous);
+            fflush(stdout);
+
+            latency_recorder_t *swap = previous;
+            previous = current;
+            current = swap;
+            next_latency += latency_period;
+        }
+
+        struct timespec wait = { 0, MONITOR_SLEEP };
+        nanosleep(&wait, NULL);
+    }
+
+    free(merged);
+    return NULL;
+}
+
+/*
+ * Writes the center and the translation of the frame in the slot as a line of the centers file.
+ * Returns a negative value, if writing has failed.
+ */
+static int write_center(FILE *file, const slot_t *slot)
+{
+    const float *center = slot->buffer.center, *translation = slot->buffer.translation;
+    return fprintf(file, "%zu %d %.3f %.5f %.5f %.5f %.5f %.5f %.5f\n", slot->index, slot->header.step, slot->header.time,
+            center[0], center[1], center[2], translation[0], translation[1], translation[2]);
+}
+
+/*
+ * Opens the file for the centers and translations of the frames and writes its header.
+ * Returns the opened file or NULL, if it could not be opened.
+ */
+static FILE *open_centers(const pipeline_config_t *config)
+{
+    FILE *file = fopen(config->centers_file, "w");
+    if (file == NULL) {
+        fprintf(stderr, "File %s could not be opened for writing.\n", config->centers_file);
+        return NULL;
+    }
+
+    fprintf(file, "# centers of the reference atoms in frames of %s and translations centering them (nm)\n", config->input_file);
+    fprintf(file, "# frame step time center_x center_y center_z translation_x translation_y translation_z\n");
+    return file;
+}
+
+/*
+ * Writes centered frames into the output file in their original order.
+ */
+static void write_frames(pipeline_t *pipeline)
+{
+    latency_recorder_t *latency = pipeline->latencies == NULL ? NULL : &pipeline->latencies[pipeline->config->n_threads + 1];
+
+    for (size_t frame = 0; ; ++frame) {
+        slot_t *slot = &pipeline->slots[frame % pipeline->n_slots];
+
+        pthread_mutex_lock(&pipeline->lock);
+        while (!pipeline->stop && !(slot->state == SLOT_DONE && slot->frame == frame) &&
+                !(pipeline->finished && frame >= pipeline->n_frames)) {
+            pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+        }
+        int proceed = !pipeline->stop && slot->state == SLOT_DONE && slot->frame == frame;
+        if (proceed && slot->corrupted && pipeline->config->recover) {
+            // the frame is left out of the output and the next frame follows
+            fprintf(stderr, "\nFrame %zu of %s (bytes %" PRIu64 "-%" PRIu64 ") could not be decoded. Skipping.\n",
+                    slot->index, pipeline->config->input_file, slot->offset, slot->offset + xtc_frame_size(&slot->header));
+            pipeline->n_undecodable++;
+            slot->state = SLOT_EMPTY;
+            pthread_cond_broadcast(&pipeline->changed);
+            pthread_mutex_unlock(&pipeline->lock);
+            continue;
+        }
+        if (proceed && slot->corrupted) {
+            fprintf(stderr, "\nFrame %zu of %s could not be decoded. Stopping.\n", slot->index, pipeline->config->input_file);
+            stop_pipeline(pipeline, 0);
+            proceed = 0;
+        }
+        pthread_mutex_unlock(&pipeline->lock);
+
+        if (!proceed) break;
+
+        uint64_t start = latency_start(latency);
+        int result = 0;
+        if (pipeline->writer != NULL) result = stream_write(pipeline->writer, slot->output, slot->output_size);
+        if (result == 0 && pipeline->config->checksums) result = checksum_file_add(&pipeline->checksums, slot->output_size, slot->checksum);
+        if (result == 0 && pipeline->centers != NULL) result = write_center(pipeline->centers, slot) < 0;
+        latency_lap(latency, LATENCY_WRITE, &start);
+
+        pthread_mutex_lock(&pipeline->lock);
+        if (result != 0) {
+            fprintf(stderr, "Writing has failed.\n");
+            stop_pipeline(pipeline, 1);
+        }
+        pipeline->n_written++;
+        if (result == 0) pipeline->n_bytes_written += slot->output_size;
+        if (slot->buffer.is_quantized && !slot->buffer.is_precise) pipeline->n_quantized++;
+        slot->state = SLOT_EMPTY;
+        // only the reader waits for empty slots and it waits for whole groups
+        if ((frame + 1) % pipeline->batch == 0) pthread_cond_broadcast(&pipeline->changed);
+        pthread_mutex_unlock(&pipeline->lock);
+    }
+}
+
+static const char *role_name(worker_role_t role)
+{
+    switch (role) {
+    case ROLE_DECODE: return "decode";
+    case ROLE_ENCODE: return "encode";
+    default: return "decode+encode";
+    }
+}
+
+/*
+ * Assigns workers and slots to NUMA nodes in round-robin fashion, splits the workers
+ * of every node between the decode and the encode pool and prints the placement, if requested.
+ */
+static void place_workers(pipeline_t *pipeline)
+{
+    const pipeline_config_t *config = pipeline->config;
+
+    pipeline->n_nodes = 1;
+    if (pipeline->layout != NULL) {
+        pipeline->n_nodes = pipeline->layout->n_nodes < config->n_threads ? pipeline->layout->n_nodes : config->n_threads;
+    }
+
+    // all slots of a group belong to the same node
+    for (size_t i = 0; i < pipeline->n_slots; ++i) {
+        pipeline->slots[i].node = (int) (i / pipeline->batch % (size_t) pipeline->n_nodes);
+    }
+
+    for (int i = 0; i < config->n_threads; ++i) {
+        worker_t *worker = &pipeline->workers[i];
+        worker->node = i % pipeline->n_nodes;
+
+        // workers of the node are split evenly, the decode pool gets the odd one
+        const int n_node = config->n_threads / pipeline->n_nodes + (worker->node < config->n_threads % pipeline->n_nodes);
+        const int rank = i / pipeline->n_nodes;
+        // without an output file, frames only pass through the decode stage
+        if (n_node == 1 || config->output_file == NULL) worker->role = ROLE_ANY;
+        else worker->role = rank < (n_node + 1) / 2 ? ROLE_DECODE : ROLE_ENCODE;
+    }
+
+    if (!config->numa) return;
+
+    if (pipeline->layout == NULL) {
+        printf("NUMA placement: layout of the machine could not be determined, workers are not bound.\n");
+        return;
+    }
+
+    char cpus[256] = "";
+    printf("NUMA placement: %d node(s), %d worker(s), %zu frame slots.\n",
+            pipeline->layout->n_nodes, config->n_threads, pipeline->n_slots);
+    for (int i = 0; i < config->n_threads; ++i) {
+        const worker_t *worker = &pipeline->workers[i];
+        numa_cpulist(pipeline->layout, worker->node, cpus, sizeof(cpus));
+        printf("  worker %d -> node %d (cpus %s), initial pool: %s\n", i, pipeline->layout->node_ids[worker->node], cpus, role_name(worker->role));
+    }
+}
+
+/*
+ * Opens the output file for writing. If direct output has been requested,
+ * the file is opened with O_DIRECT, if the filesystem supports it.
+ * Returns the file descriptor or a negative value on error.
+ */
+static int open_output(const pipeline_config_t *config, int *direct)
+{
+    *direct = 0;
+    if (config->direct) {
+        int fd = open(config->output_file, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0666);
+        if (fd >= 0) {
+            *direct = 1;
+            return fd;
+        }
+
+        if (errno != EINVAL) return -1;
+        fprintf(stderr, "Warning. Filesystem does not support direct output into %s. Writing through the page cache.\n", config->output_file);
+    }
+
+    return open(config->output_file, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+}
+
+int pipeline_run(const pipeline_config_t *config)
+{
+    pipeline_t pipeline = {0};
+    pipeline.config = config;
+    pipeline.frame_bound = xtc_frame_bound((int) config->n_atoms);
+
+    pipeline.input = open(config->input_file, O_RDONLY);
+    if (pipeline.input < 0) {
+        fprintf(stderr, "File %s could not be read as an xtc file.\n", config->input_file);
+        return 1;
+    }
+
+    // check that the gro file and the xtc file match each other
+    unsigned char probe[8] = {0};
+    if (read_full(pipeline.input, probe, sizeof(probe)) != (ssize_t) sizeof(probe) ||
+            xtc_peek_atoms(probe) != (int) config->n_atoms || lseek(pipeline.input, 0, SEEK_SET) != 0) {
+        fprintf(stderr, "Number of atoms in %s does not match the gro file.\n", config->input_file);
+        close(pipeline.input);
+        return 1;
+    }
+
+    if (config->centers_file != NULL && (pipeline.centers = open_centers(config)) == NULL) {
+        close(pipeline.input);
+        return 1;
+    }
+
+    // without an output file, only the centers are exported
+    int direct = 0;
+    pipeline.output = -1;
+    if (config->output_file != NULL && (pipeline.output = open_output(config, &direct)) < 0) {
+        fprintf(stderr, "File %s could not be opened for writing.\n", config->output_file);
+        if (pipeline.centers != NULL) fclose(pipeline.centers);
+        close(pipeline.input);
+        return 1;
+    }
+
+    // the output is preallocated to the size of the selected part of the input
+    off_t expected_size = 0;
+    struct stat input_stat;
+    if (direct && fstat(pipeline.input, &input_stat) == 0) {
+        expected_size = input_stat.st_size / config->skip;
+    }
+
+    pipeline.reader = stream_reader_open(pipeline.input, config->io_backend);
+    if (pipeline.output >= 0) pipeline.writer = stream_writer_open(pipeline.output, config->io_backend, direct, expected_size);
+    if (pipeline.reader == NULL || (pipeline.output >= 0 && pipeline.writer == NULL)) {
+        fprintf(stderr, "Could not start asynchronous input/output (backend '%s').\n",
+                config->io_backend == STREAM_URING ? "uring" : config->io_backend == STREAM_THREADS ? "threads" : "auto");
+        stream_reader_close(pipeline.reader);
+        stream_writer_close(pipeline.writer);
+        if (pipeline.centers != NULL) fclose(pipeline.centers);
+        close(pipeline.input);
+        if (pipeline.output >= 0) close(pipeline.output);
+        return 1;
+    }
+
+    if (config->checksums && checksum_file_open(&pipeline.checksums, config->output_file) != 0) {
+        stream_reader_close(pipeline.reader);
+        stream_writer_close(pipeline.writer);
+        if (pipeline.centers != NULL) fclose(pipeline.centers);
+        close(pipeline.input);
+        if (pipeline.output >= 0) close(pipeline.output);
+        return 1;
+    }
+
+    if (config->numa) pipeline.layout = numa_detect();
+
+    pipeline.batch = (size_t) config->frame_batch;
+    pipeline.n_slots = (SLOTS_PER_WORKER * (size_t) config->n_threads + 1) * pipeline.batch;
+    pipeline.slots = calloc(pipeline.n_slots, sizeof(slot_t));
+    pipeline.workers = calloc((size_t) config->n_threads, sizeof(worker_t));
+    if (pipeline.slots == NULL || pipeline.workers == NULL) {
+        fprintf(stderr, "Could not allocate memory for the frame slots.\n");
+        free(pipeline.slots);
+        free(pipeline.workers);
+        numa_destroy(pipeline.layout);
+        checksum_file_close(&pipeline.checksums);
+        stream_reader_close(pipeline.reader);
+        stream_writer_close(pipeline.writer);
+        if (pipeline.centers != NULL) fclose(pipeline.centers);
+        close(pipeline.input);
+        if (pipeline.output >= 0) close(pipeline.output);
+        return 1;
+    }
+
+    struct timespec start_time;
+    clock_gettime(CLOCK_REALTIME, &start_time);
+    pipeline.start_time = (double) start_time.tv_sec + (double) start_time.tv_nsec * 1e-9;
+
+    // every worker, the reader and the writer record latencies (also the busy time of the exported metrics) into their own histograms
+    if ((config->latency || config->metrics_file != NULL) && (pipeline.latencies = calloc((size_t) config->n_threads + 2, sizeof(latency_recorder_t))) == NULL) {
+        fprintf(stderr, "Warning. Could not allocate memory for latency histograms. Latencies will not be recorded.\n");
+    }
+
+    pthread_mutex_init(&pipeline.lock, NULL);
+    pthread_cond_init(&pipeline.changed, NULL);
+    place_workers(&pipeline);
+
+    int n_started = 0;
+    for (int i = 0; i < config->n_threads; ++i) {
+        worker_t *worker = &pipeline.workers[i];
+        worker->pipeline = &pipeline;
+        worker->id = i;
+        if (pthread_create(&worker->thread, NULL, run_worker, worker) != 0) {
+            fprintf(stderr, "Could not start worker thread %d.\n", i);
+            pthread_mutex_lock(&pipeline.lock);
+            stop_pipeline(&pipeline, 1);
+            pthread_mutex_unlock(&pipeline.lock);
+            break;
+        }
+        ++n_started;
+    }
+
+    // slot buffers are allocated by the workers, wait for them before reading
+    pthread_mutex_lock(&pipeline.lock);
+    while (!pipeline.stop && pipeline.n_ready < config->n_threads) {
+        pthread_cond_wait(&pipeline.changed, &pipeline.lock);
+    }
+    int stop = pipeline.stop;
+    pthread_mutex_unlock(&pipeline.lock);
+
+    pthread_t reader, controller, monitor;
+    int reader_started = 0, controller_started = 0, monitor_started = 0;
+    if (!stop) {
+        if (pthread_create(&reader, NULL, run_reader, &pipeline) != 0) {
+            fprintf(stderr, "Could not start reader thread.\n");
+            pthread_mutex_lock(&pipeline.lock);
+            stop_pipeline(&pipeline, 1);
+            pthread_mutex_unlock(&pipeline.lock);
+        } else {
+            reader_started = 1;
+            // the controller is optional, the initial split of the pools is kept without it
+            controller_started = config->output_file != NULL && config->n_threads > pipeline.n_nodes &&
+                    pthread_create(&controller, NULL, run_controller, &pipeline) == 0;
+            monitor_started = ((pipeline.latencies != NULL && config->latency_interval > 0) || config->metrics_file != NULL) &&
+                    pthread_create(&monitor, NULL, run_monitor, &pipeline) == 0;
+            write_frames(&pipeline);
+        }
+    }
+
+    // make sure that the reader does not wait for slots that will never be written
+    pthread_mutex_lock(&pipeline.lock);
+    stop_pipeline(&pipeline, 0);
+    pthread_mutex_unlock(&pipeline.lock);
+
+    if (reader_started) pthread_join(reader, NULL);
+    if (controller_started) pthread_join(controller, NULL);
+    if (monitor_started) pthread_join(monitor, NULL);
+    for (int i = 0; i < n_started; ++i) {
+        pthread_join(pipeline.workers[i].thread, NULL);
+    }
+    printf("\n");
+
+    if (config->numa && pipeline.layout != NULL) {
+        printf("Workers moved between the decode and encode pools %zu times.\n", pipeline.n_adjustments);
+    }
+
+    if (config->recover) {
+        printf("Recovery: %zu damaged region(s) with %" PRIu64 " bytes skipped, %zu undecodable frame(s) skipped.\n",
+                pipeline.n_skipped_regions, pipeline.n_skipped_bytes, pipeline.n_undecodable);
+    }
+
+    if (config->integer) {
+        printf("Integer-domain centering used for %zu of %zu frames.\n", pipeline.n_quantized, pipeline.n_written);
+    }
+
+    // the final metrics are written once all files are closed
+    metrics_t metrics = {0};
+    latency_recorder_t *sum = malloc(sizeof(latency_recorder_t));
+    if (sum != NULL && config->latency && pipeline.latencies != NULL) {
+        merge_latencies(&pipeline, sum);
+        latency_report(stdout, "Latencies of all frames:", sum, NULL);
+    }
+    if (sum != NULL && config->metrics_file != NULL) collect_metrics(&pipeline, sum, &metrics);
+
+    // buffers of every group are owned by its first slot
+    for (size_t i = 0; i < pipeline.n_slots; i += pipeline.batch) {
+        free(pipeline.slots[i].input);
+        free(pipeline.slots[i].output);
+        frame_buffer_free(&pipeline.slots[i].buffer);
+    }
+    for (int i = 0; i < config->n_threads; ++i) {
+        frame_scratch_free(&pipeline.workers[i].scratch);
+        free(pipeline.workers[i].claimed);
+        free(pipeline.workers[i].jobs);
+    }
+    free(pipeline.slots);
+    free(pipeline.workers);
+    numa_destroy(pipeline.layout);
+    pthread_mutex_destroy(&pipeline.lock);
+    pthread_cond_destroy(&pipeline.changed);
+
+    stream_reader_close(pipeline.reader);
+    if (pipeline.writer != NULL && stream_writer_close(pipeline.writer) != 0 && !pipeline.error) {
+        fprintf(stderr, "Writing has failed.\n");
+        pipeline.error = 1;
+    }
+    if (checksum_file_close(&pipeline.checksums) != 0) pipeline.error = 1;
+    if (pipeline.centers != NULL && fclose(pipeline.centers) != 0 && !pipeline.error) {
+        fprintf(stderr, "Writing into %s has failed.\n", config->centers_file);
+        pipeline.error = 1;
+    }
+
+    close(pipeline.input);
+    if (pipeline.output >= 0 && close(pipeline.output) != 0 && !pipeline.error) {
+        fprintf(stderr, "Writing has failed.\n");
+        pipeline.error = 1;
+    }
+
+    if (sum != NULL && config->metrics_file != NULL) {
+        metrics.running = 0;
+        metrics.failed = pipeline.error;
+        export_metrics(&pipeline, &metrics);
+    }
+    free(sum);
+    free(pipeline.latencies);
+
+    return pipeline.error;
+}
@@ -0,0 +1,58 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stddef.h>
+#include "stream.h"
+
+/* stratified sample of the reference atoms used to estimate the center of geometry */
+typedef struct center_sample {
+    size_t *indices;            // indices of the sampled atoms
+    size_t n_indices;
+    int disabled;               // the estimate has deviated, all reference atoms are used (accessed atomically)
+} center_sample_t;
+
+/* settings of the xtc centering pipeline */
+typedef struct pipeline_config {
+    const char *input_file;
+    const char *output_file;    // NULL, if only centers are exported
+    const char *centers_file;   // file for the centers and translations of the frames (NULL, if not exported)
+    size_t n_atoms;             // number of atoms in the system
+    const size_t *reference;    // indices of the reference atoms
+    size_t n_reference;
+    size_t reference_end;       // one past the highest index of the reference atoms
+    center_sample_t *sample;    // sample of the reference atoms (NULL, if all reference atoms are used)
+    int skip;                   // only center every Nth frame
+    int center[3];              // center in the individual dimensions
+    int n_threads;              // number of worker threads
+    int numa;                   // bind workers to NUMA nodes and report the placement
+    stream_backend_t io_backend; // backend used for asynchronous reading and writing
+    int direct;                 // write the output with O_DIRECT into a preallocated file
+    int checksums;              // write checksums of the output frames into a sidecar file
+    int recover;                // skip damaged parts of the input instead of stopping
+    int integer;                // center compressed frames on integer coordinates, if the box allows it
+    int lookup;                 // calculate centers of compressed frames using lookup tables, if the box allows it
+    int frame_batch;            // number of consecutive frames processed together by a worker
+    int latency;                // record latencies of the individual stages and report their distribution
+    int latency_interval;       // also report the latencies of every interval of this length (in seconds, 0 if not)
+    const char *metrics_file;   // file for metrics in the Prometheus text format (NULL, if not exported)
+    int metrics_interval;       // period of writing the metrics file (in seconds)
+} pipeline_config_t;
+
+/*
+ * Reads the input xtc file, centers every selected frame and writes it into the output xtc file.
+ * Frames are read by a reader thread, processed by n_threads worker threads that are adaptively
+ * split between a decode pool and an encode pool, and written in order by the calling thread.
+ * Workers claim groups of frame_batch consecutive frames and process them at once.
+ * If centers_file is set, the center and the translation of every frame are written into it.
+ * Without an output file, frames are only decoded up to the last reference atom to export the centers.
+ * If latency is set, latencies of reading, decoding, centering, wrapping, encoding and writing every frame
+ * are recorded and their distribution is printed at the end (and after every latency_interval seconds).
+ * If metrics_file is set, metrics of the progress are written into it every metrics_interval seconds and at the end.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+int pipeline_run(const pipeline_config_t *config);
+
+#endif /* PIPELINE_H */
@@ -0,0 +1,587 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+// Compiled selection queries.
+//
+// A query is parsed into a plan of operations in postfix order. Leaves of the plan are tables
+// telling which of the distinct atom names (or which residues) match a predicate
+// and ndx groups read into bitsets. The plan is evaluated by several
+// threads, each for a contiguous range of atoms. Every operand is a bitset with 64 atoms per word
+// evaluated CHUNK_WORDS words at a time, so the boolean operators are loops over short arrays
+// of words which the compiler vectorizes.
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "query.h"
+
+// number of words of a bitset evaluated at once
+#define CHUNK_WORDS 16
+
+// every thread evaluates at least this number of atoms
+static const size_t MIN_THREAD_ATOMS = 1 << 16;
+
+typedef enum operation_kind {
+    OP_TABLE,       // atoms with ids matching a table
+    OP_GROUP,       // atoms of an ndx group
+    OP_ALL,
+    OP_NOT,
+    OP_AND,
+    OP_OR,
+} operation_kind_t;
+
+typedef struct operation {
+    operation_kind_t kind;
+    const uint32_t *ids;        // atom name or residue of every atom (OP_TABLE)
+    unsigned char *matches;     // non-zero for every matching id (OP_TABLE)
+    long single;                // the only matching id or -1 (OP_TABLE)
+    uint64_t *bits;             // bitset of the group (OP_GROUP)
+} operation_t;
+
+typedef struct token {
+    const char *start;
+    size_t length;
+} token_t;
+
+typedef struct compiler {
+    const topology_t *topology;
+    const ndx_t *ndx;
+    size_t n_words;
+
+    token_t *tokens;
+    size_t n_tokens;
+    size_t position;
+
+    operation_t *operations;
+    size_t n_operations;
+    size_t depth;               // current depth of the evaluation stack
+    size_t max_depth;
+} compiler_t;
+
+typedef struct evaluator {
+    const compiler_t *plan;
+    uint64_t *result;
+    size_t first_word;          // words [first_word, last_word) are evaluated by this evaluator
+    size_t last_word;
+    pthread_t thread;
+} evaluator_t;
+
+/*
+ * Returns non-zero, if name matches pattern of the given length. '*' in pattern matches any characters.
+ */
+static int glob_match(const char *pattern, size_t length, const char *name)
+{
+    while (length > 0 && *pattern != '*') {
+        if (*name != *pattern) return 0;
+        ++pattern;
+        ++name;
+        --length;
+    }
+
+    if (length == 0) return *name == '\0';
+
+    // skip the star and try every remaining suffix of name
+    do {
+        if (glob_match(pattern + 1, length - 1, name)) return 1;
+    } while (*name++ != '\0');
+
+    return 0;
+}
+
+/*
+ * Splits query into tokens. Parentheses, '!', '&&' and '||' are tokens of their own.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+static int tokenize(compiler_t *compiler, const char *query)
+{
+    const size_t length = strlen(query);
+    compiler->tokens = malloc((length + 1) * sizeof(token_t));
+    if (compiler->tokens == NULL) return 1;
+
+    const char *c = query;
+    while (*c != '\0') {
+        if (*c == ' ' || *c == '\t' || *c == '\n') {
+            ++c;
+            continue;
+        }
+
+        token_t *token = &compiler->tokens[compiler->n_tokens++];
+        token->start = c;
+        if (*c == '(' || *c == ')' || *c == '!') {
+            token->length = 1;
+        } else if ((c[0] == '&' && c[1] == '&') || (c[0] == '|' && c[1] == '|')) {
+            token->length = 2;
+        } else {
+            size_t n = 0;
+            while (c[n] != '\0' && strchr(" \t\n()!", c[n]) == NULL &&
+                    !(c[n] == '&' && c[n + 1] == '&') && !(c[n] == '|' && c[n + 1] == '|')) ++n;
+            token->length = n;
+        }
+        c += token->length;
+    }
+
+    return 0;
+}
+
+static int token_is(const token_t *token, const char *word)
+{
+    return token->length == strlen(word) && strncmp(token->start, word, token->length) == 0;
+}
+
+/*
+ * Returns the token at the current position of the compiler or NULL at the end of the query.
+ */
+static const token_t *peek(const compiler_t *compiler)
+{
+    return compiler->position < compiler->n_tokens ? &compiler->tokens[compiler->position] : NULL;
+}
+
+static int is_and(const token_t *token)
+{
+    return token != NULL && (token_is(token, "and") || token_is(token, "&&"));
+}
+
+static int is_or(const token_t *token)
+{
+    return token != NULL && (token_is(token, "or") || token_is(token, "||"));
+}
+
+/*
+ * Returns non-zero, if token ends the list of values following a keyword.
+ */
+static int ends_values(const token_t *token)
+{
+    return token == NULL || is_and(token) || is_or(token) || token_is(token, ")") || token_is(token, "(") ||
+            token_is(token, "not") || token_is(token, "!");
+}
+
+/*
+ * Appends operation to the plan and updates the depth of the evaluation stack.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+static int emit(compiler_t *compiler, operation_t operation)
+{
+    // the plan cannot be longer than the number of tokens
+    if (compiler->n_operations == compiler->n_tokens) return 1;
+
+    if (operation.kind == OP_AND || operation.kind == OP_OR) compiler->depth--;
+    else if (operation.kind != OP_NOT) compiler->depth++;
+    if (compiler->depth > compiler->max_depth) compiler->max_depth = compiler->depth;
+
+    compiler->operations[compiler->n_operations++] = operation;
+    return 0;
+}
+
+/*
+ * Compiles 'name' or 'resname' (if residue is non-zero) followed by names.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+static int compile_names(compiler_t *compiler, int residue)
+{
+    const topology_t *topology = compiler->topology;
+    const name_table_t *table = residue ? &topology->residue_table : &topology->atom_table;
+
+    unsigned char *names = calloc(table->n_names, 1);
+    if (names == NULL) return 1;
+
+    size_t n_values = 0;
+    size_t n_matching = 0;
+    long single = -1;
+    for (const token_t *token = peek(compiler); !ends_values(token); token = peek(compiler)) {
+        for (size_t id = 0; id < table->n_names; ++id) {
+            if (!names[id] && glob_match(token->start, token->length, table->names[id])) {
+                names[id] = 1;
+                single = (long) id;
+                n_matching++;
+            }
+        }
+        n_values++;
+        compiler->position++;
+    }
+
+    if (n_values == 0) {
+        free(names);
+        return 1;
+    }
+
+    operation_t operation = { OP_TABLE, topology->atom_names, names, n_matching == 1 ? single : -1, NULL };
+    if (residue) {
+        // atoms are matched through the table of matching residues
+        operation.ids = topology->atom_residues;
+        operation.single = -1;
+        operation.matches = malloc(topology->n_residues);
+        if (operation.matches != NULL) {
+            for (size_t r = 0; r < topology->n_residues; ++r) operation.matches[r] = names[topology->residue_names[r]];
+        }
+        free(names);
+        if (operation.matches == NULL) return 1;
+    }
+
+    if (emit(compiler, operation) != 0) {
+        free(operation.matches);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Parses an integer spanning the whole text of the given length.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+static int parse_int(const char *text, size_t length, int *value)
+{
+    char buffer[32] = "";
+    if (length == 0 || length >= sizeof(buffer)) return 1;
+    memcpy(buffer, text, length);
+
+    char *end = NULL;
+    const long parsed = strtol(buffer, &end, 10);
+    if (*end != '\0' || parsed < -2147483647L || parsed > 2147483647L) return 1;
+    *value = (int) parsed;
+    return 0;
+}
+
+/*
+ * Compiles 'resid' followed by residue numbers and ranges.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+static int compile_residues(compiler_t *compiler)
+{
+    const topology_t *topology = compiler->topology;
+    operation_t operation = { OP_TABLE, topology->atom_residues, NULL, -1, NULL };
+    operation.matches = calloc(topology->n_residues, 1);
+    if (operation.matches == NULL) return 1;
+
+    size_t n_values = 0;
+    for (const token_t *token = peek(compiler); !ends_values(token); token = peek(compiler)) {
+        int range[2] = {0};
+        const char *dash = memchr(token->start + 1, '-', token->length > 1 ? token->length - 1 : 0);
+
+        if (dash != NULL) {
+            // range written as 'first-last'
+            if (parse_int(token->start, (size_t) (dash - token->start), &range[0]) != 0 ||
+                    parse_int(dash + 1, token->length - (size_t) (dash - token->start) - 1, &range[1]) != 0) goto failed;
+            compiler->position++;
+        } else {
+            if (parse_int(token->start, token->length, &range[0]) != 0) goto failed;
+            range[1] = range[0];
+            compiler->position++;
+
+            // range written as 'first to last'
+            const token_t *next = peek(compiler);
+            if (next != NULL && token_is(next, "to")) {
+                compiler->position++;
+                next = peek(compiler);
+                if (next == NULL || parse_int(next->start, next->length, &range[1]) != 0) goto failed;
+                compiler->position++;
+            }
+        }
+
+        for (size_t r = 0; r < topology->n_residues; ++r) {
+            operation.matches[r] |= topology->residue_numbers[r] >= range[0] && topology->residue_numbers[r] <= range[1];
+        }
+        n_values++;
+    }
+
+    if (n_values == 0 || emit(compiler, operation) != 0) goto failed;
+    return 0;
+
+failed:
+    free(operation.matches);
+    return 1;
+}
+
+/*
+ * Compiles the name of an ndx group.
+ * The group must occur exactly once and must list atoms of the topology in increasing order.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+static int compile_group(compiler_t *compiler)
+{
+    const token_t *token = peek(compiler);
+    if (compiler->ndx == NULL || token == NULL) return 1;
+
+    const ndx_group_t *group = ndx_find(compiler->ndx, token->start, token->length);
+    if (group == NULL) return 1;
+
+    operation_t operation = { OP_GROUP, NULL, NULL, -1, NULL };
+    operation.bits = calloc(compiler->n_words, sizeof(uint64_t));
+    if (operation.bits == NULL) return 1;
+
+    for (size_t i = 0; i < group->n_atoms; ++i) {
+        const size_t atom = group->atoms[i];
+        if ((i > 0 && atom <= group->atoms[i - 1]) || atom > compiler->topology->n_atoms) {
+            free(operation.bits);
+            return 1;
+        }
+        operation.bits[(atom - 1) / 64] |= (uint64_t) 1 << ((atom - 1) % 64);
+    }
+
+    if (emit(compiler, operation) != 0) {
+        free(operation.bits);
+        return 1;
+    }
+
+    compiler->position++;
+    return 0;
+}
+
+static int compile_expression(compiler_t *compiler);
+
+/*
+ * Compiles an operand of a boolean operator.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+static int compile_term(compiler_t *compiler)
+{
+    const token_t *token = peek(compiler);
+    if (token == NULL) return 1;
+
+    const operation_t operator = { OP_NOT, NULL, NULL, -1, NULL };
+    if (token_is(token, "not") || token_is(token, "!")) {
+        compiler->position++;
+        return compile_term(compiler) != 0 || emit(compiler, operator) != 0;
+    }
+
+    if (token_is(token, "(")) {
+        compiler->position++;
+        if (compile_expression(compiler) != 0) return 1;
+        token = peek(compiler);
+        if (token == NULL || !token_is(token, ")")) return 1;
+        compiler->position++;
+        return 0;
+    }
+
+    if (token_is(token, "all")) {
+        compiler->position++;
+        const operation_t all = { OP_ALL, NULL, NULL, -1, NULL };
+        return emit(compiler, all);
+    }
+
+    if (token_is(token, "name") || token_is(token, "resname")) {
+        compiler->position++;
+        return compile_names(compiler, token_is(token, "resname"));
+    }
+
+    if (token_is(token, "resid")) {
+        compiler->position++;
+        return compile_residues(compiler);
+    }
+
+    if (ends_values(token)) return 1;
+    return compile_group(compiler);
+}
+
+/*
+ * Compiles operands joined by 'and' and 'or', which are evaluated from left to right.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+static int compile_expression(compiler_t *compiler)
+{
+    if (compile_term(compiler) != 0) return 1;
+
+    int seen_or = 0;
+    for (const token_t *token = peek(compiler); is_and(token) || is_or(token); token = peek(compiler)) {
+        // precedence of 'and' following 'or' is ambiguous; left to smart_select
+        if (seen_or && is_and(token)) return 1;
+        seen_or |= is_or(token);
+
+        const operation_t operator = { is_and(token) ? OP_AND : OP_OR, NULL, NULL, -1, NULL };
+        compiler->position++;
+        if (compile_term(compiler) != 0 || emit(compiler, operator) != 0) return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Evaluates an OP_TABLE operation for n_words words starting at word first.
+ */
+static void evaluate_table(const compiler_t *plan, const operation_t *operation, size_t first, size_t n_words, uint64_t *bits)
+{
+    const size_t n_atoms = plan->topology->n_atoms;
+    for (size_t w = 0; w < n_words; ++w) {
+        const size_t atom = 64 * (first + w);
+        const uint32_t *ids = operation->ids + atom;
+        uint64_t word = 0;
+
+        if (atom + 64 > n_atoms) {
+            // the last word is only partially filled
+            for (size_t b = 0; atom + b < n_atoms; ++b) word |= (uint64_t) operation->matches[ids[b]] << b;
+        } else if (operation->single >= 0) {
+            // a single matching name is compared directly with the ids
+            const uint32_t single = (uint32_t) operation->single;
+            for (int b = 0; b < 64; ++b) word |= (uint64_t) (ids[b] == single) << b;
+        } else {
+            for (int b = 0; b < 64; ++b) word |= (uint64_t) operation->matches[ids[b]] << b;
+        }
+
+        bits[w] = word;
+    }
+}
+
+/*
+ * Evaluates the plan for words [first_word, last_word) into result.
+ * stack must have space for max_depth * CHUNK_WORDS words.
+ */
+static void evaluate_range(const compiler_t *plan, size_t first_word, size_t last_word, uint64_t *stack, uint64_t *result)
+{
+    for (size_t word = first_word; word < last_word; word += CHUNK_WORDS) {
+        const size_t n = last_word - word < CHUNK_WORDS ? last_word - word : CHUNK_WORDS;
+
+        uint64_t *top = stack;      // first free operand of the stack
+        for (size_t k = 0; k < plan->n_operations; ++k) {
+            const operation_t *operation = &plan->operations[k];
+
+            // operators work on the topmost one or two operands
+            if (operation->kind == OP_NOT) top -= CHUNK_WORDS;
+            else if (operation->kind == OP_AND || operation->kind == OP_OR) top -= 2 * CHUNK_WORDS;
+
+            switch (operation->kind) {
+            case OP_TABLE:
+                evaluate_table(plan, operation, word, n, top);
+                top += CHUNK_WORDS;
+                break;
+            case OP_GROUP:
+                memcpy(top, operation->bits + word, n * sizeof(uint64_t));
+                top += CHUNK_WORDS;
+                break;
+            case OP_ALL:
+                for (size_t i = 0; i < n; ++i) top[i] = ~(uint64_t) 0;
+                top += CHUNK_WORDS;
+                break;
+            case OP_NOT:
+                for (size_t i = 0; i < n; ++i) top[i] = ~top[i];
+                top += CHUNK_WORDS;
+                break;
+            case OP_AND:
+                for (size_t i = 0; i < n; ++i) top[i] &= top[i + CHUNK_WORDS];
+                top += CHUNK_WORDS;
+                break;
+            case OP_OR:
+                for (size_t i = 0; i < n; ++i) top[i] |= top[i + CHUNK_WORDS];
+                top += CHUNK_WORDS;
+                break;
+            }
+        }
+
+        memcpy(result + word, stack, n * sizeof(uint64_t));
+    }
+}
+
+static void *run_evaluator(void *arg)
+{
+    evaluator_t *evaluator = (evaluator_t *) arg;
+    const compiler_t *plan = evaluator->plan;
+
+    uint64_t *stack = malloc(plan->max_depth * CHUNK_WORDS * sizeof(uint64_t));
+    if (stack == NULL) return (void *) evaluator;
+
+    evaluate_range(plan, evaluator->first_word, evaluator->last_word, stack, evaluator->result);
+    free(stack);
+    return NULL;
+}
+
+/*
+ * Evaluates the plan using up to n_threads threads.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+static int evaluate(const compiler_t *plan, int n_threads, uint64_t *result)
+{
+    // threads get whole chunks of words
+    const size_t n_chunks = (plan->n_words + CHUNK_WORDS - 1) / CHUNK_WORDS;
+    size_t n_evaluators = plan->topology->n_atoms / MIN_THREAD_ATOMS;
+    if (n_evaluators > (size_t) n_threads) n_evaluators = (size_t) n_threads;
+    if (n_evaluators > n_chunks) n_evaluators = n_chunks;
+    if (n_evaluators < 1) n_evaluators = 1;
+
+    evaluator_t *evaluators = calloc(n_evaluators, sizeof(evaluator_t));
+    int *started = calloc(n_evaluators, sizeof(int));
+    if (evaluators == NULL || started == NULL) {
+        free(evaluators);
+        free(started);
+        return 1;
+    }
+
+    for (size_t i = 0; i < n_evaluators; ++i) {
+        evaluators[i].plan = plan;
+        evaluators[i].result = result;
+        evaluators[i].first_word = n_chunks * i / n_evaluators * CHUNK_WORDS;
+        evaluators[i].last_word = n_chunks * (i + 1) / n_evaluators * CHUNK_WORDS;
+        if (evaluators[i].last_word > plan->n_words) evaluators[i].last_word = plan->n_words;
+
+        // the first range is evaluated by the calling thread
+        if (i > 0) started[i] = pthread_create(&evaluators[i].thread, NULL, run_evaluator, &evaluators[i]) == 0;
+    }
+
+    int error = 0;
+    for (size_t i = 0; i < n_evaluators; ++i) {
+        void *failed = NULL;
+        if (started[i]) pthread_join(evaluators[i].thread, &failed);
+        else failed = run_evaluator(&evaluators[i]);
+        if (failed != NULL) error = 1;
+    }
+
+    free(evaluators);
+    free(started);
+    return error;
+}
+
+static void free_compiler(compiler_t *compiler)
+{
+    for (size_t i = 0; i < compiler->n_operations; ++i) {
+        free(compiler->operations[i].matches);
+        free(compiler->operations[i].bits);
+    }
+    free(compiler->operations);
+    free(compiler->tokens);
+}
+
+size_t *query_select(const topology_t *topology, const char *query, const ndx_t *ndx, int n_threads, size_t *n_selected)
+{
+    compiler_t compiler = {0};
+    compiler.topology = topology;
+    compiler.ndx = ndx;
+    compiler.n_words = (topology->n_atoms + 63) / 64;
+    if (compiler.n_words == 0) return NULL;
+
+    if (tokenize(&compiler, query) != 0 || compiler.n_tokens == 0) {
+        free_compiler(&compiler);
+        return NULL;
+    }
+
+    compiler.operations = calloc(compiler.n_tokens, sizeof(operation_t));
+    if (compiler.operations == NULL || compile_expression(&compiler) != 0 || compiler.position != compiler.n_tokens) {
+        free_compiler(&compiler);
+        return NULL;
+    }
+
+    uint64_t *result = malloc(compiler.n_words * sizeof(uint64_t));
+    if (result == NULL || evaluate(&compiler, n_threads, result) != 0) {
+        free(result);
+        free_compiler(&compiler);
+        return NULL;
+    }
+
+    // drop the bits following the last atom, which are set by 'all' and 'not'
+    if (topology->n_atoms % 64 != 0) result[compiler.n_words - 1] &= ((uint64_t) 1 << (topology->n_atoms % 64)) - 1;
+
+    *n_selected = 0;
+    for (size_t w = 0; w < compiler.n_words; ++w) *n_selected += (size_t) __builtin_popcountll(result[w]);
+
+    // one more index, so that nothing is selected without malloc returning NULL
+    size_t *indices = malloc((*n_selected + 1) * sizeof(size_t));
+    if (indices != NULL) {
+        size_t n = 0;
+        for (size_t w = 0; w < compiler.n_words; ++w) {
+            for (uint64_t word = result[w]; word != 0; word &= word - 1) {
+                indices[n++] = 64 * w + (size_t) __builtin_ctzll(word);
+            }
+        }
+    }
+
+    free(result);
+    free_compiler(&compiler);
+    return indices;
+}
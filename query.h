@@ -0,0 +1,26 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef QUERY_H
+#define QUERY_H
+
+#include <stddef.h>
+#include "ndx.h"
+#include "topology.h"
+
+/*
+ * Selects atoms of topology matching query, like smart_select from groan, but compiles the query
+ * into operations on per-atom bitsets which are evaluated by up to n_threads threads.
+ *
+ * Supported are the operators 'and', 'or' and 'not' (also '&&', '||' and '!'), parentheses,
+ * 'all', 'resname' and 'name' followed by names (with '*' wildcards), 'resid' followed by
+ * numbers and ranges ('1-10' or '1 to 10') and names of groups of ndx (which may be NULL).
+ * 'and' following 'or' without parentheses is not supported.
+ *
+ * Returns increasing indices of the selected atoms (to be freed using free), their number is written into n_selected.
+ * Returns NULL, if the query contains anything else, if a group is missing in ndx
+ * or is not sorted, or if the evaluation has failed. smart_select should be used in such case.
+ */
+size_t *query_select(const topology_t *topology, const char *query, const ndx_t *ndx, int n_threads, size_t *n_selected);
+
+#endif /* QUERY_H */
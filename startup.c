@@ -0,0 +1,101 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+// Reading a large gro file takes seconds. Meanwhile, the ndx file is parsed by one thread
+// and another thread opens the input xtc file, probes the header of its first frame and
+// asks the kernel to read the first frames ahead, so that the pipeline finds them
+// in the page cache once it starts.
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <unistd.h>
+#include "startup.h"
+#include "io.h"
+#include "xtc.h"
+
+// the first frames of the xtc file are read ahead...
+static const off_t PREFETCH_FRAMES = 32;
+// ...but at least and at most this number of bytes
+static const off_t PREFETCH_MIN = 16 << 20;
+static const off_t PREFETCH_MAX = 256 << 20;
+
+static void *run_ndx(void *arg)
+{
+    startup_t *startup = arg;
+    startup->ndx_read = ndx_read(startup->ndx_file, &startup->ndx) == 0;
+    return NULL;
+}
+
+/*
+ * Returns the number of bytes to read ahead from the start of the xtc file opened as fd.
+ */
+static off_t prefetch_length(int fd)
+{
+    unsigned char data[XTC_HEADER_SIZE] = {0};
+    if (pread_full(fd, data, 8, 0) != 8) return PREFETCH_MIN;
+
+    const int n_atoms = xtc_peek_atoms(data);
+    if (n_atoms <= 0) return PREFETCH_MIN;
+
+    const size_t header_size = xtc_header_size(n_atoms);
+    xtc_header_t header = {0};
+    if (pread_full(fd, data, header_size, 0) != (ssize_t) header_size || xtc_parse_header(data, &header) != 0) {
+        return PREFETCH_MIN;
+    }
+
+    const size_t frame_size = xtc_frame_size(&header);
+    if (frame_size > (size_t) (PREFETCH_MAX / PREFETCH_FRAMES)) return PREFETCH_MAX;
+
+    const off_t length = (off_t) frame_size * PREFETCH_FRAMES;
+    return length < PREFETCH_MIN ? PREFETCH_MIN : length;
+}
+
+static void *run_prefetch(void *arg)
+{
+    startup_t *startup = arg;
+
+    // errors are ignored, the pipeline reports them when it opens the file
+    int fd = open(startup->xtc_file, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    posix_fadvise(fd, 0, prefetch_length(fd), POSIX_FADV_WILLNEED);
+    close(fd);
+    return NULL;
+}
+
+void startup_begin(startup_t *startup, const char *ndx_file, const char *xtc_file)
+{
+    startup->ndx_file = ndx_file;
+    startup->xtc_file = xtc_file;
+
+    startup->ndx_started = pthread_create(&startup->ndx_thread, NULL, run_ndx, startup) == 0;
+    if (!startup->ndx_started) run_ndx(startup);
+
+    if (xtc_file != NULL) {
+        startup->prefetch_started = pthread_create(&startup->prefetch_thread, NULL, run_prefetch, startup) == 0;
+    }
+}
+
+const ndx_t *startup_ndx(startup_t *startup)
+{
+    if (startup->ndx_started) {
+        pthread_join(startup->ndx_thread, NULL);
+        startup->ndx_started = 0;
+    }
+
+    return startup->ndx_read ? &startup->ndx : NULL;
+}
+
+void startup_end(startup_t *startup)
+{
+    startup_ndx(startup);
+
+    if (startup->prefetch_started) {
+        pthread_join(startup->prefetch_thread, NULL);
+        startup->prefetch_started = 0;
+    }
+
+    if (startup->ndx_read) ndx_free(&startup->ndx);
+    startup->ndx_read = 0;
+}
@@ -0,0 +1,40 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef STARTUP_H
+#define STARTUP_H
+
+#include <pthread.h>
+#include "ndx.h"
+
+/* work running in the background while the gro file is being read */
+typedef struct startup {
+    ndx_t ndx;
+    int ndx_read;               // non-zero, if the ndx file has been read successfully
+    int ndx_started;            // non-zero, if ndx_thread is running (or has not been joined yet)
+    pthread_t ndx_thread;
+    const char *ndx_file;
+
+    int prefetch_started;       // non-zero, if prefetch_thread is running (or has not been joined yet)
+    pthread_t prefetch_thread;
+    const char *xtc_file;
+} startup_t;
+
+/*
+ * Starts reading ndx_file and prefetching the first frames of xtc_file (which may be NULL) in the background.
+ * If a thread cannot be created, the ndx file is read immediately and the xtc file is not prefetched.
+ */
+void startup_begin(startup_t *startup, const char *ndx_file, const char *xtc_file);
+
+/*
+ * Waits until the ndx file has been read.
+ * Returns the groups of the ndx file or NULL, if it could not be read.
+ */
+const ndx_t *startup_ndx(startup_t *startup);
+
+/*
+ * Waits for all background work and releases the groups of the ndx file.
+ */
+void startup_end(startup_t *startup);
+
+#endif /* STARTUP_H */
@@ -0,0 +1,663 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+// Asynchronous sequential reading and writing.
+//
+// A stream owns a fixed number of large buffers, each of them attached to one request.
+// The reader keeps all requests in flight ahead of the consumer and resubmits a buffer
+// as soon as it has been consumed. The writer fills one buffer at a time and submits it
+// as soon as it is full, while the previously filled buffers are still being written.
+//
+// Requests are executed either by io_uring (driven directly through system calls,
+// no library is required) or, if io_uring is not available, by helper threads issuing
+// blocking pread/pwrite calls.
+//
+// Both streams advise the kernel about their access pattern, so that streaming a huge
+// trajectory does not evict the page cache of other processes. The reader asks for
+// read-ahead of a window corresponding to a fixed time of reading at the measured
+// throughput and drops the pages it has already consumed. The writer drops the pages
+// it has already written.
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include "stream.h"
+#include "io.h"
+
+// number of requests kept in flight by every stream
+#define STREAM_DEPTH 4
+// size of a single read or write
+static const size_t STREAM_CHUNK = 4 << 20;
+
+// read-ahead window covers this time of reading (in seconds)
+static const double READAHEAD_TIME = 1.0;
+// limits of the read-ahead window (in bytes)
+static const double READAHEAD_MIN = 16 << 20;
+static const double READAHEAD_MAX = 1 << 30;
+
+typedef enum request_state {
+    REQUEST_IDLE,
+    REQUEST_QUEUED,     // waiting for a helper thread
+    REQUEST_RUNNING,
+    REQUEST_DONE,
+} request_state_t;
+
+typedef struct request {
+    request_state_t state;      // guarded by the lock of the engine (thread backend)
+    int write;
+    int pending;                // submitted and not yet waited for, only used by the owner
+    unsigned char *buffer;
+    size_t size;
+    off_t offset;
+    ssize_t result;             // number of bytes transferred or -1 on error
+    unsigned long sequence;     // order of submission
+} request_t;
+
+typedef struct uring {
+    int fd;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+} uring_t;
+
+typedef struct engine {
+    int fd;
+    int uses_uring;
+    request_t requests[STREAM_DEPTH];
+    uring_t ring;
+
+    pthread_t threads[STREAM_DEPTH];
+    int n_threads;
+    pthread_mutex_t lock;
+    pthread_cond_t queued;
+    pthread_cond_t done;
+    unsigned long sequence;
+    int stop;
+} engine_t;
+
+struct stream_reader {
+    engine_t engine;
+    size_t current;             // request holding the data being consumed
+    size_t position;            // position of the consumer in the current buffer
+    ssize_t available;          // number of bytes in the current buffer, -1 if not completed
+    off_t next_offset;          // offset of the next read to submit
+    off_t advised;              // end of the range the read-ahead has been requested for
+    double throughput;          // moving average of the consumption rate (bytes per second)
+    struct timespec consumed;   // time at which the last buffer has been consumed
+    int error;
+};
+
+struct stream_writer {
+    engine_t engine;
+    size_t current;             // request whose buffer is being filled
+    size_t fill;                // number of bytes in the current buffer
+    off_t offset;               // offset of the current buffer in the file
+    off_t dropped;              // end of the range whose pages have been dropped
+    int direct;                 // file is written with O_DIRECT
+    int truncate;               // file must be truncated to its real size when closing
+    int error;
+};
+
+int stream_parse_backend(const char *name, stream_backend_t *backend)
+{
+    if (!strcmp(name, "auto")) *backend = STREAM_AUTO;
+    else if (!strcmp(name, "uring")) *backend = STREAM_URING;
+    else if (!strcmp(name, "threads")) *backend = STREAM_THREADS;
+    else return 1;
+
+    return 0;
+}
+
+/*
+ * Creates io_uring with the given number of entries and maps its rings.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+static int uring_setup(uring_t *ring, unsigned entries)
+{
+#ifdef __NR_io_uring_setup
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ring->fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) return 1;
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        if (ring->sq_ring != MAP_FAILED) munmap(ring->sq_ring, ring->sq_ring_size);
+        if (ring->cq_ring != MAP_FAILED) munmap(ring->cq_ring, ring->cq_ring_size);
+        if (ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+        close(ring->fd);
+        return 1;
+    }
+
+    unsigned char *sq = ring->sq_ring;
+    ring->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) (sq + params.sq_off.array);
+
+    unsigned char *cq = ring->cq_ring;
+    ring->cq_head = (unsigned *) (cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    return 0;
+#else
+    (void) ring;
+    (void) entries;
+    return 1;
+#endif
+}
+
+static void uring_destroy(uring_t *ring)
+{
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    munmap(ring->cq_ring, ring->cq_ring_size);
+    munmap(ring->sqes, ring->sqes_size);
+    close(ring->fd);
+}
+
+/*
+ * Calls io_uring_enter, repeating the call if interrupted.
+ * Returns the value returned by the system call.
+ */
+static int uring_enter(uring_t *ring, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    int result = 0;
+    do {
+        result = (int) syscall(__NR_io_uring_enter, ring->fd, to_submit, min_complete, flags, NULL, 0);
+    } while (result < 0 && errno == EINTR);
+    return result;
+}
+
+/*
+ * Submits the request with the given tag to io_uring.
+ * If the request could not be submitted, it is removed from the submission queue again.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+static int uring_submit(engine_t *engine, size_t tag)
+{
+    uring_t *ring = &engine->ring;
+    const request_t *request = &engine->requests[tag];
+
+    // every request uses its own submission entry
+    struct io_uring_sqe *sqe = &ring->sqes[tag];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = request->write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = engine->fd;
+    sqe->off = (unsigned long long) request->offset;
+    sqe->addr = (unsigned long long) (size_t) request->buffer;
+    sqe->len = (unsigned) request->size;
+    sqe->user_data = tag;
+
+    const unsigned tail = *ring->sq_tail;
+    ring->sq_array[tail & *ring->sq_mask] = (unsigned) tag;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    if (uring_enter(ring, 1, 0, 0) == 1) return 0;
+
+    // the kernel has not consumed the entry, so it is taken back and never submitted by a later call
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/*
+ * Waits for at least one completion and marks all completed requests as done.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+static int uring_reap(engine_t *engine)
+{
+    uring_t *ring = &engine->ring;
+
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        if (uring_enter(ring, 0, 1, IORING_ENTER_GETEVENTS) < 0) return 1;
+    }
+
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        const struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        if (cqe->user_data < STREAM_DEPTH) {
+            request_t *request = &engine->requests[cqe->user_data];
+            request->result = cqe->res < 0 ? -1 : cqe->res;
+            request->state = REQUEST_DONE;
+        }
+        ++head;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/*
+ * Performs the request using blocking system calls.
+ */
+static void execute_request(int fd, request_t *request)
+{
+    if (request->write) {
+        request->result = pwrite_full(fd, request->buffer, request->size, request->offset) == 0 ? (ssize_t) request->size : -1;
+    } else {
+        request->result = pread_full(fd, request->buffer, request->size, request->offset);
+    }
+}
+
+static void *run_helper(void *arg)
+{
+    engine_t *engine = (engine_t *) arg;
+
+    pthread_mutex_lock(&engine->lock);
+    for (;;) {
+        // requests are executed in the order of their submission
+        request_t *next = NULL;
+        for (size_t i = 0; i < STREAM_DEPTH; ++i) {
+            request_t *request = &engine->requests[i];
+            if (request->state != REQUEST_QUEUED) continue;
+            if (next == NULL || request->sequence < next->sequence) next = request;
+        }
+
+        if (next == NULL) {
+            if (engine->stop) break;
+            pthread_cond_wait(&engine->queued, &engine->lock);
+            continue;
+        }
+
+        next->state = REQUEST_RUNNING;
+        pthread_mutex_unlock(&engine->lock);
+
+        execute_request(engine->fd, next);
+
+        pthread_mutex_lock(&engine->lock);
+        next->state = REQUEST_DONE;
+        pthread_cond_broadcast(&engine->done);
+    }
+    pthread_mutex_unlock(&engine->lock);
+
+    return NULL;
+}
+
+/*
+ * Prepares the engine executing requests on fd. Buffers of the requests are allocated.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+static int engine_init(engine_t *engine, int fd, stream_backend_t backend)
+{
+    memset(engine, 0, sizeof(engine_t));
+    engine->fd = fd;
+
+    for (size_t i = 0; i < STREAM_DEPTH; ++i) {
+        void *buffer = NULL;
+        if (posix_memalign(&buffer, STREAM_ALIGNMENT, STREAM_CHUNK) != 0) {
+            for (size_t j = 0; j < i; ++j) free(engine->requests[j].buffer);
+            return 1;
+        }
+        engine->requests[i].buffer = buffer;
+    }
+
+    if (backend != STREAM_THREADS && uring_setup(&engine->ring, STREAM_DEPTH) == 0) {
+        engine->uses_uring = 1;
+        return 0;
+    }
+
+    if (backend == STREAM_URING) goto failed;
+
+    pthread_mutex_init(&engine->lock, NULL);
+    pthread_cond_init(&engine->queued, NULL);
+    pthread_cond_init(&engine->done, NULL);
+    for (int i = 0; i < STREAM_DEPTH; ++i) {
+        if (pthread_create(&engine->threads[i], NULL, run_helper, engine) != 0) break;
+        engine->n_threads++;
+    }
+
+    if (engine->n_threads == 0) {
+        pthread_mutex_destroy(&engine->lock);
+        pthread_cond_destroy(&engine->queued);
+        pthread_cond_destroy(&engine->done);
+        goto failed;
+    }
+
+    return 0;
+
+failed:
+    for (size_t i = 0; i < STREAM_DEPTH; ++i) free(engine->requests[i].buffer);
+    return 1;
+}
+
+/*
+ * Starts the request with the given tag. Buffer, size, offset and direction must be set.
+ */
+static void engine_submit(engine_t *engine, size_t tag)
+{
+    request_t *request = &engine->requests[tag];
+    request->pending = 1;
+
+    if (engine->uses_uring) {
+        request->state = REQUEST_RUNNING;
+        // the request is still completed, if it could not be queued
+        if (uring_submit(engine, tag) != 0) {
+            execute_request(engine->fd, request);
+            request->state = REQUEST_DONE;
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&engine->lock);
+    request->state = REQUEST_QUEUED;
+    request->sequence = engine->sequence++;
+    pthread_cond_signal(&engine->queued);
+    pthread_mutex_unlock(&engine->lock);
+}
+
+/*
+ * Waits for the request with the given tag to complete.
+ * Returns the number of bytes transferred (less than requested only at the end of the file) or -1 on error.
+ */
+static ssize_t engine_wait(engine_t *engine, size_t tag)
+{
+    request_t *request = &engine->requests[tag];
+
+    if (engine->uses_uring) {
+        while (request->state != REQUEST_DONE) {
+            if (uring_reap(engine) != 0) {
+                // the request may still be in flight, the engine must not be used anymore
+                request->pending = 0;
+                return -1;
+            }
+        }
+
+        // io_uring may transfer fewer bytes than requested, the rest is transferred directly
+        if (request->result >= 0 && (size_t) request->result < request->size) {
+            const size_t done = (size_t) request->result;
+            if (request->write) {
+                if (pwrite_full(engine->fd, request->buffer + done, request->size - done, request->offset + (off_t) done) != 0) request->result = -1;
+                else request->result = (ssize_t) request->size;
+            } else {
+                ssize_t rest = pread_full(engine->fd, request->buffer + done, request->size - done, request->offset + (off_t) done);
+                request->result = rest < 0 ? -1 : request->result + rest;
+            }
+        }
+    } else {
+        pthread_mutex_lock(&engine->lock);
+        while (request->state != REQUEST_DONE) pthread_cond_wait(&engine->done, &engine->lock);
+        pthread_mutex_unlock(&engine->lock);
+    }
+
+    request->state = REQUEST_IDLE;
+    request->pending = 0;
+    return request->result;
+}
+
+/*
+ * Waits for all pending requests and releases all resources of the engine.
+ */
+static void engine_destroy(engine_t *engine)
+{
+    for (size_t i = 0; i < STREAM_DEPTH; ++i) {
+        if (engine->requests[i].pending) engine_wait(engine, i);
+    }
+
+    if (engine->uses_uring) {
+        uring_destroy(&engine->ring);
+    } else {
+        pthread_mutex_lock(&engine->lock);
+        engine->stop = 1;
+        pthread_cond_broadcast(&engine->queued);
+        pthread_mutex_unlock(&engine->lock);
+
+        for (int i = 0; i < engine->n_threads; ++i) pthread_join(engine->threads[i], NULL);
+        pthread_mutex_destroy(&engine->lock);
+        pthread_cond_destroy(&engine->queued);
+        pthread_cond_destroy(&engine->done);
+    }
+
+    for (size_t i = 0; i < STREAM_DEPTH; ++i) free(engine->requests[i].buffer);
+}
+
+stream_reader_t *stream_reader_open(int fd, stream_backend_t backend)
+{
+    stream_reader_t *reader = calloc(1, sizeof(stream_reader_t));
+    if (reader == NULL) return NULL;
+
+    if (engine_init(&reader->engine, fd, backend) != 0) {
+        free(reader);
+        return NULL;
+    }
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    clock_gettime(CLOCK_MONOTONIC, &reader->consumed);
+
+    // all buffers are immediately filled with the beginning of the file
+    for (size_t i = 0; i < STREAM_DEPTH; ++i) {
+        request_t *request = &reader->engine.requests[i];
+        request->write = 0;
+        request->size = STREAM_CHUNK;
+        request->offset = reader->next_offset;
+        reader->next_offset += (off_t) STREAM_CHUNK;
+        engine_submit(&reader->engine, i);
+    }
+    reader->available = -1;
+    reader->advised = reader->next_offset;
+
+    return reader;
+}
+
+/*
+ * Updates the measured throughput after a buffer has been consumed, drops the pages of the buffer
+ * and extends the read-ahead window beyond the reads in flight.
+ */
+static void advise_reading(stream_reader_t *reader, off_t consumed)
+{
+    const int fd = reader->engine.fd;
+    posix_fadvise(fd, consumed, (off_t) STREAM_CHUNK, POSIX_FADV_DONTNEED);
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const double elapsed = (double) (now.tv_sec - reader->consumed.tv_sec) + (double) (now.tv_nsec - reader->consumed.tv_nsec) * 1e-9;
+    reader->consumed = now;
+    if (elapsed > 0) {
+        const double rate = (double) STREAM_CHUNK / elapsed;
+        reader->throughput = reader->throughput == 0 ? rate : 0.75 * reader->throughput + 0.25 * rate;
+    }
+
+    double window = reader->throughput * READAHEAD_TIME;
+    if (window < READAHEAD_MIN) window = READAHEAD_MIN;
+    if (window > READAHEAD_MAX) window = READAHEAD_MAX;
+
+    // read-ahead is requested in whole buffers to avoid many small requests
+    const off_t end = reader->next_offset + (off_t) window;
+    if (reader->advised < reader->next_offset) reader->advised = reader->next_offset;
+    if (end - reader->advised >= (off_t) STREAM_CHUNK) {
+        posix_fadvise(fd, reader->advised, end - reader->advised, POSIX_FADV_WILLNEED);
+        reader->advised = end;
+    }
+}
+
+ssize_t stream_read(stream_reader_t *reader, unsigned char *buffer, size_t size)
+{
+    if (reader->error) return -1;
+
+    size_t total = 0;
+    while (total < size) {
+        if (reader->available < 0) {
+            reader->available = engine_wait(&reader->engine, reader->current);
+            reader->position = 0;
+            if (reader->available < 0) {
+                reader->error = 1;
+                return -1;
+            }
+        }
+
+        if (reader->position == (size_t) reader->available) {
+            // a buffer that is not full marks the end of the file
+            if ((size_t) reader->available < STREAM_CHUNK) break;
+
+            // the consumed buffer is reused for the read following all reads in flight
+            request_t *request = &reader->engine.requests[reader->current];
+            advise_reading(reader, request->offset);
+            request->offset = reader->next_offset;
+            reader->next_offset += (off_t) STREAM_CHUNK;
+            engine_submit(&reader->engine, reader->current);
+
+            reader->current = (reader->current + 1) % STREAM_DEPTH;
+            reader->available = -1;
+            continue;
+        }
+
+        size_t n = (size_t) reader->available - reader->position;
+        if (n > size - total) n = size - total;
+        if (buffer != NULL) memcpy(buffer + total, reader->engine.requests[reader->current].buffer + reader->position, n);
+        reader->position += n;
+        total += n;
+    }
+
+    return (ssize_t) total;
+}
+
+void stream_reader_close(stream_reader_t *reader)
+{
+    if (reader == NULL) return;
+    engine_destroy(&reader->engine);
+    free(reader);
+}
+
+stream_writer_t *stream_writer_open(int fd, stream_backend_t backend, int direct, off_t expected_size)
+{
+    stream_writer_t *writer = calloc(1, sizeof(stream_writer_t));
+    if (writer == NULL) return NULL;
+
+    if (engine_init(&writer->engine, fd, backend) != 0) {
+        free(writer);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < STREAM_DEPTH; ++i) writer->engine.requests[i].write = 1;
+
+    writer->direct = direct;
+    writer->truncate = direct;
+    // preallocation keeps the file contiguous on disk, it is not required for writing
+    if (expected_size > 0 && fallocate(fd, 0, 0, expected_size) == 0) writer->truncate = 1;
+
+    return writer;
+}
+
+/*
+ * Waits for the write with the given tag and drops the pages written by it.
+ * Dirty pages cannot be dropped before they are written back, so the pages of older writes
+ * (whose writeback has been started by the previous advice) are dropped again.
+ */
+static void complete_write(stream_writer_t *writer, size_t tag)
+{
+    request_t *request = &writer->engine.requests[tag];
+    if (engine_wait(&writer->engine, tag) != (ssize_t) request->size) {
+        writer->error = 1;
+        return;
+    }
+
+    const int fd = writer->engine.fd;
+    if (request->offset > writer->dropped) {
+        posix_fadvise(fd, writer->dropped, request->offset - writer->dropped, POSIX_FADV_DONTNEED);
+        writer->dropped = request->offset;
+    }
+    posix_fadvise(fd, request->offset, (off_t) request->size, POSIX_FADV_DONTNEED);
+}
+
+/*
+ * Submits the current buffer of the writer and makes the next buffer available for filling.
+ */
+static void flush_buffer(stream_writer_t *writer)
+{
+    request_t *request = &writer->engine.requests[writer->current];
+    request->size = writer->fill;
+    request->offset = writer->offset;
+
+    // direct writes must cover whole blocks, the padding is cut off when closing
+    if (writer->direct && writer->fill % STREAM_ALIGNMENT != 0) {
+        request->size = writer->fill + STREAM_ALIGNMENT - writer->fill % STREAM_ALIGNMENT;
+        memset(request->buffer + writer->fill, 0, request->size - writer->fill);
+    }
+
+    engine_submit(&writer->engine, writer->current);
+
+    writer->offset += (off_t) writer->fill;
+    writer->fill = 0;
+    writer->current = (writer->current + 1) % STREAM_DEPTH;
+
+    // the next buffer may still be in flight
+    request = &writer->engine.requests[writer->current];
+    if (request->pending) complete_write(writer, writer->current);
+}
+
+int stream_write(stream_writer_t *writer, const unsigned char *buffer, size_t size)
+{
+    size_t total = 0;
+    while (total < size && !writer->error) {
+        size_t n = STREAM_CHUNK - writer->fill;
+        if (n > size - total) n = size - total;
+        memcpy(writer->engine.requests[writer->current].buffer + writer->fill, buffer + total, n);
+        writer->fill += n;
+        total += n;
+
+        if (writer->fill == STREAM_CHUNK) flush_buffer(writer);
+    }
+
+    return writer->error;
+}
+
+int stream_writer_close(stream_writer_t *writer)
+{
+    if (writer == NULL) return 1;
+
+    if (writer->fill > 0 && !writer->error) flush_buffer(writer);
+
+    // remaining writes complete in the order of their submission
+    for (size_t i = 1; i <= STREAM_DEPTH; ++i) {
+        const size_t tag = (writer->current + i) % STREAM_DEPTH;
+        if (writer->engine.requests[tag].pending) complete_write(writer, tag);
+    }
+
+    if (writer->truncate && !writer->error && ftruncate(writer->engine.fd, writer->offset) != 0) writer->error = 1;
+
+    int error = writer->error;
+    engine_destroy(&writer->engine);
+    free(writer);
+    return error;
+}
+
+size_t stream_buffer_size(void)
+{
+    return STREAM_DEPTH * STREAM_CHUNK;
+}
+
+const char *stream_reader_backend(const stream_reader_t *reader)
+{
+    return reader->engine.uses_uring ? "io_uring" : "threads";
+}
+
+const char *stream_writer_backend(const stream_writer_t *writer)
+{
+    return writer->engine.uses_uring ? "io_uring" : "threads";
+}
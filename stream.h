@@ -0,0 +1,83 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// alignment of all buffers and of all direct writes
+#define STREAM_ALIGNMENT 4096
+
+/* mechanism used to keep reads and writes in flight */
+typedef enum stream_backend {
+    STREAM_AUTO,        // io_uring, if the kernel allows it, else helper threads
+    STREAM_URING,       // io_uring only
+    STREAM_THREADS,     // helper threads issuing pread/pwrite
+} stream_backend_t;
+
+/* sequential reader keeping several large reads in flight ahead of the consumer */
+typedef struct stream_reader stream_reader_t;
+
+/* sequential writer keeping several filled buffers in flight to the disk */
+typedef struct stream_writer stream_writer_t;
+
+/*
+ * Parses the name of a backend ("auto", "uring" or "threads").
+ * Returns zero, if successful. Else returns non-zero.
+ */
+int stream_parse_backend(const char *name, stream_backend_t *backend);
+
+/*
+ * Starts reading fd from its beginning using the requested backend.
+ * Returns pointer to the reader or NULL, if the reader could not be created.
+ */
+stream_reader_t *stream_reader_open(int fd, stream_backend_t backend);
+
+/*
+ * Reads up to size bytes from the reader into buffer. If buffer is NULL, the bytes are skipped.
+ * Returns the number of bytes read (less than size at the end of the file) or -1 on error.
+ */
+ssize_t stream_read(stream_reader_t *reader, unsigned char *buffer, size_t size);
+
+/*
+ * Waits for all reads in flight and destroys the reader. Does not close the file.
+ */
+void stream_reader_close(stream_reader_t *reader);
+
+/*
+ * Starts writing into fd from its beginning using the requested backend.
+ * If direct is non-zero, fd must have been opened with O_DIRECT: all writes are then issued
+ * in multiples of STREAM_ALIGNMENT bytes and the file is truncated to its real size when closing.
+ * If expected_size is positive, the file is preallocated to this size (if the filesystem supports it)
+ * and also truncated to its real size when closing.
+ * Returns pointer to the writer or NULL, if the writer could not be created.
+ */
+stream_writer_t *stream_writer_open(int fd, stream_backend_t backend, int direct, off_t expected_size);
+
+/*
+ * Appends size bytes to the output. The data are copied, buffer can be reused immediately.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+int stream_write(stream_writer_t *writer, const unsigned char *buffer, size_t size);
+
+/*
+ * Writes all buffered data, waits for all writes in flight and destroys the writer.
+ * Does not close the file.
+ * Returns zero, if all data have been written successfully. Else returns non-zero.
+ */
+int stream_writer_close(stream_writer_t *writer);
+
+/*
+ * Returns the total size of the buffers allocated by a single reader or writer.
+ */
+size_t stream_buffer_size(void);
+
+/*
+ * Returns the name of the backend actually used by the reader or writer.
+ */
+const char *stream_reader_backend(const stream_reader_t *reader);
+const char *stream_writer_backend(const stream_writer_t *writer);
+
+#endif /* STREAM_H */
@@ -0,0 +1,373 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+// Compact representation of the system read from a gro file.
+//
+// Atom and residue names are interned: every distinct name is stored once in a name table
+// and atoms refer to it by a 32-bit id. Residue numbers and names are stored once per residue.
+// Apart from its coordinates, an atom then takes 12 bytes (name id, residue and atom number)
+// instead of the 20 bytes of the per-atom records of groan, and names are compared as integers.
+
+#include <stdlib.h>
+#include <string.h>
+#include "topology.h"
+
+// number of slots of the hash table of an interner before it is first grown
+static const size_t INITIAL_SLOTS = 64;
+
+/* hash table assigning ids to names */
+typedef struct interner {
+    uint64_t *keys;             // packed names + 1 (zero marks an empty slot)
+    uint32_t *ids;
+    size_t capacity;
+    size_t n_allocated;         // number of names the name table has space for
+} interner_t;
+
+/*
+ * Packs name of the given length into an integer.
+ */
+static uint64_t pack_name(const char *name, size_t length)
+{
+    uint64_t packed = 0;
+    memcpy(&packed, name, length);
+    return packed;
+}
+
+static size_t hash_slot(uint64_t packed, size_t capacity)
+{
+    return (size_t) ((packed * 0x9E3779B97F4A7C15ULL) >> 32) & (capacity - 1);
+}
+
+/*
+ * Inserts all names of table into the hash table of the interner, which must be empty.
+ */
+static void rehash(interner_t *interner, const name_table_t *table)
+{
+    for (size_t id = 0; id < table->n_names; ++id) {
+        const uint64_t packed = pack_name(table->names[id], strlen(table->names[id]));
+        size_t slot = hash_slot(packed, interner->capacity);
+        while (interner->keys[slot] != 0) slot = (slot + 1) & (interner->capacity - 1);
+        interner->keys[slot] = packed + 1;
+        interner->ids[slot] = (uint32_t) id;
+    }
+}
+
+/*
+ * Finds the id of name of the given length (at most TOPOLOGY_NAME_SIZE - 1), adding it to table if necessary.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+static int intern(interner_t *interner, name_table_t *table, const char *name, size_t length, uint32_t *id)
+{
+    const uint64_t packed = pack_name(name, length);
+    size_t slot = hash_slot(packed, interner->capacity);
+    while (interner->keys[slot] != 0 && interner->keys[slot] != packed + 1) slot = (slot + 1) & (interner->capacity - 1);
+
+    if (interner->keys[slot] != 0) {
+        *id = interner->ids[slot];
+        return 0;
+    }
+
+    // the hash table is kept at most half full
+    if (table->n_names == interner->capacity / 2) {
+        free(interner->keys);
+        free(interner->ids);
+        interner->capacity *= 2;
+        interner->keys = calloc(interner->capacity, sizeof(uint64_t));
+        interner->ids = malloc(interner->capacity * sizeof(uint32_t));
+        if (interner->keys == NULL || interner->ids == NULL) return 1;
+        rehash(interner, table);
+
+        slot = hash_slot(packed, interner->capacity);
+        while (interner->keys[slot] != 0) slot = (slot + 1) & (interner->capacity - 1);
+    }
+
+    if (table->n_names == interner->n_allocated) {
+        const size_t grown = interner->n_allocated == 0 ? INITIAL_SLOTS : 2 * interner->n_allocated;
+        char (*names)[TOPOLOGY_NAME_SIZE] = realloc(table->names, grown * TOPOLOGY_NAME_SIZE);
+        if (names == NULL) return 1;
+        table->names = names;
+        interner->n_allocated = grown;
+    }
+
+    memset(table->names[table->n_names], 0, TOPOLOGY_NAME_SIZE);
+    memcpy(table->names[table->n_names], name, length);
+    interner->keys[slot] = packed + 1;
+    interner->ids[slot] = (uint32_t) table->n_names;
+    *id = (uint32_t) table->n_names++;
+    return 0;
+}
+
+static int interner_init(interner_t *interner)
+{
+    interner->capacity = INITIAL_SLOTS;
+    interner->n_allocated = 0;
+    interner->keys = calloc(interner->capacity, sizeof(uint64_t));
+    interner->ids = malloc(interner->capacity * sizeof(uint32_t));
+    return interner->keys == NULL || interner->ids == NULL;
+}
+
+static void interner_free(interner_t *interner)
+{
+    free(interner->keys);
+    free(interner->ids);
+    interner->keys = NULL;
+    interner->ids = NULL;
+}
+
+/*
+ * Finds the name in the column of a gro line with the given width, without surrounding spaces.
+ * Returns the length of the name.
+ */
+static size_t field_name(const char *field, size_t width, const char **name)
+{
+    size_t start = 0, end = width;
+    while (start < end && field[start] == ' ') ++start;
+    while (end > start && field[end - 1] == ' ') --end;
+    *name = field + start;
+    return end - start;
+}
+
+/*
+ * Parses a number in the column of a gro line with the given width.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+static int field_int(const char *field, size_t width, int *value)
+{
+    char buffer[16] = "";
+    memcpy(buffer, field, width);
+    char *end = NULL;
+    *value = (int) strtol(buffer, &end, 10);
+    return end == buffer;
+}
+
+static int field_float(const char *field, size_t width, float *value)
+{
+    char buffer[16] = "";
+    memcpy(buffer, field, width);
+    char *end = NULL;
+    *value = strtof(buffer, &end);
+    return end == buffer;
+}
+
+/*
+ * Reads the whole file into memory (terminated by zero).
+ * Returns the content of the file or NULL, if the file could not be read.
+ */
+static char *read_file(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL) return NULL;
+
+    size_t size = 0, capacity = 1 << 20;
+    char *content = malloc(capacity);
+    while (content != NULL) {
+        size += fread(content + size, 1, capacity - size - 1, file);
+        if (size < capacity - 1) break;
+
+        capacity *= 2;
+        char *grown = realloc(content, capacity);
+        if (grown == NULL) free(content);
+        content = grown;
+    }
+
+    const int error = ferror(file);
+    fclose(file);
+    if (content == NULL || error) {
+        free(content);
+        return NULL;
+    }
+
+    content[size] = '\0';
+    return content;
+}
+
+/*
+ * Returns the next line of content (terminated by zero instead of the newline) and moves position behind it.
+ * Returns NULL at the end of content.
+ */
+static char *next_line(char **position)
+{
+    char *line = *position;
+    if (*line == '\0') return NULL;
+
+    char *end = strchr(line, '\n');
+    if (end == NULL) {
+        *position = line + strlen(line);
+    } else {
+        *end = '\0';
+        *position = end + 1;
+        if (end > line && end[-1] == '\r') end[-1] = '\0';
+    }
+    return line;
+}
+
+/*
+ * Parses the atoms of the gro file content into topology, whose arrays have already been allocated.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+static int parse_atoms(const char *gro_file, char **position, topology_t *topology)
+{
+    interner_t atom_interner = {0}, residue_interner = {0};
+    const int failed_init = interner_init(&atom_interner) != 0;
+    if (interner_init(&residue_interner) != 0 || failed_init) {
+        fprintf(stderr, "Could not allocate memory for the topology.\n");
+        interner_free(&atom_interner);
+        interner_free(&residue_interner);
+        return 1;
+    }
+
+    int error = 0;
+    for (size_t i = 0; i < topology->n_atoms && !error; ++i) {
+        char *line = next_line(position);
+        const size_t length = line == NULL ? 0 : strlen(line);
+
+        // velocities are read, if the first atom has them
+        if (i == 0 && length >= 68) {
+            topology->velocities = calloc(3 * topology->n_atoms, sizeof(float));
+            if (topology->velocities == NULL) {
+                fprintf(stderr, "Could not allocate memory for the topology.\n");
+                error = 1;
+                break;
+            }
+        }
+
+        int residue_number = 0;
+        const char *residue_name = NULL, *atom_name = NULL;
+        if (length < 44 || field_int(line, 5, &residue_number) != 0 || field_int(line + 15, 5, &topology->atom_numbers[i]) != 0 ||
+                field_float(line + 20, 8, &topology->coordinates[3 * i]) != 0 ||
+                field_float(line + 28, 8, &topology->coordinates[3 * i + 1]) != 0 ||
+                field_float(line + 36, 8, &topology->coordinates[3 * i + 2]) != 0) {
+            fprintf(stderr, "Could not parse line %zu of %s.\n", i + 3, gro_file);
+            error = 1;
+            break;
+        }
+
+        if (topology->velocities != NULL && length >= 68) {
+            for (int dim = 0; dim < 3; ++dim) field_float(line + 44 + 8 * dim, 8, &topology->velocities[3 * i + dim]);
+        }
+
+        const size_t residue_length = field_name(line + 5, 5, &residue_name);
+        const size_t atom_length = field_name(line + 10, 5, &atom_name);
+        uint32_t residue_id = 0;
+        if (intern(&atom_interner, &topology->atom_table, atom_name, atom_length, &topology->atom_names[i]) != 0 ||
+                intern(&residue_interner, &topology->residue_table, residue_name, residue_length, &residue_id) != 0) {
+            fprintf(stderr, "Could not allocate memory for the topology.\n");
+            error = 1;
+            break;
+        }
+
+        // a new residue starts whenever the number or the name changes
+        const size_t last = topology->n_residues - 1;
+        if (topology->n_residues == 0 || topology->residue_numbers[last] != residue_number || topology->residue_names[last] != residue_id) {
+            topology->residue_numbers[topology->n_residues] = residue_number;
+            topology->residue_names[topology->n_residues] = residue_id;
+            topology->n_residues++;
+        }
+        topology->atom_residues[i] = (uint32_t) (topology->n_residues - 1);
+    }
+
+    interner_free(&atom_interner);
+    interner_free(&residue_interner);
+    return error;
+}
+
+int topology_read_gro(const char *gro_file, topology_t *topology)
+{
+    memset(topology, 0, sizeof(topology_t));
+
+    char *content = read_file(gro_file);
+    if (content == NULL) {
+        fprintf(stderr, "File %s could not be read.\n", gro_file);
+        return 1;
+    }
+
+    char *position = content;
+    char *title = next_line(&position);
+    char *count = next_line(&position);
+    char *end = NULL;
+    const long n_atoms = count == NULL ? 0 : strtol(count, &end, 10);
+    if (title == NULL || count == NULL || end == count || n_atoms <= 0) {
+        fprintf(stderr, "Could not read the number of atoms from %s.\n", gro_file);
+        free(content);
+        return 1;
+    }
+
+    const size_t n = (size_t) n_atoms;
+    topology->n_atoms = n;
+    topology->atom_names = malloc(n * sizeof(uint32_t));
+    topology->atom_residues = malloc(n * sizeof(uint32_t));
+    topology->atom_numbers = malloc(n * sizeof(int));
+    topology->coordinates = malloc(3 * n * sizeof(float));
+    topology->residue_numbers = malloc(n * sizeof(int));
+    topology->residue_names = malloc(n * sizeof(uint32_t));
+    if (topology->atom_names == NULL || topology->atom_residues == NULL || topology->atom_numbers == NULL ||
+            topology->coordinates == NULL || topology->residue_numbers == NULL || topology->residue_names == NULL) {
+        fprintf(stderr, "Could not allocate memory for the topology.\n");
+        goto failed;
+    }
+
+    if (parse_atoms(gro_file, &position, topology) != 0) goto failed;
+
+    char *box = next_line(&position);
+    float *b = topology->box;
+    if (box == NULL || sscanf(box, "%f %f %f %f %f %f %f %f %f", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5], &b[6], &b[7], &b[8]) < 3) {
+        fprintf(stderr, "Could not read the box from %s.\n", gro_file);
+        goto failed;
+    }
+
+    // the arrays of residues only need space for the residues actually present
+    int *residue_numbers = realloc(topology->residue_numbers, topology->n_residues * sizeof(int));
+    if (residue_numbers != NULL) topology->residue_numbers = residue_numbers;
+    uint32_t *residue_names = realloc(topology->residue_names, topology->n_residues * sizeof(uint32_t));
+    if (residue_names != NULL) topology->residue_names = residue_names;
+
+    free(content);
+    return 0;
+
+failed:
+    free(content);
+    topology_free(topology);
+    return 1;
+}
+
+int topology_write_gro(FILE *output, const topology_t *topology, const char *comment)
+{
+    if (fprintf(output, "%s\n%5zu\n", comment, topology->n_atoms) < 0) return 1;
+
+    for (size_t i = 0; i < topology->n_atoms; ++i) {
+        const float *position = topology->coordinates + 3 * i;
+        if (fprintf(output, "%5d%-5s%5s%5d%8.3f%8.3f%8.3f",
+                topology_residue_number(topology, i), topology_residue_name(topology, i), topology_atom_name(topology, i),
+                topology->atom_numbers[i], position[0], position[1], position[2]) < 0) return 1;
+
+        if (topology->velocities != NULL) {
+            const float *velocity = topology->velocities + 3 * i;
+            if (fprintf(output, "%8.4f%8.4f%8.4f", velocity[0], velocity[1], velocity[2]) < 0) return 1;
+        }
+
+        if (fputc('\n', output) == EOF) return 1;
+    }
+
+    const float *b = topology->box;
+    const int triclinic = b[3] != 0.0f || b[4] != 0.0f || b[5] != 0.0f || b[6] != 0.0f || b[7] != 0.0f || b[8] != 0.0f;
+    if (triclinic) {
+        return fprintf(output, "%10.5f%10.5f%10.5f%10.5f%10.5f%10.5f%10.5f%10.5f%10.5f\n",
+                b[0], b[1], b[2], b[3], b[4], b[5], b[6], b[7], b[8]) < 0;
+    }
+
+    return fprintf(output, "%10.5f%10.5f%10.5f\n", b[0], b[1], b[2]) < 0;
+}
+
+void topology_free(topology_t *topology)
+{
+    free(topology->atom_names);
+    free(topology->atom_residues);
+    free(topology->atom_numbers);
+    free(topology->coordinates);
+    free(topology->velocities);
+    free(topology->residue_numbers);
+    free(topology->residue_names);
+    free(topology->atom_table.names);
+    free(topology->residue_table.names);
+    memset(topology, 0, sizeof(topology_t));
+}
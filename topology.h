@@ -0,0 +1,78 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// maximal length of atom and residue names (gro files use 5 characters) including the terminating zero
+#define TOPOLOGY_NAME_SIZE 8
+
+/* interned names: every distinct name is stored once and referred to by its index */
+typedef struct name_table {
+    char (*names)[TOPOLOGY_NAME_SIZE];
+    size_t n_names;
+} name_table_t;
+
+/* system read from a gro file, with names replaced by ids into name tables */
+typedef struct topology {
+    size_t n_atoms;
+    uint32_t *atom_names;       // id of the name of every atom in atom_table
+    uint32_t *atom_residues;    // residue of every atom
+    int *atom_numbers;          // atom numbers as written in the gro file
+    float *coordinates;         // x, y, z triplets
+    float *velocities;          // x, y, z triplets (NULL, if the gro file contains no velocities)
+
+    size_t n_residues;
+    int *residue_numbers;       // number of every residue
+    uint32_t *residue_names;    // id of the name of every residue in residue_table
+
+    name_table_t atom_table;
+    name_table_t residue_table;
+    float box[9];               // xx, yy, zz, followed by the off-diagonal elements in the order of gro files
+} topology_t;
+
+/*
+ * Reads the gro file into topology.
+ * A new residue starts whenever the residue number or residue name changes.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+int topology_read_gro(const char *gro_file, topology_t *topology);
+
+/*
+ * Writes topology in the gro format into output, with comment on the first line.
+ * Velocities are written, if they have been read.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+int topology_write_gro(FILE *output, const topology_t *topology, const char *comment);
+
+/*
+ * Returns the name of the atom with the given index.
+ */
+static inline const char *topology_atom_name(const topology_t *topology, size_t atom)
+{
+    return topology->atom_table.names[topology->atom_names[atom]];
+}
+
+/*
+ * Returns the name of the residue of the atom with the given index.
+ */
+static inline const char *topology_residue_name(const topology_t *topology, size_t atom)
+{
+    return topology->residue_table.names[topology->residue_names[topology->atom_residues[atom]]];
+}
+
+/*
+ * Returns the residue number of the atom with the given index.
+ */
+static inline int topology_residue_number(const topology_t *topology, size_t atom)
+{
+    return topology->residue_numbers[topology->atom_residues[atom]];
+}
+
+void topology_free(topology_t *topology);
+
+#endif /* TOPOLOGY_H */
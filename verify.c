@@ -0,0 +1,194 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+// Parallel verification of xtc files against their checksum sidecars.
+//
+// The file is split into contiguous ranges of frames of similar size in bytes, one per thread.
+// Every thread reads its range in large blocks and compares the checksum of every frame with
+// the checksum from the sidecar. Frames are not decoded, so the verification runs at the speed
+// of the storage. Threads stop as soon as a corrupted frame preceding their position is found.
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "verify.h"
+#include "checksum.h"
+#include "io.h"
+
+// amount of data read at once by a thread (in bytes)
+static const size_t READ_BLOCK = 8 * 1024 * 1024;
+
+typedef struct verifier {
+    const checksum_list_t *list;
+    int fd;
+
+    pthread_mutex_t lock;
+    size_t first_corrupted;     // first corrupted frame found so far (SIZE_MAX if none)
+    int error;
+} verifier_t;
+
+typedef struct verify_worker {
+    verifier_t *verifier;
+    pthread_t thread;
+    size_t first;               // frames [first, last) are verified by this worker
+    size_t last;
+} verify_worker_t;
+
+/*
+ * Records that frame is corrupted.
+ */
+static void report_corrupted(verifier_t *verifier, size_t frame)
+{
+    pthread_mutex_lock(&verifier->lock);
+    if (frame < verifier->first_corrupted) verifier->first_corrupted = frame;
+    pthread_mutex_unlock(&verifier->lock);
+}
+
+/*
+ * Returns non-zero, if a corrupted frame preceding frame has already been found.
+ */
+static int preceded_by_corruption(verifier_t *verifier, size_t frame)
+{
+    pthread_mutex_lock(&verifier->lock);
+    int preceded = verifier->first_corrupted < frame;
+    pthread_mutex_unlock(&verifier->lock);
+    return preceded;
+}
+
+static void *run_verifier(void *arg)
+{
+    verify_worker_t *worker = (verify_worker_t *) arg;
+    verifier_t *verifier = worker->verifier;
+    const checksum_list_t *list = verifier->list;
+
+    // the buffer must hold at least the largest frame
+    size_t capacity = READ_BLOCK;
+    for (size_t frame = worker->first; frame < worker->last; ++frame) {
+        if (list->sizes[frame] > capacity) capacity = (size_t) list->sizes[frame];
+    }
+
+    unsigned char *buffer = malloc(capacity);
+    if (buffer == NULL) {
+        fprintf(stderr, "Could not allocate memory for verification.\n");
+        pthread_mutex_lock(&verifier->lock);
+        verifier->error = 1;
+        pthread_mutex_unlock(&verifier->lock);
+        return NULL;
+    }
+
+    size_t frame = worker->first;
+    while (frame < worker->last && !preceded_by_corruption(verifier, frame)) {
+        // read as many whole frames as fit into the buffer
+        size_t end = frame;
+        size_t size = 0;
+        while (end < worker->last && (end == frame || size + list->sizes[end] <= capacity)) {
+            size += (size_t) list->sizes[end];
+            ++end;
+        }
+
+        ssize_t n = pread_full(verifier->fd, buffer, size, (off_t) list->offsets[frame]);
+        if (n < 0) n = 0;
+
+        size_t position = 0;
+        for (; frame < end; ++frame) {
+            const size_t frame_size = (size_t) list->sizes[frame];
+            if (position + frame_size > (size_t) n || crc32c(buffer + position, frame_size) != list->checksums[frame]) {
+                report_corrupted(verifier, frame);
+                free(buffer);
+                return NULL;
+            }
+            position += frame_size;
+        }
+    }
+
+    free(buffer);
+    return NULL;
+}
+
+int verify_run(const char *xtc_file, int n_threads)
+{
+    checksum_list_t list = {0};
+    if (checksum_list_read(xtc_file, &list) != 0) return 1;
+
+    verifier_t verifier = {0};
+    verifier.list = &list;
+    verifier.first_corrupted = SIZE_MAX;
+
+    verifier.fd = open(xtc_file, O_RDONLY);
+    struct stat info;
+    if (verifier.fd < 0 || fstat(verifier.fd, &info) != 0) {
+        fprintf(stderr, "File %s could not be read.\n", xtc_file);
+        if (verifier.fd >= 0) close(verifier.fd);
+        checksum_list_free(&list);
+        return 1;
+    }
+
+    verify_worker_t *workers = calloc((size_t) n_threads, sizeof(verify_worker_t));
+    if (workers == NULL) {
+        fprintf(stderr, "Could not allocate memory for verification.\n");
+        close(verifier.fd);
+        checksum_list_free(&list);
+        return 1;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_mutex_init(&verifier.lock, NULL);
+
+    // every worker gets frames of roughly the same total size
+    const uint64_t total = list.n_frames > 0 ? list.offsets[list.n_frames - 1] + list.sizes[list.n_frames - 1] : 0;
+    size_t frame = 0;
+    int n_started = 0;
+    for (int i = 0; i < n_threads; ++i) {
+        const uint64_t limit = i == n_threads - 1 ? UINT64_MAX : total / (uint64_t) n_threads * (uint64_t) (i + 1);
+        workers[i].verifier = &verifier;
+        workers[i].first = frame;
+        while (frame < list.n_frames && list.offsets[frame] < limit) ++frame;
+        workers[i].last = frame;
+
+        if (pthread_create(&workers[i].thread, NULL, run_verifier, &workers[i]) != 0) {
+            fprintf(stderr, "Could not start verification thread %d.\n", i);
+            pthread_mutex_lock(&verifier.lock);
+            verifier.error = 1;
+            pthread_mutex_unlock(&verifier.lock);
+            break;
+        }
+        ++n_started;
+    }
+
+    for (int i = 0; i < n_started; ++i) {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double elapsed = (double) (end.tv_sec - start.tv_sec) + (double) (end.tv_nsec - start.tv_nsec) * 1e-9;
+
+    int result = 0;
+    if (verifier.error) {
+        result = 1;
+    } else if (verifier.first_corrupted != SIZE_MAX) {
+        fprintf(stderr, "Frame %zu of %s (offset %" PRIu64 ") is corrupted.\n",
+                verifier.first_corrupted, xtc_file, list.offsets[verifier.first_corrupted]);
+        result = 1;
+    } else if ((uint64_t) info.st_size != total) {
+        fprintf(stderr, "File %s contains %" PRIu64 " bytes following the last frame (offset %" PRIu64 ").\n",
+                xtc_file, (uint64_t) info.st_size - total, total);
+        result = 1;
+    } else {
+        printf("All %zu frames of %s are intact (%.1f MB/s).\n", list.n_frames, xtc_file,
+                elapsed > 0 ? (double) total / elapsed / 1e6 : 0.0);
+    }
+
+    pthread_mutex_destroy(&verifier.lock);
+    free(workers);
+    close(verifier.fd);
+    checksum_list_free(&list);
+    return result;
+}
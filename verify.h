@@ -0,0 +1,14 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef VERIFY_H
+#define VERIFY_H
+
+/*
+ * Checks every frame of xtc_file against the checksums stored in its sidecar (xtc_file.crc)
+ * using n_threads threads. Reports the first corrupted frame and its offset.
+ * Returns zero, if all frames are intact. Else returns non-zero.
+ */
+int verify_run(const char *xtc_file, int n_threads);
+
+#endif /* VERIFY_H */
@@ -0,0 +1,1169 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+// Reading and writing of xtc frames.
+// The coordinate compression follows the xdr3dfcoord algorithm of the xdrfile library
+// so that the produced trajectories are identical to those written by Gromacs.
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "xtc.h"
+
+static const int magicints[] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0,
+    8, 10, 12, 16, 20, 25, 32, 40, 50, 64,
+    80, 101, 128, 161, 203, 256, 322, 406, 512, 645,
+    812, 1024, 1290, 1625, 2048, 2580, 3250, 4096, 5060, 6501,
+    8192, 10321, 13003, 16384, 20642, 26007, 32768, 41285, 52015, 65536,
+    82570, 104031, 131072, 165140, 208063, 262144, 330280, 416127, 524287, 660561,
+    832255, 1048576, 1321122, 1664510, 2097152, 2642245, 3329021, 4194304, 5284491, 6658042,
+    8388607, 10568983, 13316085, 16777216 };
+
+#define FIRSTIDX 9
+#define LASTIDX ((int) (sizeof(magicints) / sizeof(*magicints)))
+// scaled coordinates must not exceed this value
+#define MAXABS (INT_MAX - 2)
+
+// maximal number of bytes consumed or produced while processing one run of atoms
+static const size_t RUN_BYTES = 96;
+
+static inline uint32_t get_u32(const unsigned char *data)
+{
+    return ((uint32_t) data[0] << 24) | ((uint32_t) data[1] << 16) | ((uint32_t) data[2] << 8) | (uint32_t) data[3];
+}
+
+static inline int get_int(const unsigned char *data)
+{
+    return (int) get_u32(data);
+}
+
+static inline float get_float(const unsigned char *data)
+{
+    uint32_t bits = get_u32(data);
+    float value = 0.0f;
+    memcpy(&value, &bits, sizeof(float));
+    return value;
+}
+
+static inline void put_u32(unsigned char *data, uint32_t value)
+{
+    data[0] = (unsigned char) (value >> 24);
+    data[1] = (unsigned char) (value >> 16);
+    data[2] = (unsigned char) (value >> 8);
+    data[3] = (unsigned char) value;
+}
+
+static inline void put_int(unsigned char *data, int value)
+{
+    put_u32(data, (uint32_t) value);
+}
+
+static inline void put_float(unsigned char *data, float value)
+{
+    uint32_t bits = 0;
+    memcpy(&bits, &value, sizeof(float));
+    put_u32(data, bits);
+}
+
+size_t xtc_header_size(int n_atoms)
+{
+    return n_atoms <= XTC_MAX_UNCOMPRESSED ? XTC_SMALL_HEADER_SIZE : XTC_HEADER_SIZE;
+}
+
+int xtc_peek_atoms(const unsigned char *data)
+{
+    return get_int(data + 4);
+}
+
+int xtc_parse_header(const unsigned char *data, xtc_header_t *header)
+{
+    if (get_int(data) != XTC_MAGIC) return 1;
+
+    header->n_atoms = get_int(data + 4);
+    header->step = get_int(data + 8);
+    header->time = get_float(data + 12);
+    for (int i = 0; i < 9; ++i) {
+        header->box[i / 3][i % 3] = get_float(data + 16 + 4 * i);
+    }
+
+    if (header->n_atoms < 0 || get_int(data + 52) != header->n_atoms) return 1;
+
+    if (header->n_atoms <= XTC_MAX_UNCOMPRESSED) {
+        header->precision = -1.0f;
+        header->smallidx = 0;
+        header->n_bytes = 4 * 3 * header->n_atoms;
+        return 0;
+    }
+
+    header->precision = get_float(data + 56);
+    for (int dim = 0; dim < 3; ++dim) {
+        header->minint[dim] = get_int(data + 60 + 4 * dim);
+        header->maxint[dim] = get_int(data + 72 + 4 * dim);
+    }
+    header->smallidx = get_int(data + 84);
+    header->n_bytes = get_int(data + 88);
+
+    if (header->smallidx < FIRSTIDX || header->smallidx >= LASTIDX) return 1;
+    if (header->n_bytes < 0 || (size_t) header->n_bytes > xtc_frame_bound(header->n_atoms)) return 1;
+    for (int dim = 0; dim < 3; ++dim) {
+        if (header->maxint[dim] < header->minint[dim]) return 1;
+    }
+
+    return 0;
+}
+
+size_t xtc_frame_size(const xtc_header_t *header)
+{
+    return xtc_header_size(header->n_atoms) + (((size_t) header->n_bytes + 3) & ~(size_t) 3);
+}
+
+size_t xtc_frame_bound(int n_atoms)
+{
+    // every atom takes at most 96 bits for coordinates and 6 bits for the run-length flag
+    return XTC_HEADER_SIZE + 13 * (size_t) n_atoms + RUN_BYTES;
+}
+
+/*
+ * Returns the number of bits needed to store an integer with the given size.
+ */
+static int sizeofint(const unsigned int size)
+{
+    unsigned int num = 1;
+    int num_of_bits = 0;
+
+    while (size >= num && num_of_bits < 32) {
+        num_of_bits++;
+        num <<= 1;
+    }
+
+    return num_of_bits;
+}
+
+/*
+ * Returns the number of bits needed to store three integers with the given sizes as one number.
+ */
+static int sizeofints(const unsigned int sizes[3])
+{
+    unsigned int bytes[32] = {0};
+    unsigned int num_of_bytes = 1, num_of_bits = 0;
+    bytes[0] = 1;
+
+    for (int i = 0; i < 3; ++i) {
+        unsigned int tmp = 0, bytecnt = 0;
+        for (bytecnt = 0; bytecnt < num_of_bytes; ++bytecnt) {
+            tmp = bytes[bytecnt] * sizes[i] + tmp;
+            bytes[bytecnt] = tmp & 0xff;
+            tmp >>= 8;
+        }
+        while (tmp != 0) {
+            bytes[bytecnt++] = tmp & 0xff;
+            tmp >>= 8;
+        }
+        num_of_bytes = bytecnt;
+    }
+
+    unsigned int num = 1;
+    num_of_bytes--;
+    while (bytes[num_of_bytes] >= num) {
+        num_of_bits++;
+        num *= 2;
+    }
+
+    return num_of_bits + num_of_bytes * 8;
+}
+
+/* state of the bit stream used for compressed coordinates */
+typedef struct bitstream {
+    unsigned char *data;
+    size_t count;
+    unsigned int lastbits;
+    unsigned int lastbyte;
+} bitstream_t;
+
+static void sendbits(bitstream_t *stream, int num_of_bits, unsigned int num)
+{
+    while (num_of_bits >= 8) {
+        stream->lastbyte = (stream->lastbyte << 8) | (num >> (num_of_bits - 8));
+        stream->data[stream->count++] = (unsigned char) (stream->lastbyte >> stream->lastbits);
+        num_of_bits -= 8;
+    }
+
+    if (num_of_bits > 0) {
+        stream->lastbyte = (stream->lastbyte << num_of_bits) | num;
+        stream->lastbits += num_of_bits;
+        if (stream->lastbits >= 8) {
+            stream->lastbits -= 8;
+            stream->data[stream->count++] = (unsigned char) (stream->lastbyte >> stream->lastbits);
+        }
+    }
+
+    if (stream->lastbits > 0) {
+        stream->data[stream->count] = (unsigned char) (stream->lastbyte << (8 - stream->lastbits));
+    }
+}
+
+/*
+ * Combines three integers with the given sizes into one number stored as bytes in little-endian order.
+ * Returns the number of bytes.
+ */
+static int pack_bytes(const unsigned int sizes[3], const unsigned int nums[3], unsigned int bytes[32])
+{
+    int num_of_bytes = 0;
+    unsigned int tmp = nums[0];
+
+    do {
+        bytes[num_of_bytes++] = tmp & 0xff;
+        tmp >>= 8;
+    } while (tmp != 0);
+
+    for (int i = 1; i < 3; ++i) {
+        int bytecnt = 0;
+        tmp = nums[i];
+        for (bytecnt = 0; bytecnt < num_of_bytes; ++bytecnt) {
+            tmp = bytes[bytecnt] * sizes[i] + tmp;
+            bytes[bytecnt] = tmp & 0xff;
+            tmp >>= 8;
+        }
+        while (tmp != 0) {
+            bytes[bytecnt++] = tmp & 0xff;
+            tmp >>= 8;
+        }
+        num_of_bytes = bytecnt;
+    }
+
+    return num_of_bytes;
+}
+
+static void sendints(bitstream_t *stream, const int num_of_bits, const unsigned int sizes[3], const unsigned int nums[3])
+{
+    unsigned int bytes[32] = {0};
+    const int num_of_bytes = pack_bytes(sizes, nums, bytes);
+
+    if (num_of_bits >= num_of_bytes * 8) {
+        for (int i = 0; i < num_of_bytes; ++i) {
+            sendbits(stream, 8, bytes[i]);
+        }
+        sendbits(stream, num_of_bits - num_of_bytes * 8, 0);
+    } else {
+        for (int i = 0; i < num_of_bytes - 1; ++i) {
+            sendbits(stream, 8, bytes[i]);
+        }
+        sendbits(stream, num_of_bits - (num_of_bytes - 1) * 8, bytes[num_of_bytes - 1]);
+    }
+}
+
+static unsigned int receivebits(bitstream_t *stream, int num_of_bits)
+{
+    const unsigned int mask = num_of_bits >= 32 ? 0xffffffffu : (1u << num_of_bits) - 1;
+    unsigned int num = 0;
+
+    while (num_of_bits >= 8) {
+        stream->lastbyte = (stream->lastbyte << 8) | stream->data[stream->count++];
+        num |= (stream->lastbyte >> stream->lastbits) << (num_of_bits - 8);
+        num_of_bits -= 8;
+    }
+
+    if (num_of_bits > 0) {
+        if (stream->lastbits < (unsigned int) num_of_bits) {
+            stream->lastbits += 8;
+            stream->lastbyte = (stream->lastbyte << 8) | stream->data[stream->count++];
+        }
+        stream->lastbits -= num_of_bits;
+        num |= (stream->lastbyte >> stream->lastbits) & ((1u << num_of_bits) - 1);
+    }
+
+    return num & mask;
+}
+
+/*
+ * Splits a number stored as num_of_bytes bytes in little-endian order into three integers with the given sizes.
+ * bytes must have space for at least 4 items.
+ */
+static void unpack_bytes(unsigned int bytes[], int num_of_bytes, const unsigned int sizes[3], int nums[3])
+{
+    for (int i = 2; i > 0; --i) {
+        unsigned int num = 0;
+        for (int j = num_of_bytes - 1; j >= 0; --j) {
+            num = (num << 8) | bytes[j];
+            unsigned int p = num / sizes[i];
+            bytes[j] = p;
+            num = num - p * sizes[i];
+        }
+        nums[i] = (int) num;
+    }
+
+    nums[0] = (int) (bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (bytes[3] << 24));
+}
+
+static void receiveints(bitstream_t *stream, int num_of_bits, const unsigned int sizes[3], int nums[3])
+{
+    unsigned int bytes[32] = {0};
+    int num_of_bytes = 0;
+
+    while (num_of_bits > 8) {
+        bytes[num_of_bytes++] = receivebits(stream, 8);
+        num_of_bits -= 8;
+    }
+    if (num_of_bits > 0) {
+        bytes[num_of_bytes++] = receivebits(stream, num_of_bits);
+    }
+
+    unpack_bytes(bytes, num_of_bytes, sizes, nums);
+}
+
+/*
+ * Computes sizes of the coordinate ranges and the number of bits needed to store them.
+ * Sets bitsize to zero, if the coordinates must be stored as three separate integers.
+ */
+static void coordinate_sizes(const int minint[3], const int maxint[3], unsigned int sizeint[3], int bitsizeint[3], int *bitsize)
+{
+    for (int dim = 0; dim < 3; ++dim) {
+        sizeint[dim] = (unsigned int) maxint[dim] - (unsigned int) minint[dim] + 1;
+        bitsizeint[dim] = 0;
+    }
+
+    // check if one of the sizes is too big to be multiplied
+    if ((sizeint[0] | sizeint[1] | sizeint[2]) > 0xffffff) {
+        for (int dim = 0; dim < 3; ++dim) bitsizeint[dim] = sizeofint(sizeint[dim]);
+        *bitsize = 0;
+    } else {
+        *bitsize = sizeofints(sizeint);
+    }
+}
+
+int xtc_decode(const unsigned char *frame, const xtc_header_t *header, float *coords, int *work)
+{
+    const int n_atoms = header->n_atoms;
+
+    if (n_atoms <= XTC_MAX_UNCOMPRESSED) {
+        for (int i = 0; i < 3 * n_atoms; ++i) {
+            coords[i] = get_float(frame + XTC_SMALL_HEADER_SIZE + 4 * i);
+        }
+        return 0;
+    }
+
+    unsigned int sizeint[3] = {0}, sizesmall[3] = {0};
+    int bitsizeint[3] = {0}, bitsize = 0;
+    coordinate_sizes(header->minint, header->maxint, sizeint, bitsizeint, &bitsize);
+
+    int smallidx = header->smallidx;
+    int smaller = magicints[smallidx - 1 > FIRSTIDX ? smallidx - 1 : FIRSTIDX] / 2;
+    int smallnum = magicints[smallidx] / 2;
+    sizesmall[0] = sizesmall[1] = sizesmall[2] = magicints[smallidx];
+
+    bitstream_t stream = { (unsigned char *) frame + XTC_HEADER_SIZE, 0, 0, 0 };
+    const float inv_precision = 1.0 / header->precision;
+    float *lfp = coords;
+    int prevcoord[3] = {0};
+    int run = 0;
+
+    int i = 0;
+    while (i < n_atoms) {
+        // the stream has been padded, so it is enough to check for overruns once per run
+        if (stream.count > (size_t) header->n_bytes) return 1;
+
+        int *thiscoord = work + i * 3;
+
+        if (bitsize == 0) {
+            thiscoord[0] = (int) receivebits(&stream, bitsizeint[0]);
+            thiscoord[1] = (int) receivebits(&stream, bitsizeint[1]);
+            thiscoord[2] = (int) receivebits(&stream, bitsizeint[2]);
+        } else {
+            receiveints(&stream, bitsize, sizeint, thiscoord);
+        }
+
+        i++;
+        thiscoord[0] += header->minint[0];
+        thiscoord[1] += header->minint[1];
+        thiscoord[2] += header->minint[2];
+
+        prevcoord[0] = thiscoord[0];
+        prevcoord[1] = thiscoord[1];
+        prevcoord[2] = thiscoord[2];
+
+        int is_smaller = 0;
+        if (receivebits(&stream, 1) == 1) {
+            run = (int) receivebits(&stream, 5);
+            is_smaller = run % 3;
+            run -= is_smaller;
+            is_smaller--;
+        }
+
+        if (i + run / 3 > n_atoms) return 1;
+
+        if (run > 0) {
+            thiscoord += 3;
+            for (int k = 0; k < run; k += 3) {
+                receiveints(&stream, smallidx, sizesmall, thiscoord);
+                i++;
+                thiscoord[0] += prevcoord[0] - smallnum;
+                thiscoord[1] += prevcoord[1] - smallnum;
+                thiscoord[2] += prevcoord[2] - smallnum;
+                if (k == 0) {
+                    // interchange first with second atom for better compression of water molecules
+                    int tmp = thiscoord[0]; thiscoord[0] = prevcoord[0]; prevcoord[0] = tmp;
+                    tmp = thiscoord[1]; thiscoord[1] = prevcoord[1]; prevcoord[1] = tmp;
+                    tmp = thiscoord[2]; thiscoord[2] = prevcoord[2]; prevcoord[2] = tmp;
+                    *lfp++ = prevcoord[0] * inv_precision;
+                    *lfp++ = prevcoord[1] * inv_precision;
+                    *lfp++ = prevcoord[2] * inv_precision;
+                } else {
+                    prevcoord[0] = thiscoord[0];
+                    prevcoord[1] = thiscoord[1];
+                    prevcoord[2] = thiscoord[2];
+                }
+                *lfp++ = thiscoord[0] * inv_precision;
+                *lfp++ = thiscoord[1] * inv_precision;
+                *lfp++ = thiscoord[2] * inv_precision;
+                thiscoord += 3;
+            }
+        } else {
+            *lfp++ = thiscoord[0] * inv_precision;
+            *lfp++ = thiscoord[1] * inv_precision;
+            *lfp++ = thiscoord[2] * inv_precision;
+        }
+
+        smallidx += is_smaller;
+        if (smallidx < FIRSTIDX || smallidx >= LASTIDX) return 1;
+
+        if (is_smaller < 0) {
+            smallnum = smaller;
+            smaller = smallidx > FIRSTIDX ? magicints[smallidx - 1] / 2 : 0;
+        } else if (is_smaller > 0) {
+            smaller = smallnum;
+            smallnum = magicints[smallidx] / 2;
+        }
+        sizesmall[0] = sizesmall[1] = sizesmall[2] = magicints[smallidx];
+    }
+
+    return stream.count > (size_t) header->n_bytes;
+}
+
+/* bit reader of the table-driven decoder */
+typedef struct bitreader {
+    const unsigned char *data;
+    size_t position;            // number of bits consumed so far
+} bitreader_t;
+
+/*
+ * Returns the next num_of_bits (1 to 57) bits of the stream.
+ * Eight bytes are loaded at once which is safe, because the frame is followed by padding.
+ */
+static inline uint64_t read_bits(bitreader_t *reader, int num_of_bits)
+{
+    uint64_t word = 0;
+    memcpy(&word, reader->data + (reader->position >> 3), sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    word <<= reader->position & 7;
+    reader->position += (size_t) num_of_bits;
+    return word >> (64 - num_of_bits);
+}
+
+/*
+ * Reads a number written by sendints using 9 to 32 bits.
+ * The number is stored as bytes in little-endian order, the last byte may be incomplete.
+ */
+static inline uint32_t read_packed32(bitreader_t *reader, int num_of_bits)
+{
+    const int n_full = (num_of_bits - 1) >> 3;
+    const int rest = num_of_bits - 8 * n_full;
+    const uint32_t bits = (uint32_t) read_bits(reader, num_of_bits);
+    const uint32_t full = __builtin_bswap32((bits >> rest) << (32 - 8 * n_full));
+    return full | ((bits & ((1u << rest) - 1)) << (8 * n_full));
+}
+
+/*
+ * Reads a number written by sendints using 1 to 64 bits.
+ */
+static inline uint64_t read_packed64(bitreader_t *reader, int num_of_bits)
+{
+    const int n_full = (num_of_bits - 1) >> 3;
+    const int rest = num_of_bits - 8 * n_full;
+    uint64_t full = 0;
+    if (n_full > 0) full = __builtin_bswap64(read_bits(reader, 8 * n_full) << (64 - 8 * n_full));
+    return full | (read_bits(reader, rest) << (8 * n_full));
+}
+
+/*
+ * Reads three integers with the given sizes written by sendints using num_of_bits bits.
+ */
+static void read_ints(bitreader_t *reader, int num_of_bits, const unsigned int sizes[3], int nums[3])
+{
+    if (num_of_bits <= 64) {
+        const uint64_t packed = read_packed64(reader, num_of_bits);
+        const uint64_t rest = packed / sizes[2];
+        nums[2] = (int) (packed - rest * sizes[2]);
+        nums[1] = (int) (rest % sizes[1]);
+        nums[0] = (int) (uint32_t) (rest / sizes[1]);
+        return;
+    }
+
+    unsigned int bytes[32] = {0};
+    int num_of_bytes = 0;
+    while (num_of_bits > 8) {
+        bytes[num_of_bytes++] = (unsigned int) read_bits(reader, 8);
+        num_of_bits -= 8;
+    }
+    bytes[num_of_bytes++] = (unsigned int) read_bits(reader, num_of_bits);
+
+    unpack_bytes(bytes, num_of_bytes, sizes, nums);
+}
+
+/*
+ * Splits a number into three integers of the same size.
+ * When inlined with a constant size, the divisions are turned into multiplications.
+ */
+static inline void split_small(uint32_t packed, const uint32_t size, int nums[3])
+{
+    const uint32_t rest = packed / size;
+    nums[2] = (int) (packed - rest * size);
+    nums[1] = (int) (rest % size);
+    nums[0] = (int) (rest / size);
+}
+
+// coordinates of runs with smallidx up to 32 fit into 32 bits and are split using constant sizes
+#define SMALL_CASE(idx) case idx: split_small(read_packed32(reader, idx), (uint32_t) magicints[idx], nums); return;
+
+/*
+ * Reads coordinates of an atom of a run encoded with smallidx.
+ */
+static inline void read_small(bitreader_t *reader, int smallidx, int nums[3])
+{
+    switch (smallidx) {
+        SMALL_CASE(9)  SMALL_CASE(10) SMALL_CASE(11) SMALL_CASE(12) SMALL_CASE(13) SMALL_CASE(14)
+        SMALL_CASE(15) SMALL_CASE(16) SMALL_CASE(17) SMALL_CASE(18) SMALL_CASE(19) SMALL_CASE(20)
+        SMALL_CASE(21) SMALL_CASE(22) SMALL_CASE(23) SMALL_CASE(24) SMALL_CASE(25) SMALL_CASE(26)
+        SMALL_CASE(27) SMALL_CASE(28) SMALL_CASE(29) SMALL_CASE(30) SMALL_CASE(31) SMALL_CASE(32)
+        default: {
+            const unsigned int sizes[3] = { magicints[smallidx], magicints[smallidx], magicints[smallidx] };
+            read_ints(reader, smallidx, sizes, nums);
+        }
+    }
+}
+
+#undef SMALL_CASE
+
+int xtc_decode_quantized(const unsigned char *frame, const xtc_header_t *header, int *x, int *y, int *z)
+{
+    return xtc_decode_prefix(frame, header, header->n_atoms, x, y, z);
+}
+
+int xtc_decode_prefix(const unsigned char *frame, const xtc_header_t *header, int n_decode, int *x, int *y, int *z)
+{
+    const int n_atoms = header->n_atoms;
+    if (n_atoms <= XTC_MAX_UNCOMPRESSED) return 1;
+
+    unsigned int sizeint[3] = {0};
+    int bitsizeint[3] = {0}, bitsize = 0;
+    coordinate_sizes(header->minint, header->maxint, sizeint, bitsizeint, &bitsize);
+
+    int smallidx = header->smallidx;
+    int smaller = magicints[smallidx - 1 > FIRSTIDX ? smallidx - 1 : FIRSTIDX] / 2;
+    int smallnum = magicints[smallidx] / 2;
+
+    bitreader_t reader = { frame + XTC_HEADER_SIZE, 0 };
+    const size_t limit = 8 * (size_t) header->n_bytes;
+    unsigned int prevcoord[3] = {0};
+    int run = 0;
+    int out = 0;
+
+    int i = 0;
+    while (i < n_atoms && out < n_decode) {
+        // the stream has been padded, so it is enough to check for overruns once per run
+        if (reader.position > limit) return 1;
+
+        int coord[3] = {0};
+        if (bitsize == 0) {
+            for (int dim = 0; dim < 3; ++dim) {
+                coord[dim] = bitsizeint[dim] > 0 ? (int) read_bits(&reader, bitsizeint[dim]) : 0;
+            }
+        } else {
+            read_ints(&reader, bitsize, sizeint, coord);
+        }
+
+        i++;
+        // coordinates are summed with wrap-around just like in the reference implementation
+        for (int dim = 0; dim < 3; ++dim) {
+            prevcoord[dim] = (unsigned int) coord[dim] + (unsigned int) header->minint[dim];
+        }
+
+        int is_smaller = 0;
+        if (read_bits(&reader, 1) == 1) {
+            run = (int) read_bits(&reader, 5);
+            is_smaller = run % 3;
+            run -= is_smaller;
+            is_smaller--;
+        }
+
+        if (i + run / 3 > n_atoms) return 1;
+
+        if (run > 0) {
+            for (int k = 0; k < run; k += 3) {
+                int small[3] = {0};
+                read_small(&reader, smallidx, small);
+                i++;
+
+                unsigned int thiscoord[3] = {0};
+                for (int dim = 0; dim < 3; ++dim) {
+                    thiscoord[dim] = (unsigned int) small[dim] + prevcoord[dim] - (unsigned int) smallnum;
+                }
+
+                if (k == 0) {
+                    // the first atom of the run has been interchanged with the second one
+                    x[out] = (int) thiscoord[0];
+                    y[out] = (int) thiscoord[1];
+                    z[out] = (int) thiscoord[2];
+                    out++;
+                    x[out] = (int) prevcoord[0];
+                    y[out] = (int) prevcoord[1];
+                    z[out] = (int) prevcoord[2];
+                } else {
+                    x[out] = (int) thiscoord[0];
+                    y[out] = (int) thiscoord[1];
+                    z[out] = (int) thiscoord[2];
+                }
+                out++;
+
+                prevcoord[0] = thiscoord[0];
+                prevcoord[1] = thiscoord[1];
+                prevcoord[2] = thiscoord[2];
+            }
+        } else {
+            x[out] = (int) prevcoord[0];
+            y[out] = (int) prevcoord[1];
+            z[out] = (int) prevcoord[2];
+            out++;
+        }
+
+        smallidx += is_smaller;
+        if (smallidx < FIRSTIDX || smallidx >= LASTIDX) return 1;
+
+        if (is_smaller < 0) {
+            smallnum = smaller;
+            smaller = smallidx > FIRSTIDX ? magicints[smallidx - 1] / 2 : 0;
+        } else if (is_smaller > 0) {
+            smaller = smallnum;
+            smallnum = magicints[smallidx] / 2;
+        }
+    }
+
+    return reader.position > limit;
+}
+
+void xtc_dequantize(const xtc_header_t *header, const int *x, const int *y, const int *z, float *coords)
+{
+    const float inv_precision = 1.0 / header->precision;
+    for (int i = 0; i < header->n_atoms; ++i) {
+        coords[3 * i] = x[i] * inv_precision;
+        coords[3 * i + 1] = y[i] * inv_precision;
+        coords[3 * i + 2] = z[i] * inv_precision;
+    }
+}
+
+/*
+ * Writes the frame header into output.
+ */
+static void write_header(unsigned char *output, const xtc_header_t *header)
+{
+    put_int(output, XTC_MAGIC);
+    put_int(output + 4, header->n_atoms);
+    put_int(output + 8, header->step);
+    put_float(output + 12, header->time);
+    for (int i = 0; i < 9; ++i) {
+        put_float(output + 16 + 4 * i, header->box[i / 3][i % 3]);
+    }
+    put_int(output + 52, header->n_atoms);
+}
+
+size_t xtc_encode(unsigned char *output, size_t capacity, const xtc_header_t *header, const float *coords, int *work)
+{
+    const int n_atoms = header->n_atoms;
+    const float precision = header->precision;
+
+    if (capacity < xtc_frame_bound(n_atoms)) return 0;
+
+    write_header(output, header);
+
+    if (n_atoms <= XTC_MAX_UNCOMPRESSED) {
+        for (int i = 0; i < 3 * n_atoms; ++i) {
+            put_float(output + XTC_SMALL_HEADER_SIZE + 4 * i, coords[i]);
+        }
+        return XTC_SMALL_HEADER_SIZE + 12 * (size_t) n_atoms;
+    }
+
+    int minint[3] = { INT_MAX, INT_MAX, INT_MAX };
+    int maxint[3] = { INT_MIN, INT_MIN, INT_MIN };
+    int mindiff = INT_MAX;
+    int oldlint[3] = {0};
+
+    // convert the coordinates into integers
+    for (int i = 0; i < n_atoms; ++i) {
+        int lint[3] = {0};
+        for (int dim = 0; dim < 3; ++dim) {
+            float lf = 0.0f;
+            if (coords[3 * i + dim] >= 0.0) lf = coords[3 * i + dim] * precision + 0.5;
+            else lf = coords[3 * i + dim] * precision - 0.5;
+
+            // scaling would cause overflow
+            if (fabs(lf) > MAXABS) return 0;
+
+            lint[dim] = (int) lf;
+            if (lint[dim] < minint[dim]) minint[dim] = lint[dim];
+            if (lint[dim] > maxint[dim]) maxint[dim] = lint[dim];
+            work[3 * i + dim] = lint[dim];
+        }
+
+        int diff = abs(oldlint[0] - lint[0]) + abs(oldlint[1] - lint[1]) + abs(oldlint[2] - lint[2]);
+        if (diff < mindiff && i > 0) mindiff = diff;
+        oldlint[0] = lint[0];
+        oldlint[1] = lint[1];
+        oldlint[2] = lint[2];
+    }
+
+    // turning values into unsigned integers by subtracting minint would cause overflow
+    for (int dim = 0; dim < 3; ++dim) {
+        if ((float) maxint[dim] - (float) minint[dim] >= MAXABS) return 0;
+    }
+
+    unsigned int sizeint[3] = {0}, sizesmall[3] = {0};
+    int bitsizeint[3] = {0}, bitsize = 0;
+    coordinate_sizes(minint, maxint, sizeint, bitsizeint, &bitsize);
+
+    int smallidx = FIRSTIDX;
+    while (smallidx < LASTIDX && magicints[smallidx] < mindiff) {
+        smallidx++;
+    }
+
+    const int maxidx = smallidx + 8 < LASTIDX ? smallidx + 8 : LASTIDX;
+    const int minidx = maxidx - 8;
+    int smaller = magicints[smallidx - 1 > FIRSTIDX ? smallidx - 1 : FIRSTIDX] / 2;
+    int smallnum = magicints[smallidx] / 2;
+    sizesmall[0] = sizesmall[1] = sizesmall[2] = magicints[smallidx];
+    const int larger = magicints[maxidx] / 2;
+
+    put_float(output + 56, precision);
+    for (int dim = 0; dim < 3; ++dim) {
+        put_int(output + 60 + 4 * dim, minint[dim]);
+        put_int(output + 72 + 4 * dim, maxint[dim]);
+    }
+    put_int(output + 84, smallidx);
+
+    bitstream_t stream = { output + XTC_HEADER_SIZE, 0, 0, 0 };
+    unsigned int tmpcoord[30] = {0};
+    int prevcoord[3] = {0};
+    int prevrun = -1;
+
+    int i = 0;
+    while (i < n_atoms) {
+        int is_small = 0, is_smaller = 0;
+        int *thiscoord = work + i * 3;
+
+        if (smallidx < maxidx && i >= 1 &&
+                abs(thiscoord[0] - prevcoord[0]) < larger &&
+                abs(thiscoord[1] - prevcoord[1]) < larger &&
+                abs(thiscoord[2] - prevcoord[2]) < larger) {
+            is_smaller = 1;
+        } else if (smallidx > minidx) {
+            is_smaller = -1;
+        } else {
+            is_smaller = 0;
+        }
+
+        if (i + 1 < n_atoms) {
+            if (abs(thiscoord[0] - thiscoord[3]) < smallnum &&
+                    abs(thiscoord[1] - thiscoord[4]) < smallnum &&
+                    abs(thiscoord[2] - thiscoord[5]) < smallnum) {
+                // interchange first with second atom for better compression of water molecules
+                int tmp = thiscoord[0]; thiscoord[0] = thiscoord[3]; thiscoord[3] = tmp;
+                tmp = thiscoord[1]; thiscoord[1] = thiscoord[4]; thiscoord[4] = tmp;
+                tmp = thiscoord[2]; thiscoord[2] = thiscoord[5]; thiscoord[5] = tmp;
+                is_small = 1;
+            }
+        }
+
+        tmpcoord[0] = (unsigned int) (thiscoord[0] - minint[0]);
+        tmpcoord[1] = (unsigned int) (thiscoord[1] - minint[1]);
+        tmpcoord[2] = (unsigned int) (thiscoord[2] - minint[2]);
+        if (bitsize == 0) {
+            sendbits(&stream, bitsizeint[0], tmpcoord[0]);
+            sendbits(&stream, bitsizeint[1], tmpcoord[1]);
+            sendbits(&stream, bitsizeint[2], tmpcoord[2]);
+        } else {
+            sendints(&stream, bitsize, sizeint, tmpcoord);
+        }
+
+        prevcoord[0] = thiscoord[0];
+        prevcoord[1] = thiscoord[1];
+        prevcoord[2] = thiscoord[2];
+        thiscoord += 3;
+        i++;
+
+        int run = 0;
+        if (is_small == 0 && is_smaller == -1) is_smaller = 0;
+
+        while (is_small && run < 8 * 3) {
+            const int dx = thiscoord[0] - prevcoord[0];
+            const int dy = thiscoord[1] - prevcoord[1];
+            const int dz = thiscoord[2] - prevcoord[2];
+            // squares are summed with wrap-around just like in the reference implementation
+            const int distance = (int) ((unsigned int) dx * (unsigned int) dx + (unsigned int) dy * (unsigned int) dy + (unsigned int) dz * (unsigned int) dz);
+            if (is_smaller == -1 && distance >= (int) ((unsigned int) smaller * (unsigned int) smaller)) {
+                is_smaller = 0;
+            }
+
+            tmpcoord[run++] = (unsigned int) (dx + smallnum);
+            tmpcoord[run++] = (unsigned int) (dy + smallnum);
+            tmpcoord[run++] = (unsigned int) (dz + smallnum);
+
+            prevcoord[0] = thiscoord[0];
+            prevcoord[1] = thiscoord[1];
+            prevcoord[2] = thiscoord[2];
+
+            i++;
+            thiscoord += 3;
+            is_small = 0;
+            if (i < n_atoms &&
+                    abs(thiscoord[0] - prevcoord[0]) < smallnum &&
+                    abs(thiscoord[1] - prevcoord[1]) < smallnum &&
+                    abs(thiscoord[2] - prevcoord[2]) < smallnum) {
+                is_small = 1;
+            }
+        }
+
+        if (run != prevrun || is_smaller != 0) {
+            prevrun = run;
+            // flag the change in run-length
+            sendbits(&stream, 1, 1);
+            sendbits(&stream, 5, (unsigned int) (run + is_smaller + 1));
+        } else {
+            // flag the fact that run-length did not change
+            sendbits(&stream, 1, 0);
+        }
+
+        for (int k = 0; k < run; k += 3) {
+            sendints(&stream, smallidx, sizesmall, &tmpcoord[k]);
+        }
+
+        if (is_smaller != 0) {
+            smallidx += is_smaller;
+            if (is_smaller < 0) {
+                smallnum = smaller;
+                smaller = smallidx > FIRSTIDX ? magicints[smallidx - 1] / 2 : 0;
+            } else {
+                smaller = smallnum;
+                smallnum = magicints[smallidx] / 2;
+            }
+            sizesmall[0] = sizesmall[1] = sizesmall[2] = magicints[smallidx];
+        }
+    }
+
+    if (stream.lastbits != 0) stream.count++;
+
+    // the compressed block is padded to a multiple of four bytes
+    put_int(output + 88, (int) stream.count);
+    size_t padded = (stream.count + 3) & ~(size_t) 3;
+    memset(output + XTC_HEADER_SIZE + stream.count, 0, padded - stream.count);
+
+    return XTC_HEADER_SIZE + padded;
+}
+
+/* bit writer of the table-driven encoder */
+typedef struct bitwriter {
+    unsigned char *data;
+    size_t count;               // number of complete bytes written so far
+    uint64_t buffer;            // pending bits are kept in the lowest bits
+    int bits;                   // number of pending bits
+} bitwriter_t;
+
+/*
+ * Appends num_of_bits (0 to 32) lowest bits of value to the stream. value must not have any higher bits set.
+ * Pending bits are written out four bytes at a time.
+ */
+static inline void write_bits(bitwriter_t *writer, int num_of_bits, uint32_t value)
+{
+    writer->buffer = (writer->buffer << num_of_bits) | value;
+    writer->bits += num_of_bits;
+    if (writer->bits >= 32) {
+        writer->bits -= 32;
+        put_u32(writer->data + writer->count, (uint32_t) (writer->buffer >> writer->bits));
+        writer->count += 4;
+    }
+}
+
+static inline void write_bits64(bitwriter_t *writer, int num_of_bits, uint64_t value)
+{
+    if (num_of_bits > 32) {
+        write_bits(writer, num_of_bits - 32, (uint32_t) (value >> 32));
+        write_bits(writer, 32, (uint32_t) value);
+    } else {
+        write_bits(writer, num_of_bits, (uint32_t) value);
+    }
+}
+
+/*
+ * Writes a number smaller than 2^num_of_bits (9 to 32 bits) the same way as sendints does,
+ * i.e. as bytes in little-endian order with an incomplete last byte.
+ */
+static inline void write_packed32(bitwriter_t *writer, int num_of_bits, uint32_t packed)
+{
+    const int n_full = (num_of_bits - 1) >> 3;
+    const int rest = num_of_bits - 8 * n_full;
+    const uint32_t full = __builtin_bswap32(packed) >> (32 - 8 * n_full);
+    write_bits(writer, num_of_bits, (full << rest) | (packed >> (8 * n_full)));
+}
+
+/*
+ * Writes a number smaller than 2^num_of_bits (1 to 64 bits) the same way as sendints does.
+ */
+static inline void write_packed64(bitwriter_t *writer, int num_of_bits, uint64_t packed)
+{
+    const int n_full = (num_of_bits - 1) >> 3;
+    const int rest = num_of_bits - 8 * n_full;
+    if (n_full > 0) write_bits64(writer, 8 * n_full, __builtin_bswap64(packed) >> (64 - 8 * n_full));
+    write_bits(writer, rest, (uint32_t) (packed >> (8 * n_full)));
+}
+
+/*
+ * Writes three integers with the given sizes as one number using num_of_bits bits.
+ */
+static void write_ints(bitwriter_t *writer, int num_of_bits, const unsigned int sizes[3], const unsigned int nums[3])
+{
+    if (num_of_bits <= 64) {
+        const uint64_t packed = ((uint64_t) nums[0] * sizes[1] + nums[1]) * sizes[2] + nums[2];
+        write_packed64(writer, num_of_bits, packed);
+        return;
+    }
+
+    unsigned int bytes[32] = {0};
+    const int num_of_bytes = pack_bytes(sizes, nums, bytes);
+
+    if (num_of_bits >= num_of_bytes * 8) {
+        for (int i = 0; i < num_of_bytes; ++i) {
+            write_bits(writer, 8, bytes[i]);
+        }
+        for (int zeros = num_of_bits - num_of_bytes * 8; zeros > 0; zeros -= 32) {
+            write_bits(writer, zeros < 32 ? zeros : 32, 0);
+        }
+    } else {
+        for (int i = 0; i < num_of_bytes - 1; ++i) {
+            write_bits(writer, 8, bytes[i]);
+        }
+        write_bits(writer, num_of_bits - (num_of_bytes - 1) * 8, bytes[num_of_bytes - 1]);
+    }
+}
+
+/*
+ * Writes coordinates of an atom of a run encoded with smallidx.
+ */
+static inline void write_small(bitwriter_t *writer, int smallidx, const unsigned int nums[3])
+{
+    const unsigned int size = (unsigned int) magicints[smallidx];
+    if (smallidx <= 32) {
+        // the cube of the size fits into 32 bits
+        write_packed32(writer, smallidx, (nums[0] * size + nums[1]) * size + nums[2]);
+    } else {
+        const unsigned int sizes[3] = { size, size, size };
+        write_ints(writer, smallidx, sizes, nums);
+    }
+}
+
+/*
+ * Writes out the pending bits, padding the last byte with zeros.
+ * Returns the total number of bytes written.
+ */
+static size_t finish_bits(bitwriter_t *writer)
+{
+    while (writer->bits >= 8) {
+        writer->bits -= 8;
+        writer->data[writer->count++] = (unsigned char) (writer->buffer >> writer->bits);
+    }
+    if (writer->bits > 0) {
+        writer->data[writer->count++] = (unsigned char) (writer->buffer << (8 - writer->bits));
+        writer->bits = 0;
+    }
+    return writer->count;
+}
+
+int xtc_quantize(const xtc_header_t *header, const float *coords, int *work)
+{
+    const float precision = header->precision;
+
+    for (int i = 0; i < 3 * header->n_atoms; ++i) {
+        float lf = 0.0f;
+        if (coords[i] >= 0.0) lf = coords[i] * precision + 0.5;
+        else lf = coords[i] * precision - 0.5;
+
+        // scaling would cause overflow
+        if (fabs(lf) > MAXABS) return 1;
+        work[i] = (int) lf;
+    }
+
+    return 0;
+}
+
+size_t xtc_encode_quantized(unsigned char *output, size_t capacity, const xtc_header_t *header, int *work)
+{
+    const int n_atoms = header->n_atoms;
+
+    if (n_atoms <= XTC_MAX_UNCOMPRESSED || capacity < xtc_frame_bound(n_atoms)) return 0;
+
+    int minint[3] = { INT_MAX, INT_MAX, INT_MAX };
+    int maxint[3] = { INT_MIN, INT_MIN, INT_MIN };
+    int mindiff = INT_MAX;
+
+    for (int i = 0; i < n_atoms; ++i) {
+        const int *lint = work + 3 * i;
+        for (int dim = 0; dim < 3; ++dim) {
+            if (lint[dim] < minint[dim]) minint[dim] = lint[dim];
+            if (lint[dim] > maxint[dim]) maxint[dim] = lint[dim];
+        }
+
+        if (i > 0) {
+            const int diff = abs(lint[-3] - lint[0]) + abs(lint[-2] - lint[1]) + abs(lint[-1] - lint[2]);
+            if (diff < mindiff) mindiff = diff;
+        }
+    }
+
+    // turning values into unsigned integers by subtracting minint would cause overflow
+    for (int dim = 0; dim < 3; ++dim) {
+        if ((float) maxint[dim] - (float) minint[dim] >= MAXABS) return 0;
+    }
+
+    write_header(output, header);
+
+    unsigned int sizeint[3] = {0};
+    int bitsizeint[3] = {0}, bitsize = 0;
+    coordinate_sizes(minint, maxint, sizeint, bitsizeint, &bitsize);
+
+    int smallidx = FIRSTIDX;
+    while (smallidx < LASTIDX && magicints[smallidx] < mindiff) {
+        smallidx++;
+    }
+
+    const int maxidx = smallidx + 8 < LASTIDX ? smallidx + 8 : LASTIDX;
+    const int minidx = maxidx - 8;
+    int smaller = magicints[smallidx - 1 > FIRSTIDX ? smallidx - 1 : FIRSTIDX] / 2;
+    int smallnum = magicints[smallidx] / 2;
+    const int larger = magicints[maxidx] / 2;
+
+    put_float(output + 56, header->precision);
+    for (int dim = 0; dim < 3; ++dim) {
+        put_int(output + 60 + 4 * dim, minint[dim]);
+        put_int(output + 72 + 4 * dim, maxint[dim]);
+    }
+    put_int(output + 84, smallidx);
+
+    bitwriter_t writer = { output + XTC_HEADER_SIZE, 0, 0, 0 };
+    unsigned int tmpcoord[30] = {0};
+    int prevcoord[3] = {0};
+    int prevrun = -1;
+
+    int i = 0;
+    while (i < n_atoms) {
+        int is_small = 0, is_smaller = 0;
+        int *thiscoord = work + i * 3;
+
+        if (smallidx < maxidx && i >= 1 &&
+                abs(thiscoord[0] - prevcoord[0]) < larger &&
+                abs(thiscoord[1] - prevcoord[1]) < larger &&
+                abs(thiscoord[2] - prevcoord[2]) < larger) {
+            is_smaller = 1;
+        } else if (smallidx > minidx) {
+            is_smaller = -1;
+        }
+
+        if (i + 1 < n_atoms &&
+                abs(thiscoord[0] - thiscoord[3]) < smallnum &&
+                abs(thiscoord[1] - thiscoord[4]) < smallnum &&
+                abs(thiscoord[2] - thiscoord[5]) < smallnum) {
+            // interchange first with second atom for better compression of water molecules
+            int tmp = thiscoord[0]; thiscoord[0] = thiscoord[3]; thiscoord[3] = tmp;
+            tmp = thiscoord[1]; thiscoord[1] = thiscoord[4]; thiscoord[4] = tmp;
+            tmp = thiscoord[2]; thiscoord[2] = thiscoord[5]; thiscoord[5] = tmp;
+            is_small = 1;
+        }
+
+        tmpcoord[0] = (unsigned int) thiscoord[0] - (unsigned int) minint[0];
+        tmpcoord[1] = (unsigned int) thiscoord[1] - (unsigned int) minint[1];
+        tmpcoord[2] = (unsigned int) thiscoord[2] - (unsigned int) minint[2];
+        if (bitsize == 0) {
+            write_bits(&writer, bitsizeint[0], tmpcoord[0]);
+            write_bits(&writer, bitsizeint[1], tmpcoord[1]);
+            write_bits(&writer, bitsizeint[2], tmpcoord[2]);
+        } else {
+            write_ints(&writer, bitsize, sizeint, tmpcoord);
+        }
+
+        prevcoord[0] = thiscoord[0];
+        prevcoord[1] = thiscoord[1];
+        prevcoord[2] = thiscoord[2];
+        thiscoord += 3;
+        i++;
+
+        int run = 0;
+        if (is_small == 0 && is_smaller == -1) is_smaller = 0;
+
+        while (is_small && run < 8 * 3) {
+            const int dx = thiscoord[0] - prevcoord[0];
+            const int dy = thiscoord[1] - prevcoord[1];
+            const int dz = thiscoord[2] - prevcoord[2];
+            // squares are summed with wrap-around just like in the reference implementation
+            const int distance = (int) ((unsigned int) dx * (unsigned int) dx + (unsigned int) dy * (unsigned int) dy + (unsigned int) dz * (unsigned int) dz);
+            if (is_smaller == -1 && distance >= (int) ((unsigned int) smaller * (unsigned int) smaller)) {
+                is_smaller = 0;
+            }
+
+            tmpcoord[run++] = (unsigned int) (dx + smallnum);
+            tmpcoord[run++] = (unsigned int) (dy + smallnum);
+            tmpcoord[run++] = (unsigned int) (dz + smallnum);
+
+            prevcoord[0] = thiscoord[0];
+            prevcoord[1] = thiscoord[1];
+            prevcoord[2] = thiscoord[2];
+
+            i++;
+            thiscoord += 3;
+            is_small = i < n_atoms &&
+                    abs(thiscoord[0] - prevcoord[0]) < smallnum &&
+                    abs(thiscoord[1] - prevcoord[1]) < smallnum &&
+                    abs(thiscoord[2] - prevcoord[2]) < smallnum;
+        }
+
+        if (run != prevrun || is_smaller != 0) {
+            prevrun = run;
+            // flag the change in run-length
+            write_bits(&writer, 6, 32 | (unsigned int) (run + is_smaller + 1));
+        } else {
+            // flag the fact that run-length did not change
+            write_bits(&writer, 1, 0);
+        }
+
+        for (int k = 0; k < run; k += 3) {
+            write_small(&writer, smallidx, &tmpcoord[k]);
+        }
+
+        if (is_smaller != 0) {
+            smallidx += is_smaller;
+            if (is_smaller < 0) {
+                smallnum = smaller;
+                smaller = smallidx > FIRSTIDX ? magicints[smallidx - 1] / 2 : 0;
+            } else {
+                smaller = smallnum;
+                smallnum = magicints[smallidx] / 2;
+            }
+        }
+    }
+
+    const size_t count = finish_bits(&writer);
+
+    // the compressed block is padded to a multiple of four bytes
+    put_int(output + 88, (int) count);
+    size_t padded = (count + 3) & ~(size_t) 3;
+    memset(output + XTC_HEADER_SIZE + count, 0, padded - count);
+
+    return XTC_HEADER_SIZE + padded;
+}
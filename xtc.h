@@ -0,0 +1,116 @@
+// Released under MIT License.
+// Copyright (c) 2022 Ladislav Bartos
+
+#ifndef XTC_H
+#define XTC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// magic number at the start of every xtc frame
+#define XTC_MAGIC 1995
+// systems with at most this number of atoms are stored without compression
+#define XTC_MAX_UNCOMPRESSED 9
+// size of the frame header preceding compressed coordinates
+#define XTC_HEADER_SIZE 92
+// size of the frame header preceding uncompressed coordinates
+#define XTC_SMALL_HEADER_SIZE 56
+// number of zero bytes that must follow the coordinates of a frame passed to the decoder
+#define XTC_PADDING 128
+
+typedef struct xtc_header {
+    int n_atoms;
+    int step;
+    float time;
+    float box[3][3];
+    float precision;
+    int minint[3];
+    int maxint[3];
+    int smallidx;
+    int n_bytes;        // length of the compressed coordinate block
+} xtc_header_t;
+
+/*
+ * Returns the number of bytes preceding the coordinates in a frame with n_atoms atoms.
+ */
+size_t xtc_header_size(int n_atoms);
+
+/*
+ * Returns the number of atoms stored in the frame header at data.
+ * data must contain at least 8 bytes.
+ */
+int xtc_peek_atoms(const unsigned char *data);
+
+/*
+ * Parses a frame header. data must contain at least xtc_header_size() bytes.
+ * Returns zero, if the header is valid. Else returns non-zero.
+ */
+int xtc_parse_header(const unsigned char *data, xtc_header_t *header);
+
+/*
+ * Returns the total size of the frame described by header, including the header itself.
+ */
+size_t xtc_frame_size(const xtc_header_t *header);
+
+/*
+ * Returns the maximal size of an encoded frame containing n_atoms atoms.
+ */
+size_t xtc_frame_bound(int n_atoms);
+
+/*
+ * Decodes coordinates of a frame into coords (3 * n_atoms floats).
+ * frame must point to the start of the frame and must be followed by XTC_PADDING readable bytes.
+ * work must have space for 3 * n_atoms integers.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+int xtc_decode(const unsigned char *frame, const xtc_header_t *header, float *coords, int *work);
+
+/*
+ * Decodes compressed coordinates of a frame into integers in units of 1 / precision.
+ * Coordinates are written into separate arrays x, y and z (n_atoms integers each).
+ * Produces exactly the integers from which xtc_decode calculates the coordinates,
+ * but reads the bit stream 64 bits at a time and splits common runs without divisions.
+ * frame must point to the start of the frame and must be followed by XTC_PADDING readable bytes.
+ * Returns zero, if successful. Else (also for uncompressed frames) returns non-zero.
+ */
+int xtc_decode_quantized(const unsigned char *frame, const xtc_header_t *header, int *x, int *y, int *z);
+
+/*
+ * Like xtc_decode_quantized, but stops as soon as at least the first n_decode atoms have been decoded.
+ * Atoms are compressed one after another, so the rest of the frame is not touched at all.
+ * A few more atoms (at most one run) may be written into x, y and z, which must still have space for n_atoms integers.
+ * Returns zero, if successful. Else returns non-zero.
+ */
+int xtc_decode_prefix(const unsigned char *frame, const xtc_header_t *header, int n_decode, int *x, int *y, int *z);
+
+/*
+ * Converts integer coordinates produced by xtc_decode_quantized into coords (3 * n_atoms floats).
+ * The result is bit-identical to the output of xtc_decode.
+ */
+void xtc_dequantize(const xtc_header_t *header, const int *x, const int *y, const int *z, float *coords);
+
+/*
+ * Encodes a frame with coordinates coords into output.
+ * Step, time, box, precision and number of atoms are taken from header.
+ * work must have space for 3 * n_atoms integers.
+ * Returns the size of the encoded frame or 0, if encoding has failed.
+ */
+size_t xtc_encode(unsigned char *output, size_t capacity, const xtc_header_t *header, const float *coords, int *work);
+
+/*
+ * Converts coords (3 * n_atoms floats) into integers in units of 1 / precision, rounding the same way as xtc_encode.
+ * Returns zero, if successful. Else (the scaled coordinates would overflow) returns non-zero.
+ */
+int xtc_quantize(const xtc_header_t *header, const float *coords, int *work);
+
+/*
+ * Encodes a compressed frame with integer coordinates work (x, y, z triplets in units of 1 / precision) into output.
+ * Produces exactly the same frame as xtc_encode, but packs the numbers using 64-bit arithmetic
+ * and writes the bit stream four bytes at a time.
+ * Step, time, box, precision and number of atoms are taken from header.
+ * The order of coordinates in work is changed during encoding.
+ * Returns the size of the encoded frame or 0, if encoding has failed or the frame would not be compressed.
+ */
+size_t xtc_encode_quantized(unsigned char *output, size_t capacity, const xtc_header_t *header, int *work);
+
+#endif /* XTC_H */